@@ -6,9 +6,12 @@
 function init()
 	print("MirageRender example.lua script file init() function.")
 	
-	-- Define multithreading info (0 for SDL_GetCPUCount())
+	-- Define multithreading info (0 for SDL_GetCPUCount(), optional true to pin threads to cores)
 	SetMThreadInitInfo(0)
 	
+	-- Define render tiles (size in pixels, order: "scanline", "morton" or "hilbert")
+	SetTileInitInfo(32, "hilbert")
+	
 	-- Define display
 	SetDisplayInitInfo(512, 512, 1)
 	
@@ -16,6 +19,18 @@ function init()
 	SetRadianceClamping(10.0)
 	SetMaxRecursion(10)
 	
+	-- Define sampler ("random", "stratified", "halton" or "sobol", strata per pixel for "stratified")
+	SetSampler("sobol", 16)
+	
+	-- Define renderer ("pathtracer" or "wavefront", the latter shades whole tiles of paths in sorted batches)
+	SetRenderer("pathtracer")
+	
+	-- Cache built ray acceleration structures in a directory ("" for off), later runs of the same scene map them in instead of building
+	SetAcceleratorCache("")
+	
+	-- Spend up to this many seconds after building a ray acceleration structure on rearranging its treelets (0 for off, optional treelet size 3 to 8, default 7)
+	SetAcceleratorOptimization(0)
+	
 	-- Some stuff with default values
 	v_zero = NewVector3(0, 0, 0)
 	v_full = NewVector3(1, 1, 1)
@@ -41,7 +56,7 @@ function init()
 	t_camera = NewTransform(v_camera, q_camera, v_full)
 	c_perspective = NewCameraPersp(t_camera, 4, 64, 70.0)
 	
-	-- Meshes
+	-- Meshes (to place one many times for the memory of a single copy, load it once with NewMesh & add each placement with AddShape(NewInstance(transform, mesh)) instead of AddMesh)
 	q_cornellbox = NewQuaternionLookAt(v_zero, NewVector3(0, 0, 1))
 	t_cornellbox = NewTransform(v_zero, q_cornellbox, v_full)
 	m_cornellbox = NewMesh(t_cornellbox, mat_diff_white, "cornellboxes/cornellbox_nolight.obj")
@@ -63,7 +78,11 @@ function init()
 	AddLight(l_point)
 	AddCamera(c_perspective)
 	
-	-- Build ray acceleration structure
+	-- Build ray acceleration structure ("bvh" splits at the median, "bvh_sah" by surface area: max leaf size [, bins, traversal cost, intersection cost],
+	-- "lbvh" sorts Morton codes, faster to build: max leaf size [, morton bits (30/63), sah top (true/false)],
+	-- "sbvh" also splits space, duplicating shapes that straddle a split: max leaf size [, duplication budget (0.25 adds up to 25% more references), bins, traversal cost, intersection cost],
+	-- "bvh4" & "bvh8" collapse the SAH tree to 4 or 8 children per node: same arguments as "bvh_sah" [, quantized (true/false), duplication budget (spatial splits if above 0)],
+	-- "lazybvh" builds only the top of an SAH tree & splits the rest the first time rays reach it, rendering starts sooner: same arguments as "bvh_sah")
 	AddRayAccelerator("bvh", 1)
 	
 end
\ No newline at end of file
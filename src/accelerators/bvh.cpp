@@ -3,257 +3,2117 @@
 // std includes
 #include <iostream>
 #include <algorithm>
-#include <ctime>
+#include <chrono>
+#include <atomic>
 
 // mirage includes
+#include "bvhcache.h"
 #include "../macros.h"
+#include "../utils/memutils.h"
+#include "../core/threadpool.h"
 
 namespace mirage
 {
 
+	// Deepest tree the traversal can walk, the median split stays far below it, the SAH falls back to it past
+	// BVH_MAX_SAH_DEPTH & treelet restructuring never takes a subtree past it
+	static const int BVH_STACK_SIZE = 128;
+
+	// Largest leaf a BVHLinearNode can reference
+	static const uint32_t BVH_MAX_LEAF_SIZE = 0xFFFF;
+
+	// Past this depth the SAH gives way to median splits, keeps the tree within the traversal stack
+	static const int BVH_MAX_SAH_DEPTH = 64;
+
+	// Most bins the SAH builder will use per node
+	static const unsigned BVH_MAX_SAH_BINS = 256;
+
+	// Primitives per chunk when a node is bounded, binned or partitioned by several threads
+	static const uint32_t BVH_BUILD_GRAIN = 4096;
+
+	// Smallest subtree handed to a thread of its own
+	static const uint32_t BVH_MIN_TASK_SIZE = 1024;
+
+	// Leading Morton code bits shared by all primitives of an LBVH treelet
+	static const int BVH_TREELET_BITS = 12;
+
+	// Bits sorted per radix sort pass
+	static const int BVH_RADIX_BITS = 8;
+
+	// Most subtrees a treelet can rearrange, the search goes through every subset of them
+	static const unsigned BVH_MAX_TREELET_LEAVES = 8;
+
+	// Treelet passes stop once one lowers the SAH cost by less than this fraction
+	static const float BVH_TREELET_MIN_GAIN = 0.001f;
+
+	// One SAH bin, count == 0 means bounds is unset
+	struct BVHBin
+	{
+		AABB bounds;
+		uint32_t count;
+
+		BVHBin() : count(0)
+		{
+
+		}
+	};
+
+	// One spatial split bin, references entering & leaving the bin are counted separately
+	struct BVHSpatialBin
+	{
+		AABB bounds;
+		uint32_t count;
+		uint32_t enter;
+		uint32_t exit;
+
+		BVHSpatialBin() : count(0), enter(0), exit(0)
+		{
+
+		}
+	};
+
+	// Packet origins & inverse directions, loaded once per traversal
+	struct BVHPacketRays
+	{
+		vfloat ox, oy, oz;
+		vfloat idx, idy, idz;
+
+		BVHPacketRays(const RayPacket & packet) :
+			ox(vfloat::load(packet.ox)), oy(vfloat::load(packet.oy)), oz(vfloat::load(packet.oz)),
+			idx(vfloat::load(packet.idx)), idy(vfloat::load(packet.idy)), idz(vfloat::load(packet.idz))
+		{
+
+		}
+	};
+
+	// Slab test of one box against all lanes, a lane hits if the box overlaps [0, tFar]
+	static inline int intersectPacket(const BVHLinearNode & node, const BVHPacketRays & r, const vfloat & tFar)
+	{
+		const vfloat t1 = (vfloat(node.pmin[0]) - r.ox) * r.idx;
+		const vfloat t2 = (vfloat(node.pmax[0]) - r.ox) * r.idx;
+		const vfloat t3 = (vfloat(node.pmin[1]) - r.oy) * r.idy;
+		const vfloat t4 = (vfloat(node.pmax[1]) - r.oy) * r.idy;
+		const vfloat t5 = (vfloat(node.pmin[2]) - r.oz) * r.idz;
+		const vfloat t6 = (vfloat(node.pmax[2]) - r.oz) * r.idz;
+
+		const vfloat tboxmin = vmax(vmax(vmin(t1, t2), vmin(t3, t4)), vmin(t5, t6));
+		const vfloat tboxmax = vmin(vmin(vmax(t1, t2), vmax(t3, t4)), vmax(t5, t6));
+
+		return movemask((tboxmax >= vmax(tboxmin, vfloat(0.0f))) & (tboxmin <= tFar));
+	}
+
+	// A node waiting on the traversal stack with the distance the ray enters its box
+	struct BVHStackEntry
+	{
+		uint32_t index;
+		float tEntry;
+	};
+
+	// Slab test of one node against a single ray, a hit if the box overlaps [tNear, tFar]
+	static inline bool intersectNode(const BVHLinearNode & node, const vec3 & ro, const vec3 & rd_inv, const float tNear, const float tFar, float & tEntry)
+	{
+		float t1 = (node.pmin[0] - ro.x) * rd_inv.x;
+		float t2 = (node.pmax[0] - ro.x) * rd_inv.x;
+		float t3 = (node.pmin[1] - ro.y) * rd_inv.y;
+		float t4 = (node.pmax[1] - ro.y) * rd_inv.y;
+		float t5 = (node.pmin[2] - ro.z) * rd_inv.z;
+		float t6 = (node.pmax[2] - ro.z) * rd_inv.z;
+
+		float tboxmin = std::max(std::max(std::min(t1, t2), std::min(t3, t4)), std::min(t5, t6));
+		float tboxmax = std::min(std::min(std::max(t1, t2), std::max(t3, t4)), std::max(t5, t6));
+
+		if (tboxmax < std::max(tboxmin, tNear) || tboxmin > tFar)
+		{
+			return false;
+		}
+
+		tEntry = tboxmin;
+
+		return true;
+	}
+
+	// Pushes the children of an interior node that overlap [tNear, tFar], the nearer one last so it's popped first
+	static inline void pushChildren(const BVHLinearNode * nodes, const uint32_t index, const vec3 & ro, const vec3 & rd_inv, const float tNear, const float tFar, BVHStackEntry * stack, int & stackSize)
+	{
+		BVHStackEntry l = { index + 1, 0.0f };
+		BVHStackEntry r = { nodes[index].offset, 0.0f };
+		const bool hitL = intersectNode(nodes[l.index], ro, rd_inv, tNear, tFar, l.tEntry);
+		const bool hitR = intersectNode(nodes[r.index], ro, rd_inv, tNear, tFar, r.tEntry);
+
+		if (hitL && hitR)
+		{
+			if (l.tEntry <= r.tEntry)
+				std::swap(l, r);
+			stack[stackSize++] = l;
+			stack[stackSize++] = r;
+		}
+		else if (hitL)
+		{
+			stack[stackSize++] = l;
+		}
+		else if (hitR)
+		{
+			stack[stackSize++] = r;
+		}
+	}
+
+	// Spreads the low 10 bits of x so there are two zero bits between each
+	static inline uint64_t expandBits10(uint64_t x)
+	{
+		x &= 0x3FF;
+		x = (x | (x << 16)) & 0x30000FF;
+		x = (x | (x << 8)) & 0x300F00F;
+		x = (x | (x << 4)) & 0x30C30C3;
+		x = (x | (x << 2)) & 0x9249249;
+		return x;
+	}
+
+	// Same for the low 21 bits of x
+	static inline uint64_t expandBits21(uint64_t x)
+	{
+		x &= 0x1FFFFF;
+		x = (x | (x << 32)) & 0x1F00000000FFFFULL;
+		x = (x | (x << 16)) & 0x1F0000FF0000FFULL;
+		x = (x | (x << 8)) & 0x100F00F00F00F00FULL;
+		x = (x | (x << 4)) & 0x10C30C30C30C30C3ULL;
+		x = (x | (x << 2)) & 0x1249249249249249ULL;
+		return x;
+	}
+
+	// Stable LSD radix sort on the low bits of the codes. Each pass histograms fixed size chunks
+	// in parallel and scatters every chunk to its own offsets, the result ends up in data
+	static void radixSort(std::vector<BVHMortonPrim> & data, std::vector<BVHMortonPrim> & scratch, const int bits)
+	{
+		const uint32_t count = static_cast<uint32_t>(data.size());
+		const uint32_t buckets = 1u << BVH_RADIX_BITS;
+		const uint32_t chunks = (count + BVH_BUILD_GRAIN - 1) / BVH_BUILD_GRAIN;
+		std::vector<uint32_t> offsets(chunks * buckets);
+
+		scratch.resize(count);
+		for (int shift = 0; shift < bits; shift += BVH_RADIX_BITS)
+		{
+			auto digitOf = [=](const BVHMortonPrim & p)
+			{
+				return static_cast<uint32_t>(p.code >> shift) & (buckets - 1);
+			};
+
+			// Count the digits of every chunk
+			ThreadPool::instance().parallelFor(chunks, [&](size_t c, unsigned)
+			{
+				uint32_t * histogram = &offsets[c * buckets];
+				std::fill(histogram, histogram + buckets, 0u);
+
+				const uint32_t s = static_cast<uint32_t>(c) * BVH_BUILD_GRAIN;
+				const uint32_t e = std::min(count, s + BVH_BUILD_GRAIN);
+				for (uint32_t i = s; i < e; i++)
+					histogram[digitOf(data[i])]++;
+			});
+
+			// Turn the counts into output offsets, digit major so equal digits keep their chunk order
+			uint32_t sum = 0;
+			for (uint32_t d = 0; d < buckets; d++)
+			{
+				for (uint32_t c = 0; c < chunks; c++)
+				{
+					const uint32_t n = offsets[c * buckets + d];
+					offsets[c * buckets + d] = sum;
+					sum += n;
+				}
+			}
+
+			ThreadPool::instance().parallelFor(chunks, [&](size_t c, unsigned)
+			{
+				uint32_t * offset = &offsets[c * buckets];
+
+				const uint32_t s = static_cast<uint32_t>(c) * BVH_BUILD_GRAIN;
+				const uint32_t e = std::min(count, s + BVH_BUILD_GRAIN);
+				for (uint32_t i = s; i < e; i++)
+					scratch[offset[digitOf(data[i])]++] = data[i];
+			});
+
+			data.swap(scratch);
+		}
+	}
+
+	// First index of a sorted code range whose highest differing bit is set. Bits the whole range
+	// agrees on are skipped and bit is left at the one split on, or -1 if all codes are equal
+	static uint32_t findMortonSplit(const std::vector<BVHMortonPrim> & morton, const uint32_t start, const uint32_t end, int & bit)
+	{
+		for (; bit >= 0; bit--)
+		{
+			// The range is sorted, so the bits its first & last code agree on are the same for all of it
+			const uint64_t bitMask = 1ULL << bit;
+			if ((morton[start].code & bitMask) == (morton[end - 1].code & bitMask))
+				continue;
+
+			uint32_t lo = start;
+			uint32_t hi = end - 1;
+			while (lo + 1 < hi)
+			{
+				const uint32_t mid = lo + ((hi - lo) >> 1);
+				if (morton[mid].code & bitMask)
+					hi = mid;
+				else
+					lo = mid;
+			}
+			return hi;
+		}
+
+		// Once the bits run out the range is simply halved
+		return start + ((end - start) >> 1);
+	}
+
+	// Bounds of count primitives & of their centroids. Fixed size chunks, so the result doesn't depend on the thread count
+	static void boundPrimitives(const BVHPrimitiveInfo * prims, const uint32_t count, AABB & bbox, AABB & cbox)
+	{
+		const uint32_t chunks = (count + BVH_BUILD_GRAIN - 1) / BVH_BUILD_GRAIN;
+		std::vector<AABB> chunkBox(chunks);
+		std::vector<AABB> chunkCentroids(chunks);
+
+		auto boundChunk = [&](size_t c, unsigned)
+		{
+			const uint32_t s = static_cast<uint32_t>(c) * BVH_BUILD_GRAIN;
+			const uint32_t e = std::min(count, s + BVH_BUILD_GRAIN);
+
+			AABB b = prims[s].bounds;
+			AABB cb(prims[s].centroid, prims[s].centroid);
+			for (uint32_t i = s + 1; i < e; i++)
+			{
+				b = b.addBox(prims[i].bounds);
+				cb = cb.addPoint(prims[i].centroid);
+			}
+			chunkBox[c] = b;
+			chunkCentroids[c] = cb;
+		};
+
+		if (chunks > 1)
+			ThreadPool::instance().parallelFor(chunks, boundChunk);
+		else
+			boundChunk(0, 0);
+
+		bbox = chunkBox[0];
+		cbox = chunkCentroids[0];
+		for (uint32_t c = 1; c < chunks; c++)
+		{
+			bbox = bbox.addBox(chunkBox[c]);
+			cbox = cbox.addBox(chunkCentroids[c]);
+		}
+	}
+
+	// Bin of value when [min, min + binCount / scale] is cut into binCount equal bins
+	static inline unsigned binIndex(const float value, const float min, const float scale, const unsigned binCount)
+	{
+		return std::min(static_cast<unsigned>(std::max(value - min, 0.0f) * scale), binCount - 1);
+	}
+
+	// Surface area of the overlap of two boxes
+	static inline float overlapArea(const AABB & a, const AABB & b)
+	{
+		vec3 pmin;
+		vec3 pmax;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			pmin[axis] = std::max(a.getMin()[axis], b.getMin()[axis]);
+			pmax[axis] = std::min(a.getMax()[axis], b.getMax()[axis]);
+			if (pmin[axis] > pmax[axis])
+				return 0.0f;
+		}
+		return AABB(pmin, pmax).getSurfaceArea();
+	}
+
+	// Cheapest object split of refs over all three axes, binned by centroid like BVHAccel::splitSAH
+	static void findObjectSplit(const std::vector<BVHPrimitiveInfo> & refs, const AABB & cbox, const unsigned binCount, BVHSplitCandidate & best)
+	{
+		const uint32_t count = static_cast<uint32_t>(refs.size());
+		const vec3 cmin = cbox.getMin();
+		const vec3 extent = cbox.getMax() - cmin;
+		vec3 scale;
+		for (int axis = 0; axis < 3; axis++)
+			scale[axis] = extent[axis] > 0.0f ? binCount / extent[axis] : 0.0f;
+
+		const uint32_t chunks = (count + BVH_BUILD_GRAIN - 1) / BVH_BUILD_GRAIN;
+		std::vector<BVHBin> chunkBins(chunks * 3 * binCount);
+
+		auto binChunk = [&](size_t c, unsigned)
+		{
+			const uint32_t s = static_cast<uint32_t>(c) * BVH_BUILD_GRAIN;
+			const uint32_t e = std::min(count, s + BVH_BUILD_GRAIN);
+
+			for (int axis = 0; axis < 3; axis++)
+			{
+				if (extent[axis] <= 0.0f)
+					continue;
+
+				BVHBin * bins = &chunkBins[(c * 3 + axis) * binCount];
+				for (uint32_t i = s; i < e; i++)
+				{
+					BVHBin & bin = bins[binIndex(refs[i].centroid[axis], cmin[axis], scale[axis], binCount)];
+					bin.bounds = bin.count ? bin.bounds.addBox(refs[i].bounds) : refs[i].bounds;
+					bin.count++;
+				}
+			}
+		};
+
+		if (chunks > 1)
+			ThreadPool::instance().parallelFor(chunks, binChunk);
+		else
+			binChunk(0, 0);
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (extent[axis] <= 0.0f)
+				continue;
+
+			// Merge the chunks into the first set
+			BVHBin * bins = &chunkBins[axis * binCount];
+			for (uint32_t c = 1; c < chunks; c++)
+			{
+				for (unsigned b = 0; b < binCount; b++)
+				{
+					const BVHBin & other = chunkBins[(c * 3 + axis) * binCount + b];
+					if (!other.count)
+						continue;
+					bins[b].bounds = bins[b].count ? bins[b].bounds.addBox(other.bounds) : other.bounds;
+					bins[b].count += other.count;
+				}
+			}
+
+			float rightArea[BVH_MAX_SAH_BINS];
+			uint32_t rightCount[BVH_MAX_SAH_BINS];
+			AABB accum;
+			uint32_t accumCount = 0;
+			for (unsigned b = binCount - 1; b > 0; b--)
+			{
+				if (bins[b].count)
+				{
+					accum = accumCount ? accum.addBox(bins[b].bounds) : bins[b].bounds;
+					accumCount += bins[b].count;
+				}
+				rightArea[b - 1] = accumCount ? accum.getSurfaceArea() : 0.0f;
+				rightCount[b - 1] = accumCount;
+			}
+
+			bool improved = false;
+			accumCount = 0;
+			for (unsigned b = 0; b < binCount - 1; b++)
+			{
+				if (bins[b].count)
+				{
+					accum = accumCount ? accum.addBox(bins[b].bounds) : bins[b].bounds;
+					accumCount += bins[b].count;
+				}
+				if (accumCount == 0 || rightCount[b] == 0)
+					continue;
+
+				const float cost = accumCount * accum.getSurfaceArea() + rightCount[b] * rightArea[b];
+				if (cost < best.cost)
+				{
+					best.cost = cost;
+					best.axis = axis;
+					best.bin = b;
+					best.left = accum;
+					best.leftCount = accumCount;
+					best.rightCount = rightCount[b];
+					improved = true;
+				}
+			}
+
+			// Only the areas were kept on the way back, bound the right side of the winner again
+			if (improved)
+			{
+				accumCount = 0;
+				for (unsigned b = best.bin + 1; b < binCount; b++)
+				{
+					if (bins[b].count)
+					{
+						best.right = accumCount ? best.right.addBox(bins[b].bounds) : bins[b].bounds;
+						accumCount += bins[b].count;
+					}
+				}
+			}
+		}
+	}
+
+	// Moves the leaves of a subtree built into its own reference list along by base
+	static void shiftLeaves(BVHNode * node, const uint32_t base)
+	{
+		if (node->isLeaf())
+		{
+			node->prim_offset += base;
+			return;
+		}
+
+		shiftLeaves(node->l_child, base);
+		shiftLeaves(node->r_child, base);
+	}
+
+	// SAH cost of a build tree, not yet divided by the surface area of its root
+	static double treeCost(const BVHNode * node, const BVHBuildParams & params)
+	{
+		if (node->isLeaf())
+			return params.intersectionCost * node->prim_count * node->aabb.getSurfaceArea();
+
+		return params.traversalCost * node->aabb.getSurfaceArea() + treeCost(node->l_child, params) + treeCost(node->r_child, params);
+	}
+
+	// Levels of every subtree, stored in the nodes
+	static uint32_t computeHeights(BVHNode * node)
+	{
+		node->height = node->isLeaf() ? 1 : 1 + std::max(computeHeights(node->l_child), computeHeights(node->r_child));
+		return node->height;
+	}
+
+	// Levels the treelet subtrees in set would take up when linked following the best partitions
+	static uint32_t treeletHeight(const unsigned set, BVHNode * const * leaves, const uint8_t * partition)
+	{
+		if ((set & (set - 1)) == 0)
+		{
+			unsigned leaf = 0;
+			while (!(set & (1u << leaf)))
+				leaf++;
+			return leaves[leaf]->height;
+		}
+
+		return 1 + std::max(treeletHeight(partition[set], leaves, partition), treeletHeight(set ^ partition[set], leaves, partition));
+	}
+
+	// Links the treelet subtrees in set below node following the best partitions, taking interior nodes from the treelet's own
+	static void linkTreelet(BVHNode * node, const unsigned set, BVHNode * const * leaves, BVHNode * const * interiors, unsigned & next, const uint8_t * partition, const AABB * bounds)
+	{
+		BVHNode ** child[2] = { &node->l_child, &node->r_child };
+		const unsigned sides[2] = { partition[set], set ^ partition[set] };
+		for (int c = 0; c < 2; c++)
+		{
+			if ((sides[c] & (sides[c] - 1)) == 0)
+			{
+				unsigned leaf = 0;
+				while (!(sides[c] & (1u << leaf)))
+					leaf++;
+				*child[c] = leaves[leaf];
+			}
+			else
+			{
+				*child[c] = interiors[next++];
+				linkTreelet(*child[c], sides[c], leaves, interiors, next, partition, bounds);
+			}
+		}
+
+		// Children are ordered along the axis their centres are furthest apart on, which the traversal relies on
+		const vec3 offset = node->r_child->aabb.getCentroid() - node->l_child->aabb.getCentroid();
+		node->split_axis = std::abs(offset.x) >= std::abs(offset.y) && std::abs(offset.x) >= std::abs(offset.z) ? 0 : (std::abs(offset.y) >= std::abs(offset.z) ? 1 : 2);
+		if (offset[node->split_axis] < 0.0f)
+			std::swap(node->l_child, node->r_child);
+		node->aabb = bounds[set];
+		node->height = 1 + std::max(node->l_child->height, node->r_child->height);
+	}
+
+	// Grows a treelet of up to maxLeaves subtrees below root, always opening the largest, and rearranges it into the
+	// topology with the lowest summed interior surface area. The subtrees & root stay, so the rest of the tree is untouched.
+	// root is depth levels below the top, a topology that would reach past the traversal stack is turned down unless the
+	// treelet already did. Heights must be current
+	static bool restructureTreelet(BVHNode * root, const unsigned maxLeaves, const uint32_t depth)
+	{
+		BVHNode * leaves[BVH_MAX_TREELET_LEAVES];
+		BVHNode * interiors[BVH_MAX_TREELET_LEAVES - 1];
+		unsigned leafCount = 2;
+		unsigned interiorCount = 1;
+		leaves[0] = root->l_child;
+		leaves[1] = root->r_child;
+		interiors[0] = root;
+		float currentArea = root->aabb.getSurfaceArea();
+
+		while (leafCount < maxLeaves)
+		{
+			int largest = -1;
+			float largestArea = -1.0f;
+			for (unsigned i = 0; i < leafCount; i++)
+			{
+				const float area = leaves[i]->aabb.getSurfaceArea();
+				if (!leaves[i]->isLeaf() && area > largestArea)
+				{
+					largest = static_cast<int>(i);
+					largestArea = area;
+				}
+			}
+			if (largest < 0)
+				break;
+
+			BVHNode * opened = leaves[largest];
+			interiors[interiorCount++] = opened;
+			currentArea += largestArea;
+			leaves[largest] = opened->l_child;
+			leaves[leafCount++] = opened->r_child;
+		}
+
+		// Two subtrees can only be joined one way
+		if (leafCount < 3)
+			return false;
+
+		// Subsets are numbered so every subset of a set comes before it, the best cost of a set is its own area plus the cheapest way to partition it
+		const unsigned setCount = 1u << leafCount;
+		AABB bounds[1u << BVH_MAX_TREELET_LEAVES];
+		float cost[1u << BVH_MAX_TREELET_LEAVES];
+		uint8_t partition[1u << BVH_MAX_TREELET_LEAVES];
+		for (unsigned set = 1; set < setCount; set++)
+		{
+			const unsigned lowest = set & (0u - set);
+			if (set == lowest)
+			{
+				unsigned leaf = 0;
+				while (!(set & (1u << leaf)))
+					leaf++;
+				bounds[set] = leaves[leaf]->aabb;
+				cost[set] = 0.0f;
+				continue;
+			}
+
+			bounds[set] = bounds[set ^ lowest].addBox(bounds[lowest]);
+
+			// Each partition is visited once, from the side holding the lowest subtree
+			float best = INFINITY;
+			for (unsigned part = (set - 1) & set; part > 0; part = (part - 1) & set)
+			{
+				if (!(part & lowest))
+					continue;
+
+				const float c = cost[part] + cost[set ^ part];
+				if (c < best)
+				{
+					best = c;
+					partition[set] = static_cast<uint8_t>(part);
+				}
+			}
+			cost[set] = bounds[set].getSurfaceArea() + best;
+		}
+
+		// Leave the treelet alone unless it gets noticeably better, rounding alone shouldn't shuffle nodes around
+		const unsigned all = setCount - 1;
+		if (cost[all] >= currentArea * (1.0f - 1e-5f))
+			return false;
+
+		// Lower cost may come as a chain, which must not outgrow the traversal stack
+		const uint32_t maxHeight = depth < static_cast<uint32_t>(BVH_STACK_SIZE) ? BVH_STACK_SIZE - depth : 0;
+		if (treeletHeight(all, leaves, partition) > std::max(root->height, maxHeight))
+			return false;
+
+		unsigned next = 1;
+		linkTreelet(root, all, leaves, interiors, next, partition, bounds);
+		return true;
+	}
+
+	// Restructures every treelet of a subtree bottom-up until the deadline, depth is the level of node below the root
+	static void restructureSubtree(BVHNode * node, const unsigned maxLeaves, const uint32_t depth, const std::chrono::steady_clock::time_point & deadline)
+	{
+		if (node->isLeaf())
+			return;
+
+		restructureSubtree(node->l_child, maxLeaves, depth + 1, deadline);
+		restructureSubtree(node->r_child, maxLeaves, depth + 1, deadline);
+		node->height = 1 + std::max(node->l_child->height, node->r_child->height);
+		if (std::chrono::steady_clock::now() < deadline)
+			restructureTreelet(node, maxLeaves, depth);
+	}
+
 	// ------------------------------------------------------------------------
 	// BVH Node Object
 	// ------------------------------------------------------------------------
-	BVHNode::BVHNode(int axis, float pos, std::vector<Shape *> data, AABB bbox) :
+	BVHNode::BVHNode(int axis, uint32_t offset, uint32_t count, AABB bbox) :
 		split_axis(axis),
-		split_pos(pos),
-		data(data),
+		prim_offset(offset),
+		prim_count(count),
+		height(1),
 		aabb(bbox),
 		l_child(nullptr),
 		r_child(nullptr)
 	{
 	}
 
-	BVHNode::~BVHNode()
+	BVHNode::~BVHNode()
+	{
+		DELETE(l_child);
+		DELETE(r_child);
+	}
+
+	bool BVHNode::isLeaf() const
+	{
+		return (l_child == nullptr) && (r_child == nullptr);
+	}
+
+	// ------------------------------------------------------------------------
+	// BVH Accelerator Object
+	// ------------------------------------------------------------------------
+	BVHAccel::BVHAccel(const std::vector<Shape *> shapes, const BVHBuildParams & params) :
+		Accelerator(shapes),
+		m_params(params),
+		m_nodes(nullptr),
+		m_nodeCount(0),
+		m_builtSAHCost(0.0f),
+		m_buildTaskSize(0),
+		m_buildRootArea(0.0f)
+	{
+		LOG("BVHAccel: a New instance was created.");
+		LOG("BVHAccel: Number of loaded shapes: " << m_shapes.size());
+	}
+
+	BVHAccel::~BVHAccel()
+	{
+		freeNodes(m_nodes);
+	}
+
+	bool BVHAccel::update()
+	{
+		if (!m_initialized)
+			return false;
+
+		// Re-transform the shapes whose transform changed since the last update, each once even if spatial splits duplicated it
+		const std::vector<Shape *> & shapes = m_sceneShapes.empty() ? m_shapes : m_sceneShapes;
+		std::atomic<bool> moved(false);
+		ThreadPool::instance().parallelFor(shapes.size(), [&](size_t i, unsigned)
+		{
+			if (shapes[i]->getTransform().reqStateUpdate())
+			{
+				shapes[i]->update();
+				moved = true;
+			}
+		}, BVH_BUILD_GRAIN);
+
+		if (!moved)
+			return false;
+
+		refit();
+
+		// Refitting keeps the topology, which gets worse the further things move from where they were built
+		const float cost = getSAHCost();
+		if (cost > m_builtSAHCost * std::max(m_params.rebuildRatio, 1.0f))
+		{
+			LOG("BVHAccel: SAH cost went from " << m_builtSAHCost << " to " << cost << " after the refit, rebuilding.");
+			init();
+		}
+		else
+		{
+			MLOG_DEBUG("BVHAccel: Refit, SAH cost: %f.", cost);
+		}
+
+		return true;
+	}
+
+	bool BVHAccel::intersect(const Ray & ray, Hit & hit)
+	{
+		bool result = false;
+
+		const vec3 ro = ray.getOrigin();
+		const vec3 rd_inv = ray.getDirectionInv();
+
+		// Depth-first walk, nearer child first so the closest hit shrinks hit.t early
+		BVHStackEntry stack[BVH_STACK_SIZE];
+		int stackSize = 0;
+		if (m_nodeCount > 0 && intersectNode(m_nodes[0], ro, rd_inv, ray.mint, hit.t, stack[0].tEntry))
+		{
+			stack[0].index = 0;
+			stackSize = 1;
+		}
+		while (stackSize > 0)
+		{
+			const BVHStackEntry entry = stack[--stackSize];
+
+			// Closer hits may have been found since this was pushed
+			if (entry.tEntry > hit.t)
+				continue;
+
+			const BVHLinearNode & node = m_nodes[entry.index];
+			if (node.isLeaf())
+			{
+				if (m_leafPacks.intersect(m_shapes, node.offset, ray, hit))
+					result = true;
+			}
+			else
+			{
+				pushChildren(m_nodes, entry.index, ro, rd_inv, ray.mint, hit.t, stack, stackSize);
+			}
+		}
+
+		return result;
+	}
+
+	bool BVHAccel::intersectP(const Ray & ray)
+	{
+		const vec3 ro = ray.getOrigin();
+		const vec3 rd_inv = ray.getDirectionInv();
+
+		// Same walk as intersect(), but [mint, maxt] never shrinks & the first occluder ends it
+		BVHStackEntry stack[BVH_STACK_SIZE];
+		int stackSize = 0;
+		if (m_nodeCount > 0 && intersectNode(m_nodes[0], ro, rd_inv, ray.mint, ray.maxt, stack[0].tEntry))
+		{
+			stack[0].index = 0;
+			stackSize = 1;
+		}
+		while (stackSize > 0)
+		{
+			const BVHStackEntry entry = stack[--stackSize];
+			const BVHLinearNode & node = m_nodes[entry.index];
+
+			if (node.isLeaf())
+			{
+				if (m_leafPacks.intersectP(m_shapes, node.offset, ray))
+					return true;
+			}
+			else
+			{
+				pushChildren(m_nodes, entry.index, ro, rd_inv, ray.mint, ray.maxt, stack, stackSize);
+			}
+		}
+
+		return false;
+	}
+
+	int BVHAccel::intersect(const RayPacket & packet, Intersection * iSects)
+	{
+		const BVHPacketRays rays(packet);
+		Hit hits[RayPacket::WIDTH];
+		float tHit[RayPacket::WIDTH];
+		for (unsigned i = 0; i < RayPacket::WIDTH; i++)
+		{
+			hits[i] = Hit(packet.maxt[i]);
+			tHit[i] = packet.maxt[i];
+		}
+
+		// Children are ordered by the direction of the first active lane, the rays of a packet are coherent
+		unsigned first = 0;
+		while (first + 1 < RayPacket::WIDTH && !(packet.mask & (1 << first)))
+			first++;
+		const bool dirIsNeg[3] = { packet.dx[first] < 0.0f, packet.dy[first] < 0.0f, packet.dz[first] < 0.0f };
+
+		// Walk the tree once for the whole packet, a node is entered if any lane still wants it
+		uint32_t stack[BVH_STACK_SIZE];
+		int stackSize = 0;
+		if (m_nodeCount > 0)
+			stack[stackSize++] = 0;
+		while (stackSize > 0)
+		{
+			const uint32_t index = stack[--stackSize];
+			const BVHLinearNode & node = m_nodes[index];
+
+			const int mask = intersectPacket(node, rays, vfloat::load(tHit)) & packet.mask;
+			if (!mask)
+				continue;
+
+			if (node.isLeaf())
+			{
+				const uint32_t offset = m_leafPacks.getOffset(node.offset);
+				for (uint32_t k = offset; k < offset + node.prim_count; k++)
+				{
+					int lanes = m_shapes[k]->intersect(packet, mask, hits);
+					for (unsigned i = 0; lanes; i++, lanes >>= 1)
+					{
+						if (lanes & 1)
+						{
+							hits[i].prim = k;
+							tHit[i] = hits[i].t;
+						}
+					}
+				}
+			}
+			else if (dirIsNeg[node.split_axis])
+			{
+				stack[stackSize++] = index + 1;
+				stack[stackSize++] = node.offset;
+			}
+			else
+			{
+				stack[stackSize++] = node.offset;
+				stack[stackSize++] = index + 1;
+			}
+		}
+
+		// Fill the surface data only for the closest hit of each lane
+		int result = 0;
+		for (unsigned i = 0; i < RayPacket::WIDTH; i++)
+		{
+			if (hits[i].prim == Hit::NONE)
+				continue;
+
+			getIntersection(packet.rays[i], hits[i], iSects[i]);
+			result |= 1 << i;
+		}
+
+		return result;
+	}
+
+	int BVHAccel::intersectP(const RayPacket & packet)
+	{
+		const BVHPacketRays rays(packet);
+		const vfloat maxt = vfloat::load(packet.maxt);
+		int active = packet.mask;
+		int result = 0;
+
+		uint32_t stack[BVH_STACK_SIZE];
+		int stackSize = 0;
+		if (m_nodeCount > 0)
+			stack[stackSize++] = 0;
+		while (stackSize > 0 && active)
+		{
+			const uint32_t index = stack[--stackSize];
+			const BVHLinearNode & node = m_nodes[index];
+
+			int mask = intersectPacket(node, rays, maxt) & active;
+			if (!mask)
+				continue;
+
+			if (node.isLeaf())
+			{
+				// Blocked lanes are done, drop them from the rest of the walk
+				const uint32_t offset = m_leafPacks.getOffset(node.offset);
+				for (uint32_t k = offset; k < offset + node.prim_count; k++)
+				{
+					const int blocked = m_shapes[k]->intersectP(packet, mask);
+					result |= blocked;
+					active &= ~blocked;
+					mask &= ~blocked;
+					if (!mask)
+						break;
+				}
+			}
+			else
+			{
+				stack[stackSize++] = node.offset;
+				stack[stackSize++] = index + 1;
+			}
+		}
+
+		return result;
+	}
+
+	void BVHAccel::init()
+	{
+		LOG("BVHAccel: Started building the hierarchy...");
+		auto startTime = std::chrono::steady_clock::now();
+
+		// Hashed before the build reorders the shapes
+		const bool cached = isCached();
+		const uint64_t cacheKey = cached ? getBVHCacheKey(m_shapes, m_params, 2, sizeof(BVHLinearNode)) : 0;
+
+		void * nodes = nullptr;
+		uint32_t nodeCount = 0;
+		if (cached && loadCache(cacheKey, sizeof(BVHLinearNode), nodes, nodeCount))
+		{
+			m_nodes = static_cast<BVHLinearNode *>(nodes);
+			m_nodeCount = nodeCount;
+		}
+		else
+		{
+			BVHNode * root = buildTree(nodeCount);
+
+			// Flatten it depth-first into one cache-line aligned block
+			freeNodes(m_nodes);
+			m_nodes = static_cast<BVHLinearNode *>(alignedAlloc(std::max<size_t>(nodeCount, 1) * sizeof(BVHLinearNode), 64));
+			m_nodeCount = nodeCount;
+
+			uint32_t offset = 0;
+			if (root)
+				flatten(root, offset);
+			DELETE(root);
+
+			if (cached)
+				saveCache(cacheKey, m_nodes, sizeof(BVHLinearNode), m_nodeCount);
+		}
+
+		// Leaves point at their typed ranges from here on, the cache above keeps the shape offsets
+		std::vector<BVHLeafRange> leaves;
+		for (uint32_t i = 0; i < m_nodeCount; i++)
+		{
+			if (m_nodes[i].isLeaf())
+			{
+				BVHLeafRange leaf = { m_nodes[i].offset, m_nodes[i].prim_count };
+				m_nodes[i].offset = static_cast<uint32_t>(leaves.size());
+				leaves.push_back(leaf);
+			}
+		}
+		m_leafPacks.build(m_shapes, leaves);
+
+		float duration = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
+
+		m_initialized = true;
+		m_builtSAHCost = getSAHCost();
+		LOG("BVHAccel: Build finished! Time taken: " << duration << "s on " << ThreadPool::instance().getThreadCount() << " threads.");
+		LOG("BVHAccel: " << m_nodeCount << " nodes, " << (m_nodeCount * sizeof(BVHLinearNode) + m_shapes.size() * sizeof(Shape *)) / 1024 << " KiB, SAH cost: " << m_builtSAHCost << ".");
+		LOG("BVHAccel: " << leaves.size() << " leaves sorted by type, triangles " << MIRAGE_SIMD_WIDTH << " wide, into " << m_leafPacks.getMemoryUsage() / 1024 << " KiB.");
+	}
+
+	float BVHAccel::getSAHCost() const
+	{
+		if (m_nodeCount == 0)
+			return 0.0f;
+
+		// Expected cost of a random ray through the root, each node weighted by its chance of being hit
+		const float rootArea = AABB(vec3(m_nodes[0].pmin[0], m_nodes[0].pmin[1], m_nodes[0].pmin[2]), vec3(m_nodes[0].pmax[0], m_nodes[0].pmax[1], m_nodes[0].pmax[2])).getSurfaceArea();
+		if (rootArea <= 0.0f)
+			return m_params.intersectionCost * m_shapes.size();
+
+		double cost = 0.0;
+		for (uint32_t i = 0; i < m_nodeCount; i++)
+		{
+			const BVHLinearNode & node = m_nodes[i];
+			const float area = AABB(vec3(node.pmin[0], node.pmin[1], node.pmin[2]), vec3(node.pmax[0], node.pmax[1], node.pmax[2])).getSurfaceArea();
+			cost += (node.isLeaf() ? m_params.intersectionCost * node.prim_count : m_params.traversalCost) * area / rootArea;
+		}
+
+		return static_cast<float>(cost);
+	}
+
+	void BVHAccel::refit()
+	{
+		// Subtrees are contiguous in the depth-first array & children come after their parent, so walking
+		// a subtree backwards refits it bottom-up. Small enough subtrees are handed to the threads whole
+		const uint32_t taskSize = std::max(BVH_MIN_TASK_SIZE, m_nodeCount / (ThreadPool::instance().getThreadCount() * 8));
+		std::vector<std::pair<uint32_t, uint32_t>> tasks;
+		std::vector<uint32_t> upper;
+		std::vector<std::pair<uint32_t, uint32_t>> ranges;
+		if (m_nodeCount > 0)
+			ranges.push_back(std::make_pair(0u, m_nodeCount));
+		while (!ranges.empty())
+		{
+			const std::pair<uint32_t, uint32_t> range = ranges.back();
+			ranges.pop_back();
+
+			const BVHLinearNode & node = m_nodes[range.first];
+			if (range.second - range.first <= taskSize || node.isLeaf())
+			{
+				tasks.push_back(range);
+				continue;
+			}
+
+			upper.push_back(range.first);
+			ranges.push_back(std::make_pair(range.first + 1, node.offset));
+			ranges.push_back(std::make_pair(node.offset, range.second));
+		}
+
+		ThreadPool::instance().parallelFor(tasks.size(), [&](size_t t, unsigned)
+		{
+			for (uint32_t i = tasks[t].second; i > tasks[t].first; i--)
+				refitNode(i - 1);
+		});
+
+		// The nodes above the subtrees were collected parents first
+		for (size_t i = upper.size(); i > 0; i--)
+			refitNode(upper[i - 1]);
+
+		m_leafPacks.refit(m_shapes);
+	}
+
+	void BVHAccel::refitNode(const uint32_t index)
+	{
+		BVHLinearNode & node = m_nodes[index];
+
+		if (!node.isLeaf())
+		{
+			const BVHLinearNode & left = m_nodes[index + 1];
+			const BVHLinearNode & right = m_nodes[node.offset];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				node.pmin[axis] = std::min(left.pmin[axis], right.pmin[axis]);
+				node.pmax[axis] = std::max(left.pmax[axis], right.pmax[axis]);
+			}
+			return;
+		}
+
+		const uint32_t offset = m_leafPacks.getOffset(node.offset);
+		AABB bbox = m_shapes[offset]->worldBound();
+		for (uint32_t k = offset + 1; k < offset + node.prim_count; k++)
+			bbox = bbox.addBox(m_shapes[k]->worldBound());
+
+		const vec3 & pmin = bbox.getMin();
+		const vec3 & pmax = bbox.getMax();
+		node.pmin[0] = pmin.x; node.pmin[1] = pmin.y; node.pmin[2] = pmin.z;
+		node.pmax[0] = pmax.x; node.pmax[1] = pmax.y; node.pmax[2] = pmax.z;
+	}
+
+	bool BVHAccel::isCached() const
+	{
+		// Rebuilds from update() are never cached, the shapes have moved since the scene was loaded
+		return !m_initialized && !m_shapes.empty() && !m_params.cacheDirectory.empty();
+	}
+
+	bool BVHAccel::loadCache(const uint64_t key, const std::size_t nodeSize, void *& nodes, uint32_t & nodeCount)
+	{
+		const std::string path = getBVHCachePath(m_params.cacheDirectory, key);
+		const uint32_t primCount = static_cast<uint32_t>(m_shapes.size());
+
+		const uint32_t * order = nullptr;
+		uint32_t refCount = 0;
+		if (!loadBVHCache(path, key, nodeSize, primCount, m_cacheFile, order, refCount, nodes, nodeCount))
+			return false;
+
+		std::vector<Shape *> ordered(refCount);
+		ThreadPool::instance().parallelFor(refCount, [&](size_t i, unsigned)
+		{
+			ordered[i] = m_shapes[order[i]];
+		}, BVH_BUILD_GRAIN);
+		if (refCount > primCount)
+			m_sceneShapes.swap(m_shapes);
+		m_shapes.swap(ordered);
+
+		LOG("BVHAccel: Loaded the hierarchy from " << path << ".");
+		return true;
+	}
+
+	void BVHAccel::saveCache(const uint64_t key, const void * nodes, const std::size_t nodeSize, const uint32_t nodeCount)
+	{
+		const std::string path = getBVHCachePath(m_params.cacheDirectory, key);
+
+		const uint32_t shapeCount = static_cast<uint32_t>(m_sceneShapes.empty() ? m_shapes.size() : m_sceneShapes.size());
+		if (saveBVHCache(path, key, shapeCount, m_buildOrder, nodes, nodeSize, nodeCount))
+		{
+			LOG("BVHAccel: Saved the hierarchy to " << path << ".");
+		}
+		else
+		{
+			WRN("BVHAccel: Couldn't save the hierarchy to " << path << ".");
+		}
+		std::vector<uint32_t>().swap(m_buildOrder);
+	}
+
+	void BVHAccel::freeNodes(void * nodes)
+	{
+		// Nodes loaded from the cache live in the mapping, which goes with them
+		if (m_cacheFile.contains(nodes))
+			m_cacheFile.close();
+		else
+			alignedFree(nodes);
+	}
+
+	BVHNode * BVHAccel::buildTree(uint32_t & nodeCount)
+	{
+		ThreadPool & threadPool = ThreadPool::instance();
+
+		// Rebuilds start over from the shapes without the references spatial splits added
+		if (!m_sceneShapes.empty())
+		{
+			m_shapes.swap(m_sceneShapes);
+			std::vector<Shape *>().swap(m_sceneShapes);
+		}
+		const uint32_t primCount = static_cast<uint32_t>(m_shapes.size());
+
+		// Bounds & centroids are computed once, the builder partitions these instead of the shapes
+		m_buildPrims.resize(primCount);
+		m_buildScratch.resize(primCount);
+		threadPool.parallelFor(primCount, [&](size_t i, unsigned)
+		{
+			m_buildPrims[i].bounds = m_shapes[i]->worldBound();
+			m_buildPrims[i].centroid = m_buildPrims[i].bounds.getCentroid();
+			m_buildPrims[i].index = static_cast<uint32_t>(i);
+		}, BVH_BUILD_GRAIN);
+
+		// Split the top of the tree with all threads, nodes below the task size become independent subtrees
+		BVHNode * root = nullptr;
+		if (primCount > 0 && m_params.splitMethod == BVH_SPLIT_LBVH)
+		{
+			root = buildLBVH(nodeCount);
+		}
+		else if (primCount > 0 && m_params.splitMethod == BVH_SPLIT_SBVH)
+		{
+			root = buildSBVH(nodeCount);
+		}
+		else if (primCount > 0)
+		{
+			std::vector<BVHBuildTask> tasks;
+			m_buildTaskSize = std::max(BVH_MIN_TASK_SIZE, primCount / (threadPool.getThreadCount() * 8));
+
+			root = new BVHNode;
+			buildRecursive(root, 0, primCount, 0, nodeCount, threadPool.getThreadCount() > 1 ? &tasks : nullptr);
+
+			// Biggest subtrees first so no thread is left with a large one at the end
+			std::sort(tasks.begin(), tasks.end(), [](const BVHBuildTask & a, const BVHBuildTask & b)
+			{
+				return a.end - a.start > b.end - b.start;
+			});
+
+			std::atomic<uint32_t> taskNodeCount(0);
+			threadPool.parallelFor(tasks.size(), [&](size_t i, unsigned)
+			{
+				uint32_t localCount = 0;
+				buildRecursive(tasks[i].node, tasks[i].start, tasks[i].end, tasks[i].depth, localCount, nullptr);
+				taskNodeCount += localCount;
+			});
+			nodeCount += taskNodeCount;
+
+			MLOG_DEBUG("BVHAccel: Built %u subtrees in parallel.", static_cast<unsigned>(tasks.size()));
+		}
+
+		// Spend the time given on improving the tree, rebuilds from update() have to be quick instead
+		if (!m_initialized && m_params.optimizeSeconds > 0.0f)
+			optimizeTreelets(root);
+
+		// Reorder the shapes to match the leaves, the cache needs the order to do the same on load
+		const uint32_t refCount = static_cast<uint32_t>(m_buildPrims.size());
+		std::vector<Shape *> ordered(refCount);
+		if (isCached())
+			m_buildOrder.resize(refCount);
+		threadPool.parallelFor(refCount, [&](size_t i, unsigned)
+		{
+			ordered[i] = m_shapes[m_buildPrims[i].index];
+			if (!m_buildOrder.empty())
+				m_buildOrder[i] = m_buildPrims[i].index;
+		}, BVH_BUILD_GRAIN);
+		if (refCount > primCount)
+			m_sceneShapes.swap(m_shapes);
+		m_shapes.swap(ordered);
+		std::vector<BVHPrimitiveInfo>().swap(m_buildPrims);
+		std::vector<BVHPrimitiveInfo>().swap(m_buildScratch);
+
+		return root;
+	}
+
+	void BVHAccel::buildRecursive(BVHNode * node, const uint32_t start, const uint32_t end, const int depth, uint32_t & nodeCount, std::vector<BVHBuildTask> * tasks)
+	{
+		const uint32_t count = end - start;
+
+		// Leave small enough nodes for the parallel subtree pass
+		if (tasks && count < m_buildTaskSize)
+		{
+			BVHBuildTask task = { node, start, end, depth };
+			tasks->push_back(task);
+			return;
+		}
+
+		nodeCount++;
+
+		// Calculate node axis-aligned bounding box & the bounds of the primitive centroids
+		AABB node_bbox;
+		AABB centroid_bbox;
+		computeBounds(start, end, node_bbox, centroid_bbox);
+		node->aabb = node_bbox;
+		node->prim_offset = start;
+
+		// Create a leaf if recursion limit was reached
+		const uint32_t maxLeafSize = std::min(std::max(m_params.leafThreshold, 1u), BVH_MAX_LEAF_SIZE);
+		if (count == 1 || (m_params.splitMethod == BVH_SPLIT_MEDIAN && count <= maxLeafSize))
+		{
+			node->prim_count = count;
+			return;
+		}
+
+		// Choose a split, the SAH may also decide a leaf is cheaper
+		int axis;
+		uint32_t mid;
+		if (m_params.splitMethod == BVH_SPLIT_SAH && depth < BVH_MAX_SAH_DEPTH)
+		{
+			axis = centroid_bbox.getMaximumExtent();
+			if (!splitSAH(start, end, node_bbox, centroid_bbox, axis, mid))
+			{
+				if (count <= maxLeafSize)
+				{
+					node->prim_count = count;
+					return;
+				}
+
+				// All centroids coincide, fall back to splitting the range in half
+				mid = start + (count >> 1);
+				std::nth_element(m_buildPrims.begin() + start, m_buildPrims.begin() + mid, m_buildPrims.begin() + end, BVHComparePrimitives(axis));
+			}
+		}
+		else
+		{
+			// Split along the longest axis at the object median, partitioning the primitives in place
+			axis = node_bbox.getMaximumExtent();
+			mid = start + (count >> 1);
+			std::nth_element(m_buildPrims.begin() + start, m_buildPrims.begin() + mid, m_buildPrims.begin() + end, BVHComparePrimitives(axis));
+		}
+
+		// Recursive call to build the child nodes
+		node->split_axis = axis;
+		node->l_child = new BVHNode;
+		node->r_child = new BVHNode;
+		buildRecursive(node->l_child, start, mid, depth + 1, nodeCount, tasks);
+		buildRecursive(node->r_child, mid, end, depth + 1, nodeCount, tasks);
+	}
+
+	void BVHAccel::computeBounds(const uint32_t start, const uint32_t end, AABB & bbox, AABB & cbox) const
 	{
-		DELETE(l_child);
-		DELETE(r_child);
+		boundPrimitives(&m_buildPrims[start], end - start, bbox, cbox);
 	}
 
-	bool BVHNode::isLeaf()
+	bool BVHAccel::splitSAH(const uint32_t start, const uint32_t end, const AABB & bbox, const AABB & cbox, const int axis, uint32_t & mid)
 	{
-		return (l_child == nullptr) && (r_child == nullptr);
+		const float cmin = cbox.getMin()[axis];
+		const float extent = cbox.getMax()[axis] - cmin;
+		if (extent <= 0.0f)
+			return false;
+
+		const unsigned binCount = std::min(std::max(m_params.sahBins, 2u), BVH_MAX_SAH_BINS);
+		const float binScale = binCount / extent;
+		auto binOf = [=](const BVHPrimitiveInfo & p)
+		{
+			return std::min(static_cast<unsigned>((p.centroid[axis] - cmin) * binScale), binCount - 1);
+		};
+
+		// Drop the primitive centroids into equally sized bins along the axis, one set of bins per chunk
+		const uint32_t chunks = (end - start + BVH_BUILD_GRAIN - 1) / BVH_BUILD_GRAIN;
+		std::vector<BVHBin> chunkBins(chunks * binCount);
+
+		auto binChunk = [&](size_t c, unsigned)
+		{
+			const uint32_t s = start + static_cast<uint32_t>(c) * BVH_BUILD_GRAIN;
+			const uint32_t e = std::min(end, s + BVH_BUILD_GRAIN);
+
+			BVHBin * bins = &chunkBins[c * binCount];
+			for (uint32_t i = s; i < e; i++)
+			{
+				BVHBin & bin = bins[binOf(m_buildPrims[i])];
+				bin.bounds = bin.count ? bin.bounds.addBox(m_buildPrims[i].bounds) : m_buildPrims[i].bounds;
+				bin.count++;
+			}
+		};
+
+		if (chunks > 1)
+			ThreadPool::instance().parallelFor(chunks, binChunk);
+		else
+			binChunk(0, 0);
+
+		// Merge the chunks into the first set
+		BVHBin * bins = &chunkBins[0];
+		for (uint32_t c = 1; c < chunks; c++)
+		{
+			for (unsigned b = 0; b < binCount; b++)
+			{
+				const BVHBin & other = chunkBins[c * binCount + b];
+				if (!other.count)
+					continue;
+				bins[b].bounds = bins[b].count ? bins[b].bounds.addBox(other.bounds) : other.bounds;
+				bins[b].count += other.count;
+			}
+		}
+
+		// Sweep from the right to get the area & count right of each bin boundary
+		float rightArea[BVH_MAX_SAH_BINS];
+		uint32_t rightCount[BVH_MAX_SAH_BINS];
+		AABB accum;
+		uint32_t accumCount = 0;
+		for (unsigned b = binCount - 1; b > 0; b--)
+		{
+			if (bins[b].count)
+			{
+				accum = accumCount ? accum.addBox(bins[b].bounds) : bins[b].bounds;
+				accumCount += bins[b].count;
+			}
+			rightArea[b - 1] = accumCount ? accum.getSurfaceArea() : 0.0f;
+			rightCount[b - 1] = accumCount;
+		}
+
+		// Sweep from the left, evaluating the SAH at every boundary
+		const float nodeArea = bbox.getSurfaceArea();
+		const float invArea = nodeArea > 0.0f ? 1.0f / nodeArea : 0.0f;
+		float bestCost = INFINITY;
+		unsigned bestSplit = 0;
+		accumCount = 0;
+		for (unsigned b = 0; b < binCount - 1; b++)
+		{
+			if (bins[b].count)
+			{
+				accum = accumCount ? accum.addBox(bins[b].bounds) : bins[b].bounds;
+				accumCount += bins[b].count;
+			}
+			if (accumCount == 0 || rightCount[b] == 0)
+				continue;
+
+			const float cost = m_params.traversalCost + m_params.intersectionCost * (accumCount * accum.getSurfaceArea() + rightCount[b] * rightArea[b]) * invArea;
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestSplit = b;
+			}
+		}
+
+		// Keep small nodes as leaves when intersecting everything is cheaper than splitting
+		const uint32_t count = end - start;
+		const uint32_t maxLeafSize = std::min(std::max(m_params.leafThreshold, 1u), BVH_MAX_LEAF_SIZE);
+		if (bestCost == INFINITY || (count <= maxLeafSize && m_params.intersectionCost * count <= bestCost))
+			return false;
+
+		// Partition the primitives around the chosen boundary
+		mid = partitionPrimitives(start, end, [&](const BVHPrimitiveInfo & p)
+		{
+			return binOf(p) <= bestSplit;
+		});
+
+		return mid != start && mid != end;
 	}
 
-	// ------------------------------------------------------------------------
-	// BVH Accelerator Object
-	// ------------------------------------------------------------------------
-	BVHAccel::BVHAccel(const std::vector<Shape *> shapes, const float lThreshold) :
-		Accelerator(shapes),
-		m_leafThreshold(lThreshold),
-		m_root(nullptr)
+	template <typename Predicate>
+	uint32_t BVHAccel::partitionPrimitives(const uint32_t start, const uint32_t end, const Predicate & isLeft)
 	{
-		LOG("BVHAccel: a New instance was created.");
-		LOG("BVHAccel: Number of loaded shapes: " << m_shapes.size());
+		const uint32_t chunks = (end - start + BVH_BUILD_GRAIN - 1) / BVH_BUILD_GRAIN;
+		if (chunks <= 1)
+		{
+			auto it = std::partition(m_buildPrims.begin() + start, m_buildPrims.begin() + end, isLeft);
+			return static_cast<uint32_t>(it - m_buildPrims.begin());
+		}
+
+		// Count the left side of every chunk...
+		ThreadPool & threadPool = ThreadPool::instance();
+		std::vector<uint32_t> leftCount(chunks);
+		threadPool.parallelFor(chunks, [&](size_t c, unsigned)
+		{
+			const uint32_t s = start + static_cast<uint32_t>(c) * BVH_BUILD_GRAIN;
+			const uint32_t e = std::min(end, s + BVH_BUILD_GRAIN);
+			leftCount[c] = static_cast<uint32_t>(std::count_if(m_buildPrims.begin() + s, m_buildPrims.begin() + e, isLeft));
+		});
+
+		// ...turn the counts into output offsets...
+		std::vector<uint32_t> leftOffset(chunks);
+		std::vector<uint32_t> rightOffset(chunks);
+		uint32_t leftTotal = 0;
+		for (uint32_t c = 0; c < chunks; c++)
+		{
+			leftOffset[c] = start + leftTotal;
+			leftTotal += leftCount[c];
+		}
+		uint32_t rightTotal = 0;
+		for (uint32_t c = 0; c < chunks; c++)
+		{
+			rightOffset[c] = start + leftTotal + rightTotal;
+			rightTotal += std::min(end, start + (c + 1) * BVH_BUILD_GRAIN) - (start + c * BVH_BUILD_GRAIN) - leftCount[c];
+		}
+
+		// ...then scatter through the scratch buffer and copy back
+		threadPool.parallelFor(chunks, [&](size_t c, unsigned)
+		{
+			const uint32_t s = start + static_cast<uint32_t>(c) * BVH_BUILD_GRAIN;
+			const uint32_t e = std::min(end, s + BVH_BUILD_GRAIN);
+			uint32_t l = leftOffset[c];
+			uint32_t r = rightOffset[c];
+			for (uint32_t i = s; i < e; i++)
+			{
+				if (isLeft(m_buildPrims[i]))
+					m_buildScratch[l++] = m_buildPrims[i];
+				else
+					m_buildScratch[r++] = m_buildPrims[i];
+			}
+		});
+		threadPool.parallelFor(chunks, [&](size_t c, unsigned)
+		{
+			const uint32_t s = start + static_cast<uint32_t>(c) * BVH_BUILD_GRAIN;
+			const uint32_t e = std::min(end, s + BVH_BUILD_GRAIN);
+			std::copy(m_buildScratch.begin() + s, m_buildScratch.begin() + e, m_buildPrims.begin() + s);
+		});
+
+		return start + leftTotal;
 	}
 
-	BVHAccel::~BVHAccel()
+	BVHNode * BVHAccel::buildLBVH(uint32_t & nodeCount)
 	{
-		DELETE(m_root);
+		ThreadPool & threadPool = ThreadPool::instance();
+		const uint32_t primCount = static_cast<uint32_t>(m_buildPrims.size());
+		const int codeBits = m_params.mortonBits > 30 ? 63 : 30;
+		const int axisBits = codeBits / 3;
+
+		// Quantize the centroids to a grid over their bounds & interleave the coordinates, x in the highest bit
+		AABB bbox;
+		AABB cbox;
+		computeBounds(0, primCount, bbox, cbox);
+		const vec3 cmin = cbox.getMin();
+		const vec3 cextent = cbox.getMax() - cmin;
+		const uint64_t cellMax = (1ULL << axisBits) - 1;
+
+		std::vector<BVHMortonPrim> morton(primCount);
+		std::vector<BVHMortonPrim> mortonScratch;
+		threadPool.parallelFor(primCount, [&](size_t i, unsigned)
+		{
+			uint64_t cell[3];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				const float f = cextent[axis] > 0.0f ? (m_buildPrims[i].centroid[axis] - cmin[axis]) / cextent[axis] : 0.0f;
+				cell[axis] = std::min(static_cast<uint64_t>(std::max(f, 0.0f) * (cellMax + 1)), cellMax);
+			}
+
+			if (codeBits == 30)
+				morton[i].code = (expandBits10(cell[0]) << 2) | (expandBits10(cell[1]) << 1) | expandBits10(cell[2]);
+			else
+				morton[i].code = (expandBits21(cell[0]) << 2) | (expandBits21(cell[1]) << 1) | expandBits21(cell[2]);
+			morton[i].index = static_cast<uint32_t>(i);
+		}, BVH_BUILD_GRAIN);
+
+		radixSort(morton, mortonScratch, codeBits);
+		std::vector<BVHMortonPrim>().swap(mortonScratch);
+
+		// Bring the primitives into code order
+		threadPool.parallelFor(primCount, [&](size_t i, unsigned)
+		{
+			m_buildScratch[i] = m_buildPrims[morton[i].index];
+		}, BVH_BUILD_GRAIN);
+		m_buildPrims.swap(m_buildScratch);
+
+		// Primitives sharing the leading code bits form a treelet, emitted independently of the others
+		const int treeletShift = codeBits - BVH_TREELET_BITS;
+		std::vector<uint32_t> treeletStart(1, 0);
+		for (uint32_t i = 1; i < primCount; i++)
+		{
+			if ((morton[i].code >> treeletShift) != (morton[i - 1].code >> treeletShift))
+				treeletStart.push_back(i);
+		}
+		treeletStart.push_back(primCount);
+
+		const uint32_t treeletCount = static_cast<uint32_t>(treeletStart.size() - 1);
+		std::vector<BVHNode *> treelets(treeletCount);
+		std::atomic<uint32_t> treeletNodeCount(0);
+		threadPool.parallelFor(treeletCount, [&](size_t i, unsigned)
+		{
+			uint32_t localCount = 0;
+			treelets[i] = emitLBVH(morton, treeletStart[i], treeletStart[i + 1], treeletShift - 1, localCount);
+			treeletNodeCount += localCount;
+		});
+		nodeCount += treeletNodeCount;
+
+		MLOG_DEBUG("BVHAccel: Emitted %u LBVH treelets in parallel.", treeletCount);
+
+		// Join the treelets, either with the SAH or by carrying on with the leading code bits
+		if (m_params.lbvhSAHTop)
+			return buildUpperSAH(treelets, 0, treeletCount, nodeCount);
+
+		std::vector<BVHMortonPrim> treeletCodes(treeletCount);
+		for (uint32_t i = 0; i < treeletCount; i++)
+		{
+			treeletCodes[i].code = morton[treeletStart[i]].code;
+			treeletCodes[i].index = i;
+		}
+
+		return emitUpperLBVH(treelets, treeletCodes, 0, treeletCount, codeBits - 1, nodeCount);
 	}
 
-	void BVHAccel::update() const
+	BVHNode * BVHAccel::emitLBVH(const std::vector<BVHMortonPrim> & morton, const uint32_t start, const uint32_t end, int bit, uint32_t & nodeCount)
 	{
-		WRN("Unimplemented function BVHAccel::update was called.");
+		const uint32_t count = end - start;
+		const uint32_t maxLeafSize = std::min(std::max(m_params.leafThreshold, 1u), BVH_MAX_LEAF_SIZE);
+		nodeCount++;
+
+		// Leaves bound their primitives, interior nodes are bounded by their children on the way back up
+		if (count <= maxLeafSize)
+		{
+			AABB bbox = m_buildPrims[start].bounds;
+			for (uint32_t i = start + 1; i < end; i++)
+				bbox = bbox.addBox(m_buildPrims[i].bounds);
+
+			return new BVHNode(0, start, count, bbox);
+		}
+
+		const uint32_t mid = findMortonSplit(morton, start, end, bit);
+		BVHNode * node = new BVHNode(bit >= 0 ? 2 - bit % 3 : 0);
+		node->l_child = emitLBVH(morton, start, mid, bit - 1, nodeCount);
+		node->r_child = emitLBVH(morton, mid, end, bit - 1, nodeCount);
+		node->aabb = node->l_child->aabb.addBox(node->r_child->aabb);
+
+		return node;
 	}
 
-	bool BVHAccel::intersect(const Ray & ray, Intersection & iSect)
+	BVHNode * BVHAccel::emitUpperLBVH(std::vector<BVHNode *> & treelets, const std::vector<BVHMortonPrim> & morton, const uint32_t start, const uint32_t end, int bit, uint32_t & nodeCount)
 	{
-		bool result = false;
-		float tHit = INFINITY;
-		float tHit0 = 0.0f;
-		float tHit1 = INFINITY;
+		if (end - start == 1)
+			return treelets[start];
 
-		traverse(m_root, ray, result, tHit, tHit0, tHit1, iSect);
+		nodeCount++;
 
-		return result;
+		const uint32_t mid = findMortonSplit(morton, start, end, bit);
+		BVHNode * node = new BVHNode(bit >= 0 ? 2 - bit % 3 : 0);
+		node->l_child = emitUpperLBVH(treelets, morton, start, mid, bit - 1, nodeCount);
+		node->r_child = emitUpperLBVH(treelets, morton, mid, end, bit - 1, nodeCount);
+		node->aabb = node->l_child->aabb.addBox(node->r_child->aabb);
+
+		return node;
 	}
 
-	bool BVHAccel::intersectP(const Ray & ray)
+	BVHNode * BVHAccel::buildUpperSAH(std::vector<BVHNode *> & roots, const uint32_t start, const uint32_t end, uint32_t & nodeCount)
 	{
-		bool result = false;
-		float tHit = ray.maxt;
-		float tHit0 = ray.mint;
-		float tHit1 = INFINITY;
+		const uint32_t count = end - start;
+		if (count == 1)
+			return roots[start];
 
-		traverseP(m_root, ray, result, tHit, tHit0, tHit1);
+		nodeCount++;
 
-		return result;
+		AABB bbox = roots[start]->aabb;
+		AABB cbox(roots[start]->aabb.getCentroid(), roots[start]->aabb.getCentroid());
+		for (uint32_t i = start + 1; i < end; i++)
+		{
+			bbox = bbox.addBox(roots[i]->aabb);
+			cbox = cbox.addPoint(roots[i]->aabb.getCentroid());
+		}
+
+		const int axis = cbox.getMaximumExtent();
+		const float cmin = cbox.getMin()[axis];
+		const float extent = cbox.getMax()[axis] - cmin;
+
+		// Bin the treelets by centroid, there is no leaf option since every treelet is already a subtree
+		uint32_t mid = start + (count >> 1);
+		if (extent > 0.0f)
+		{
+			const unsigned binCount = std::min(std::max(m_params.sahBins, 2u), BVH_MAX_SAH_BINS);
+			const float binScale = binCount / extent;
+			auto binOf = [=](const BVHNode * n)
+			{
+				return std::min(static_cast<unsigned>((n->aabb.getCentroid()[axis] - cmin) * binScale), binCount - 1);
+			};
+
+			BVHBin bins[BVH_MAX_SAH_BINS];
+			for (uint32_t i = start; i < end; i++)
+			{
+				BVHBin & bin = bins[binOf(roots[i])];
+				bin.bounds = bin.count ? bin.bounds.addBox(roots[i]->aabb) : roots[i]->aabb;
+				bin.count++;
+			}
+
+			float rightCost[BVH_MAX_SAH_BINS];
+			AABB accum;
+			uint32_t accumCount = 0;
+			for (unsigned b = binCount - 1; b > 0; b--)
+			{
+				if (bins[b].count)
+				{
+					accum = accumCount ? accum.addBox(bins[b].bounds) : bins[b].bounds;
+					accumCount += bins[b].count;
+				}
+				rightCost[b - 1] = accumCount ? accumCount * accum.getSurfaceArea() : INFINITY;
+			}
+
+			float bestCost = INFINITY;
+			unsigned bestSplit = 0;
+			accumCount = 0;
+			for (unsigned b = 0; b < binCount - 1; b++)
+			{
+				if (bins[b].count)
+				{
+					accum = accumCount ? accum.addBox(bins[b].bounds) : bins[b].bounds;
+					accumCount += bins[b].count;
+				}
+				if (accumCount == 0)
+					continue;
+
+				const float cost = accumCount * accum.getSurfaceArea() + rightCost[b];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestSplit = b;
+				}
+			}
+
+			if (bestCost < INFINITY)
+			{
+				mid = static_cast<uint32_t>(std::partition(roots.begin() + start, roots.begin() + end, [&](const BVHNode * n)
+				{
+					return binOf(n) <= bestSplit;
+				}) - roots.begin());
+			}
+		}
+
+		BVHNode * node = new BVHNode(axis, 0, 0, bbox);
+		node->l_child = buildUpperSAH(roots, start, mid, nodeCount);
+		node->r_child = buildUpperSAH(roots, mid, end, nodeCount);
+
+		return node;
 	}
 
-	void BVHAccel::init()
+	BVHNode * BVHAccel::buildSBVH(uint32_t & nodeCount)
 	{
-		LOG("BVHAccel: Started building the hierarchy...");
-		std::clock_t startTime = std::clock();
+		ThreadPool & threadPool = ThreadPool::instance();
+		const uint32_t primCount = static_cast<uint32_t>(m_buildPrims.size());
 
-		m_root = new BVHNode;
-		buildRecursive(m_root, 0, m_shapes);
+		AABB bbox;
+		AABB cbox;
+		computeBounds(0, primCount, bbox, cbox);
+		m_buildRootArea = bbox.getSurfaceArea();
+		m_buildTaskSize = std::max(BVH_MIN_TASK_SIZE, primCount / (threadPool.getThreadCount() * 8));
+		const uint32_t budget = static_cast<uint32_t>(std::min(primCount * std::max(m_params.duplicationBudget, 0.0f), static_cast<float>(0xFFFFFFFFu - primCount)));
 
-		std::clock_t endTime = std::clock();
-		std::clock_t time = endTime - startTime;
-		float duration = time / (double)CLOCKS_PER_SEC;
+		// Spatial splits add references, so nodes get their own lists & the leaves are gathered into m_buildPrims
+		std::vector<BVHPrimitiveInfo> refs;
+		refs.swap(m_buildPrims);
+		std::vector<BVHSpatialTask> tasks;
 
-		m_initialized = true;
-		LOG("BVHAccel: Build finished! Time taken: " << duration << "s.");
+		BVHNode * root = new BVHNode;
+		buildSpatialRecursive(root, refs, 0, budget, nodeCount, m_buildPrims, threadPool.getThreadCount() > 1 ? &tasks : nullptr);
+
+		// Biggest subtrees first so no thread is left with a large one at the end
+		std::sort(tasks.begin(), tasks.end(), [](const BVHSpatialTask & a, const BVHSpatialTask & b)
+		{
+			return a.refs.size() > b.refs.size();
+		});
+
+		std::vector<std::vector<BVHPrimitiveInfo>> taskLeaves(tasks.size());
+		std::atomic<uint32_t> taskNodeCount(0);
+		threadPool.parallelFor(tasks.size(), [&](size_t i, unsigned)
+		{
+			uint32_t localCount = 0;
+			buildSpatialRecursive(tasks[i].node, tasks[i].refs, tasks[i].depth, tasks[i].budget, localCount, taskLeaves[i], nullptr);
+			taskNodeCount += localCount;
+		});
+		nodeCount += taskNodeCount;
+
+		// Append the leaves of every subtree & move its offsets along
+		for (size_t i = 0; i < tasks.size(); i++)
+		{
+			shiftLeaves(tasks[i].node, static_cast<uint32_t>(m_buildPrims.size()));
+			m_buildPrims.insert(m_buildPrims.end(), taskLeaves[i].begin(), taskLeaves[i].end());
+			std::vector<BVHPrimitiveInfo>().swap(taskLeaves[i]);
+		}
+
+		MLOG_DEBUG("BVHAccel: Built %u spatial split subtrees in parallel.", static_cast<unsigned>(tasks.size()));
+
+		const uint32_t duplicates = static_cast<uint32_t>(m_buildPrims.size()) - primCount;
+		LOG("BVHAccel: Spatial splits added " << duplicates << " references, " << 100.0f * duplicates / std::max(primCount, 1u) << "% of the shapes.");
+
+		return root;
 	}
 
-	void BVHAccel::buildRecursive(BVHNode * node, int depth, std::vector<Shape *> &shapes)
+	void BVHAccel::buildSpatialRecursive(BVHNode * node, std::vector<BVHPrimitiveInfo> & refs, const int depth, uint32_t budget, uint32_t & nodeCount, std::vector<BVHPrimitiveInfo> & leaves, std::vector<BVHSpatialTask> * tasks)
 	{
-		// Calculate node axis-aligned bounding box
-		AABB node_bbox = shapes[0]->worldBound();
-		for (size_t i = 0; i < shapes.size(); i++)
+		const uint32_t count = static_cast<uint32_t>(refs.size());
+
+		// Leave small enough nodes for the parallel subtree pass
+		if (tasks && count < m_buildTaskSize)
 		{
-			node_bbox = node_bbox.addBox(shapes[i]->worldBound());
+			tasks->push_back(BVHSpatialTask());
+			tasks->back().node = node;
+			tasks->back().refs.swap(refs);
+			tasks->back().depth = depth;
+			tasks->back().budget = budget;
+			return;
 		}
+
+		nodeCount++;
+
+		AABB node_bbox;
+		AABB centroid_bbox;
+		boundPrimitives(refs.data(), count, node_bbox, centroid_bbox);
 		node->aabb = node_bbox;
 
-		// Create a leaf if recursion limit was reached
-		if (shapes.size() <= m_leafThreshold)
+		const uint32_t maxLeafSize = std::min(std::max(m_params.leafThreshold, 1u), BVH_MAX_LEAF_SIZE);
+		auto makeLeaf = [&]()
+		{
+			node->prim_offset = static_cast<uint32_t>(leaves.size());
+			node->prim_count = count;
+			leaves.insert(leaves.end(), refs.begin(), refs.end());
+			std::vector<BVHPrimitiveInfo>().swap(refs);
+		};
+
+		if (count == 1 || (depth >= BVH_MAX_SAH_DEPTH && count <= maxLeafSize))
 		{
-			node->data.insert(node->data.end(), shapes.begin(), shapes.end());
+			makeLeaf();
 			return;
 		}
 
-		// Split along the longest axis, find it...
-		const int axis = node_bbox.getMaximumExtent();
-		node->split_axis = axis;
+		std::vector<BVHPrimitiveInfo> left;
+		std::vector<BVHPrimitiveInfo> right;
+		int axis = centroid_bbox.getMaximumExtent();
+		bool split = false;
 
-		// Calculate split point & sort the primitives based on pre-set rules
-		const int median = shapes.size() >> 1;
-		std::nth_element(shapes.begin(), shapes.begin() + median, shapes.end(), BVHCompareShapes(axis));
-		node->split_pos = shapes[median]->worldBound().getCentroid()[axis];
+		if (depth < BVH_MAX_SAH_DEPTH)
+		{
+			const unsigned binCount = std::min(std::max(m_params.sahBins, 2u), BVH_MAX_SAH_BINS);
+			const float nodeArea = node_bbox.getSurfaceArea();
+			const float invArea = nodeArea > 0.0f ? 1.0f / nodeArea : 0.0f;
 
-		// Create branches
-		node->l_child = new BVHNode;
-		node->r_child = new BVHNode;
+			BVHSplitCandidate object;
+			findObjectSplit(refs, centroid_bbox, binCount, object);
+			const float objectCost = m_params.traversalCost + m_params.intersectionCost * object.cost * invArea;
 
-		// Create left & right child shape vectors
-		std::vector<Shape *> lList(median);
-		std::vector<Shape *> rList(shapes.size() - median);
-		std::copy(shapes.begin(), shapes.begin() + median, lList.begin());
-		std::copy(shapes.begin() + median, shapes.end(), rList.begin());
+			// Spatial splits only pay off where the object split leaves the children overlapping
+			BVHSplitCandidate spatial;
+			if (budget > 0 && m_buildRootArea > 0.0f && (object.cost == INFINITY || overlapArea(object.left, object.right) > m_params.spatialAlpha * m_buildRootArea))
+				findSpatialSplit(refs, node_bbox, spatial);
+			const float spatialCost = m_params.traversalCost + m_params.intersectionCost * spatial.cost * invArea;
 
-		// Recursive call to build the child nodes
-		buildRecursive(node->l_child, depth + 1, lList);
-		buildRecursive(node->r_child, depth + 1, rList);
+			// Keep small nodes as leaves when intersecting everything is cheaper than splitting
+			if (count <= maxLeafSize && m_params.intersectionCost * count <= std::min(objectCost, spatialCost))
+			{
+				makeLeaf();
+				return;
+			}
+
+			if (spatialCost < objectCost && partitionSpatial(refs, node_bbox, spatial, budget, left, right))
+			{
+				axis = spatial.axis;
+				split = true;
+			}
+			else if (object.cost < INFINITY)
+			{
+				const float cmin = centroid_bbox.getMin()[object.axis];
+				const float scale = binCount / (centroid_bbox.getMax()[object.axis] - cmin);
+				for (uint32_t i = 0; i < count; i++)
+				{
+					if (binIndex(refs[i].centroid[object.axis], cmin, scale, binCount) <= object.bin)
+						left.push_back(refs[i]);
+					else
+						right.push_back(refs[i]);
+				}
+				axis = object.axis;
+				split = true;
+			}
+			else if (count <= maxLeafSize)
+			{
+				makeLeaf();
+				return;
+			}
+		}
+
+		// Past the depth limit, or all centroids coincide: split the list in half
+		if (!split)
+		{
+			const uint32_t mid = count >> 1;
+			std::nth_element(refs.begin(), refs.begin() + mid, refs.end(), BVHComparePrimitives(axis));
+			left.assign(refs.begin(), refs.begin() + mid);
+			right.assign(refs.begin() + mid, refs.end());
+		}
+		std::vector<BVHPrimitiveInfo>().swap(refs);
+
+		// Recursive call to build the child nodes, what is left of the budget is shared in proportion to their size
+		const uint32_t leftBudget = static_cast<uint32_t>(static_cast<uint64_t>(budget) * left.size() / (left.size() + right.size()));
+		const uint32_t rightBudget = budget - leftBudget;
+		node->split_axis = axis;
+		node->l_child = new BVHNode;
+		node->r_child = new BVHNode;
+		buildSpatialRecursive(node->l_child, left, depth + 1, leftBudget, nodeCount, leaves, tasks);
+		buildSpatialRecursive(node->r_child, right, depth + 1, rightBudget, nodeCount, leaves, tasks);
 	}
 
-	void BVHAccel::traverse(BVHNode * node, const Ray & ray, bool & bHit, float & tHit, float & tHit0, float & tHit1, Intersection & iSect)
+	void BVHAccel::findSpatialSplit(const std::vector<BVHPrimitiveInfo> & refs, const AABB & bbox, BVHSplitCandidate & best) const
 	{
-		if (node->isLeaf())
-		{
-			// Return if our bbox is closer than the triangle
-			if (tHit0 > tHit)
-				return;
+		const uint32_t count = static_cast<uint32_t>(refs.size());
+		const unsigned binCount = std::min(std::max(m_params.sahBins, 2u), BVH_MAX_SAH_BINS);
+		const vec3 bmin = bbox.getMin();
+		const vec3 extent = bbox.getMax() - bmin;
+		vec3 scale;
+		for (int axis = 0; axis < 3; axis++)
+			scale[axis] = extent[axis] > 0.0f ? binCount / extent[axis] : 0.0f;
 
-			Intersection iSectInit;
-			bool bIsectInit = false;
+		// Bins split space evenly, a reference is clipped to every bin it spans & counted where it enters & leaves
+		const uint32_t chunks = (count + BVH_BUILD_GRAIN - 1) / BVH_BUILD_GRAIN;
+		std::vector<BVHSpatialBin> chunkBins(chunks * 3 * binCount);
 
-			for (auto * s : node->data)
+		auto binChunk = [&](size_t c, unsigned)
+		{
+			const uint32_t s = static_cast<uint32_t>(c) * BVH_BUILD_GRAIN;
+			const uint32_t e = std::min(count, s + BVH_BUILD_GRAIN);
+
+			for (int axis = 0; axis < 3; axis++)
 			{
-				bIsectInit = s->intersect(ray, iSectInit);
+				if (extent[axis] <= 0.0f)
+					continue;
 
-				if (bIsectInit && iSectInit.getT() < tHit && iSectInit.getT() < ray.maxt)
+				BVHSpatialBin * bins = &chunkBins[(c * 3 + axis) * binCount];
+				for (uint32_t i = s; i < e; i++)
 				{
-					bHit = true;
-					tHit = iSectInit.getT();
-					iSect = iSectInit;
+					const BVHPrimitiveInfo & ref = refs[i];
+					const unsigned first = binIndex(ref.bounds.getMin()[axis], bmin[axis], scale[axis], binCount);
+					const unsigned last = binIndex(ref.bounds.getMax()[axis], bmin[axis], scale[axis], binCount);
+					bins[first].enter++;
+					bins[last].exit++;
+
+					for (unsigned b = first; b <= last; b++)
+					{
+						BVHPrimitiveInfo part = ref;
+						if (first != last)
+						{
+							const float lo = std::max(bmin[axis] + b * extent[axis] / binCount, ref.bounds.getMin()[axis]);
+							const float hi = std::min(bmin[axis] + (b + 1) * extent[axis] / binCount, ref.bounds.getMax()[axis]);
+							if (!clipReference(ref, axis, lo, hi, part))
+								continue;
+						}
+
+						bins[b].bounds = bins[b].count ? bins[b].bounds.addBox(part.bounds) : part.bounds;
+						bins[b].count++;
+					}
 				}
 			}
-		}
+		};
+
+		if (chunks > 1)
+			ThreadPool::instance().parallelFor(chunks, binChunk);
 		else
+			binChunk(0, 0);
+
+		for (int axis = 0; axis < 3; axis++)
 		{
-			if (node->l_child->aabb.intersectP(ray, tHit0, tHit1))
+			if (extent[axis] <= 0.0f)
+				continue;
+
+			// Merge the chunks into the first set
+			BVHSpatialBin * bins = &chunkBins[axis * binCount];
+			for (uint32_t c = 1; c < chunks; c++)
+			{
+				for (unsigned b = 0; b < binCount; b++)
+				{
+					const BVHSpatialBin & other = chunkBins[(c * 3 + axis) * binCount + b];
+					bins[b].enter += other.enter;
+					bins[b].exit += other.exit;
+					if (!other.count)
+						continue;
+					bins[b].bounds = bins[b].count ? bins[b].bounds.addBox(other.bounds) : other.bounds;
+					bins[b].count += other.count;
+				}
+			}
+
+			// References left of a plane are those that entered before it, right of it those that leave after it
+			float rightArea[BVH_MAX_SAH_BINS];
+			uint32_t rightCount[BVH_MAX_SAH_BINS];
+			AABB accum;
+			bool accumSet = false;
+			uint32_t accumCount = 0;
+			for (unsigned b = binCount - 1; b > 0; b--)
+			{
+				if (bins[b].count)
+				{
+					accum = accumSet ? accum.addBox(bins[b].bounds) : bins[b].bounds;
+					accumSet = true;
+				}
+				accumCount += bins[b].exit;
+				rightArea[b - 1] = accumSet ? accum.getSurfaceArea() : 0.0f;
+				rightCount[b - 1] = accumSet ? accumCount : 0;
+			}
+
+			bool improved = false;
+			accumSet = false;
+			accumCount = 0;
+			for (unsigned b = 0; b < binCount - 1; b++)
 			{
-				traverse(node->l_child, ray, bHit, tHit, tHit0, tHit1, iSect);
+				if (bins[b].count)
+				{
+					accum = accumSet ? accum.addBox(bins[b].bounds) : bins[b].bounds;
+					accumSet = true;
+				}
+				accumCount += bins[b].enter;
+				if (!accumSet || accumCount == 0 || rightCount[b] == 0)
+					continue;
+
+				const float cost = accumCount * accum.getSurfaceArea() + rightCount[b] * rightArea[b];
+				if (cost < best.cost)
+				{
+					best.cost = cost;
+					best.axis = axis;
+					best.bin = b;
+					best.left = accum;
+					best.leftCount = accumCount;
+					best.rightCount = rightCount[b];
+					improved = true;
+				}
 			}
-			if (node->r_child->aabb.intersectP(ray, tHit0, tHit1))
+
+			if (improved)
 			{
-				traverse(node->r_child, ray, bHit, tHit, tHit0, tHit1, iSect);
+				accumSet = false;
+				for (unsigned b = best.bin + 1; b < binCount; b++)
+				{
+					if (bins[b].count)
+					{
+						best.right = accumSet ? best.right.addBox(bins[b].bounds) : bins[b].bounds;
+						accumSet = true;
+					}
+				}
 			}
 		}
+	}
 
-		// Below is an example optimization, it is not ready yet
-		/*
-		else
-		{
-			// Capture distances into temp variables
-			float l_tHit0 = tHit0, l_tHit1 = tHit1, r_tHit0 = tHit0, r_tHit1 = tHit1;
+	bool BVHAccel::partitionSpatial(std::vector<BVHPrimitiveInfo> & refs, const AABB & bbox, const BVHSplitCandidate & split, uint32_t & budget, std::vector<BVHPrimitiveInfo> & left, std::vector<BVHPrimitiveInfo> & right) const
+	{
+		const int axis = split.axis;
+		const unsigned binCount = std::min(std::max(m_params.sahBins, 2u), BVH_MAX_SAH_BINS);
+		const float bmin = bbox.getMin()[axis];
+		const float extent = bbox.getMax()[axis] - bmin;
+		const float scale = binCount / extent;
+		const float plane = bmin + (split.bin + 1) * extent / binCount;
 
-			// Attempt to hit both leafs
-			bool l_hit = node->l_child->aabb.intersectP(ray, l_tHit0, l_tHit1);
-			bool r_hit = node->r_child->aabb.intersectP(ray, r_tHit0, r_tHit1);
+		const float leftArea = split.left.getSurfaceArea();
+		const float rightArea = split.right.getSurfaceArea();
+		const float splitCost = split.leftCount * leftArea + split.rightCount * rightArea;
 
-			// Traverse the closest hit first, if it hits a shape don't traverse other leaf
-			if (l_hit && r_hit && (l_tHit0 < r_tHit0))
+		const uint32_t start = budget;
+		left.reserve(split.leftCount);
+		right.reserve(split.rightCount);
+		for (size_t i = 0; i < refs.size(); i++)
+		{
+			const BVHPrimitiveInfo & ref = refs[i];
+			const unsigned first = binIndex(ref.bounds.getMin()[axis], bmin, scale, binCount);
+			const unsigned last = binIndex(ref.bounds.getMax()[axis], bmin, scale, binCount);
+			if (last <= split.bin)
 			{
-				// Capture tHit
-				float temp_tHit = tHit;
-				
-				// Traverse to the node
-				traverse(node->l_child, ray, bHit, tHit, tHit0, tHit1, iSect);
-
-				// Only traverse right if we didn't hit a triangle
-				if (tHit <= temp_tHit)
-					traverse(node->r_child, ray, bHit, tHit, tHit0, tHit1, iSect);
+				left.push_back(ref);
+				continue;
 			}
-			else if (l_hit && r_hit && (l_tHit0 > r_tHit0))
+			if (first > split.bin)
 			{
-				// Capture tHit
-				float temp_tHit = tHit;
-				
-				// Traverse to the node
-				traverse(node->r_child, ray, bHit, tHit, tHit0, tHit1, iSect);
-
-				// Only traverse left if we didn't hit a triangle
-				if (tHit <= temp_tHit)
-					traverse(node->l_child, ray, bHit, tHit, tHit0, tHit1, iSect);
+				right.push_back(ref);
+				continue;
 			}
-			else if (l_hit && r_hit)
+
+			// Moving a straddling reference wholly to one side may be cheaper than splitting it, and is all that's left without budget
+			const float leftCost = split.leftCount * split.left.addBox(ref.bounds).getSurfaceArea() + (split.rightCount - 1) * rightArea;
+			const float rightCost = (split.leftCount - 1) * leftArea + split.rightCount * split.right.addBox(ref.bounds).getSurfaceArea();
+			if (budget > 0 && splitCost < std::min(leftCost, rightCost))
 			{
-				traverse(node->l_child, ray, bHit, tHit, tHit0, tHit1, iSect);
-				traverse(node->r_child, ray, bHit, tHit, tHit0, tHit1, iSect);
+				BVHPrimitiveInfo leftPart;
+				BVHPrimitiveInfo rightPart;
+				const bool hasLeft = clipReference(ref, axis, ref.bounds.getMin()[axis], plane, leftPart);
+				const bool hasRight = clipReference(ref, axis, plane, ref.bounds.getMax()[axis], rightPart);
+				if (hasLeft && hasRight)
+				{
+					left.push_back(leftPart);
+					right.push_back(rightPart);
+					budget--;
+				}
+				else if (hasRight)
+				{
+					right.push_back(ref);
+				}
+				else
+				{
+					left.push_back(ref);
+				}
 			}
-			else if (l_hit && !r_hit)
+			else if (leftCost <= rightCost)
 			{
-				traverse(node->l_child, ray, bHit, tHit, tHit0, tHit1, iSect);
+				left.push_back(ref);
 			}
-			else if (r_hit && !l_hit)
+			else
 			{
-				traverse(node->r_child, ray, bHit, tHit, tHit0, tHit1, iSect);
+				right.push_back(ref);
 			}
 		}
-		*/
+
+		// Everything ended up on one side, nothing was duplicated then
+		if (left.empty() || right.empty())
+		{
+			budget = start;
+			std::vector<BVHPrimitiveInfo>().swap(left);
+			std::vector<BVHPrimitiveInfo>().swap(right);
+			return false;
+		}
+
+		return true;
 	}
 
-	// TODO: Figure out how to optimize this. It differs from the regular tree traversion function
-	void BVHAccel::traverseP(BVHNode * node, const Ray & ray, bool & bHit, float & tHit, float & tHit0, float & tHit1)
+	bool BVHAccel::clipReference(const BVHPrimitiveInfo & ref, const int axis, const float min, const float max, BVHPrimitiveInfo & part) const
 	{
-		if (node->isLeaf())
+		AABB bounds;
+		if (min > max || !m_shapes[ref.index]->clipBound(axis, min, max, bounds))
+			return false;
+
+		// Earlier splits already cut the reference down, the part can't reach beyond what is left of it
+		vec3 pmin;
+		vec3 pmax;
+		for (int k = 0; k < 3; k++)
 		{
-			Intersection iSectInit;
-			float tInit = tHit1;
+			pmin[k] = std::max(bounds.getMin()[k], ref.bounds.getMin()[k]);
+			pmax[k] = std::min(bounds.getMax()[k], ref.bounds.getMax()[k]);
+			if (pmin[k] > pmax[k])
+				return false;
+		}
+
+		part.bounds = AABB(pmin, pmax);
+		part.centroid = part.bounds.getCentroid();
+		part.index = ref.index;
+
+		return true;
+	}
+
+	void BVHAccel::optimizeTreelets(BVHNode * root)
+	{
+		if (!root || root->isLeaf())
+			return;
+
+		ThreadPool & threadPool = ThreadPool::instance();
+		const auto startTime = std::chrono::steady_clock::now();
+		const auto deadline = startTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(m_params.optimizeSeconds));
+		const unsigned maxLeaves = std::min(std::max(m_params.treeletLeaves, 3u), BVH_MAX_TREELET_LEAVES);
+		const double rootArea = std::max(root->aabb.getSurfaceArea(), 1e-30f);
+		const double startCost = treeCost(root, m_params) / rootArea;
 
-			for (auto * s : node->data)
+		// Kept up to date from here on, so no pass can stack depth past the traversal stack
+		computeHeights(root);
+
+		double cost = startCost;
+		int passes = 0;
+		while (std::chrono::steady_clock::now() < deadline)
+		{
+			// Cut the top of the tree into independent subtrees, again every pass since rearranging the top moves them around
+			std::vector<BVHNode *> subtrees(1, root);
+			std::vector<uint32_t> subtreeDepth(1, 0);
+			std::vector<BVHNode *> upper;
+			std::vector<uint32_t> upperDepth;
+			const size_t subtreeCount = threadPool.getThreadCount() * 16;
+			while (subtrees.size() < subtreeCount && upper.size() < subtreeCount)
 			{
-				if (s->intersectP(ray) && tInit < tHit && tInit < ray.maxt)
+				std::vector<BVHNode *> below;
+				std::vector<uint32_t> belowDepth;
+				for (size_t i = 0; i < subtrees.size(); i++)
 				{
-					bHit = true;
-					tHit = tInit;
+					if (subtrees[i]->isLeaf())
+					{
+						below.push_back(subtrees[i]);
+						belowDepth.push_back(subtreeDepth[i]);
+						continue;
+					}
+					upper.push_back(subtrees[i]);
+					upperDepth.push_back(subtreeDepth[i]);
+					below.push_back(subtrees[i]->l_child);
+					below.push_back(subtrees[i]->r_child);
+					belowDepth.push_back(subtreeDepth[i] + 1);
+					belowDepth.push_back(subtreeDepth[i] + 1);
 				}
+				if (below.size() == subtrees.size())
+					break;
+				subtrees.swap(below);
+				subtreeDepth.swap(belowDepth);
 			}
-		}
-		else
-		{
-			if (node->l_child->aabb.intersectP(ray, tHit0, tHit1))
+
+			threadPool.parallelFor(subtrees.size(), [&](size_t i, unsigned)
 			{
-				traverseP(node->l_child, ray, bHit, tHit, tHit0, tHit1);
-			}
-			if (node->r_child->aabb.intersectP(ray, tHit0, tHit1))
+				restructureSubtree(subtrees[i], maxLeaves, subtreeDepth[i], deadline);
+			});
+
+			// The nodes above them deepest first, so children are done before their parents. Heights are
+			// refreshed past the deadline too, the next pass relies on them
+			for (size_t i = upper.size(); i-- > 0;)
 			{
-				traverseP(node->r_child, ray, bHit, tHit, tHit0, tHit1);
+				upper[i]->height = 1 + std::max(upper[i]->l_child->height, upper[i]->r_child->height);
+				if (std::chrono::steady_clock::now() < deadline)
+					restructureTreelet(upper[i], maxLeaves, upperDepth[i]);
 			}
+
+			passes++;
+			const double passCost = treeCost(root, m_params) / rootArea;
+			const bool converged = passCost > cost * (1.0 - BVH_TREELET_MIN_GAIN);
+			cost = passCost;
+			if (converged)
+				break;
+		}
+
+		const float duration = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
+		LOG("BVHAccel: Treelet restructuring took the SAH cost from " << startCost << " to " << cost << " in " << passes << " passes, " << duration << "s.");
+	}
+
+	uint32_t BVHAccel::flatten(const BVHNode * node, uint32_t & offset)
+	{
+		const uint32_t index = offset++;
+		BVHLinearNode & linear = m_nodes[index];
+
+		const vec3 & pmin = node->aabb.getMin();
+		const vec3 & pmax = node->aabb.getMax();
+		linear.pmin[0] = pmin.x; linear.pmin[1] = pmin.y; linear.pmin[2] = pmin.z;
+		linear.pmax[0] = pmax.x; linear.pmax[1] = pmax.y; linear.pmax[2] = pmax.z;
+		linear.split_axis = static_cast<uint8_t>(node->split_axis);
+		linear.pad = 0;
+
+		if (node->isLeaf())
+		{
+			linear.offset = node->prim_offset;
+			linear.prim_count = static_cast<uint16_t>(node->prim_count);
 		}
+		else
+		{
+			// The left child lands right after us, the right one after the whole left subtree
+			linear.prim_count = 0;
+			flatten(node->l_child, offset);
+			linear.offset = flatten(node->r_child, offset);
+		}
+
+		return index;
 	}
 
 }
@@ -1,72 +1,285 @@
 #ifndef BVH_H
 #define BVH_H
 
+// std includes
+#include <cstdint>
+#include <cmath>
+#include <string>
+
 // mirage includes
+#include "bvhleafpacks.h"
 #include "../core/accelerator.h"
+#include "../utils/mappedfile.h"
 
 namespace mirage
 {
 
 	// ------------------------------------------------------------------------
-	// BVH Shape Comparator
+	// BVH Split Method
+	// How interior nodes divide their primitives while building.
 	// ------------------------------------------------------------------------
-	struct BVHCompareShapes
+	enum BVHSplitMethod
+	{
+		BVH_SPLIT_MEDIAN, // Object median along the longest axis
+		BVH_SPLIT_SAH,    // Binned surface area heuristic
+		BVH_SPLIT_LBVH,   // Linear BVH, sorted Morton codes of the centroids
+		BVH_SPLIT_SBVH    // SAH with spatial splits, shapes straddling a split plane may be referenced on both sides
+	};
+
+	// ------------------------------------------------------------------------
+	// BVH Build Parameters
+	// leafThreshold is the leaf size for the median split and the largest
+	// leaf the SAH may keep. Costs are relative, the SAH only cares about
+	// their ratio. update() rebuilds instead of refitting once the SAH cost
+	// grows past rebuildRatio times the cost of the last build.
+	// The LBVH uses mortonBits (30 or 63) long codes and, with lbvhSAHTop,
+	// joins its treelets with the SAH instead of the codes.
+	// quantized stores the child bounds of wide BVH nodes in 8 bits each.
+	// The SBVH tries spatial splits where the children of the best object
+	// split overlap by more than spatialAlpha of the root's surface area, and
+	// adds at most duplicationBudget times the shape count in references.
+	// With optimizeSeconds the first build of any method is improved for up
+	// to that long by rearranging treelets of treeletLeaves subtrees.
+	// With a cacheDirectory the first build is saved there and later runs on
+	// the same scene map it back in instead of building.
+	// ------------------------------------------------------------------------
+	struct BVHBuildParams
+	{
+		BVHSplitMethod splitMethod;
+		unsigned leafThreshold;
+		unsigned sahBins;
+		float traversalCost;
+		float intersectionCost;
+		float rebuildRatio;
+		unsigned mortonBits;
+		bool lbvhSAHTop;
+		bool quantized;
+		float duplicationBudget;
+		float spatialAlpha;
+		unsigned treeletLeaves;
+		float optimizeSeconds;
+		std::string cacheDirectory;
+
+		BVHBuildParams(
+			BVHSplitMethod method = BVH_SPLIT_MEDIAN,
+			unsigned threshold = 1,
+			unsigned bins = 16,
+			float cTraversal = 1.0f,
+			float cIntersection = 1.0f
+		) :
+			splitMethod(method),
+			leafThreshold(threshold),
+			sahBins(bins),
+			traversalCost(cTraversal),
+			intersectionCost(cIntersection),
+			rebuildRatio(1.5f),
+			mortonBits(30),
+			lbvhSAHTop(false),
+			quantized(false),
+			duplicationBudget(0.25f),
+			spatialAlpha(1e-5f),
+			treeletLeaves(7),
+			optimizeSeconds(0.0f)
+		{
+
+		}
+	};
+
+	// ------------------------------------------------------------------------
+	// BVH Primitive Info
+	// Bounds of one shape, computed once and partitioned instead of the shapes.
+	// ------------------------------------------------------------------------
+	struct BVHPrimitiveInfo
+	{
+		AABB bounds;
+		vec3 centroid;
+		uint32_t index;
+	};
+
+	// ------------------------------------------------------------------------
+	// BVH Primitive Comparator
+	// ------------------------------------------------------------------------
+	struct BVHComparePrimitives
 	{
 		int split_axis;
 
-		BVHCompareShapes(const int axis = 0) : split_axis(axis)
+		BVHComparePrimitives(const int axis = 0) : split_axis(axis)
 		{
 
 		}
 
-		bool operator()(const Shape * a, const Shape * b) const
+		bool operator()(const BVHPrimitiveInfo & a, const BVHPrimitiveInfo & b) const
 		{
-			return a->worldBound().getCentroid()[split_axis] < b->worldBound().getCentroid()[split_axis];
+			return a.centroid[split_axis] < b.centroid[split_axis];
 		}
 	};
 
 	// ------------------------------------------------------------------------
 	// BVH Node Object
+	// Only used while building, the finished tree is flattened into an array
+	// of BVHLinearNodes and these are thrown away. height counts the levels
+	// of the subtree, a leaf is 1, and is only kept up to date by the
+	// treelet restructuring.
 	// ------------------------------------------------------------------------
 	struct BVHNode
 	{
 		int split_axis;
-		float split_pos;
-		std::vector<Shape *> data;
+		uint32_t prim_offset;
+		uint32_t prim_count;
+		uint32_t height;
 		AABB aabb;
 		BVHNode * l_child;
 		BVHNode * r_child;
 
 		BVHNode(
 			int axis = 0,
-			float pos = 0.0f,
-			std::vector<Shape *> data = std::vector<Shape *>(),
+			uint32_t offset = 0,
+			uint32_t count = 0,
 			AABB bbox = AABB()
 		);
 		~BVHNode();
 
-		bool isLeaf();
+		bool isLeaf() const;
+	};
+
+	// ------------------------------------------------------------------------
+	// BVH Build Task
+	// A subtree left for the parallel pass, node is already linked into the tree.
+	// ------------------------------------------------------------------------
+	struct BVHBuildTask
+	{
+		BVHNode * node;
+		uint32_t start;
+		uint32_t end;
+		int depth;
+	};
+
+	// ------------------------------------------------------------------------
+	// BVH Split Candidate
+	// Best boundary after bin of axis, found while binning for the SBVH. cost
+	// is the unscaled SAH sum, count times surface area over both sides.
+	// ------------------------------------------------------------------------
+	struct BVHSplitCandidate
+	{
+		float cost;
+		int axis;
+		unsigned bin;
+		AABB left;
+		AABB right;
+		uint32_t leftCount;
+		uint32_t rightCount;
+
+		BVHSplitCandidate() : cost(INFINITY), axis(0), bin(0), leftCount(0), rightCount(0)
+		{
+
+		}
 	};
 
+	// ------------------------------------------------------------------------
+	// BVH Spatial Build Task
+	// Same as BVHBuildTask for the SBVH, which can't partition in place since
+	// spatial splits add references. budget is the subtree's share of the
+	// references spatial splits may add.
+	// ------------------------------------------------------------------------
+	struct BVHSpatialTask
+	{
+		BVHNode * node;
+		std::vector<BVHPrimitiveInfo> refs;
+		int depth;
+		uint32_t budget;
+	};
+
+	// ------------------------------------------------------------------------
+	// BVH Morton Primitive
+	// Morton code of a primitive centroid, radix sorted along with its index.
+	// ------------------------------------------------------------------------
+	struct BVHMortonPrim
+	{
+		uint64_t code;
+		uint32_t index;
+	};
+
+	// ------------------------------------------------------------------------
+	// BVH Linear Node Object
+	// 32 bytes, two to a cache line. Nodes are stored depth-first, so the left
+	// child of an interior node always follows it, the right one is at offset.
+	// A leaf references prim_count shapes starting at offset while it's built
+	// & cached, once the shapes are sorted by type offset is the leaf's
+	// number in m_leafPacks.
+	// ------------------------------------------------------------------------
+	struct BVHLinearNode
+	{
+		float pmin[3];
+		uint32_t offset;
+		float pmax[3];
+		uint16_t prim_count;
+		uint8_t split_axis;
+		uint8_t pad;
+
+		bool isLeaf() const
+		{
+			return prim_count > 0;
+		}
+	};
+
+	static_assert(sizeof(BVHLinearNode) == 32, "BVHLinearNode must stay 32 bytes");
+
 	// ------------------------------------------------------------------------
 	// BVH Accelerator Object
+	// Single rays test the shapes of a leaf through m_leafPacks, packets go
+	// through the shapes one at a time.
 	// ------------------------------------------------------------------------
 	class BVHAccel : public virtual Accelerator
 	{
 	public:
-		BVHAccel(const std::vector<Shape *> shapes = std::vector<Shape *>(), const float lThreshold = 1);
+		BVHAccel(const std::vector<Shape *> shapes = std::vector<Shape *>(), const BVHBuildParams & params = BVHBuildParams());
 		~BVHAccel();
 
-		virtual void update() const override;
-		virtual bool intersect(const Ray & ray, Intersection & iSect) override;
+		virtual bool update() override;
+		using Accelerator::intersect;
+		virtual bool intersect(const Ray & ray, Hit & hit) override;
 		virtual bool intersectP(const Ray & ray) override;
+		virtual int intersect(const RayPacket & packet, Intersection * iSects) override;
+		virtual int intersectP(const RayPacket & packet) override;
 		virtual void init() override;
-		void buildRecursive(BVHNode * node, int depth, std::vector<Shape *> & shapes);
-		void traverse(BVHNode * node, const Ray & ray, bool & bHit, float & tHit, float & tHit0, float & tHit1, Intersection & iSect);
-		void traverseP(BVHNode * node, const Ray & ray, bool & bHit, float & tHit, float & tHit0, float & tHit1);
-	private:
-		unsigned m_leafThreshold;
-		BVHNode * m_root;
+		virtual float getSAHCost() const;
+		virtual void refit();
+	protected:
+		BVHNode * buildTree(uint32_t & nodeCount);
+		void buildRecursive(BVHNode * node, const uint32_t start, const uint32_t end, const int depth, uint32_t & nodeCount, std::vector<BVHBuildTask> * tasks);
+		void computeBounds(const uint32_t start, const uint32_t end, AABB & bbox, AABB & cbox) const;
+		bool splitSAH(const uint32_t start, const uint32_t end, const AABB & bbox, const AABB & cbox, const int axis, uint32_t & mid);
+		template <typename Predicate>
+		uint32_t partitionPrimitives(const uint32_t start, const uint32_t end, const Predicate & isLeft);
+		BVHNode * buildLBVH(uint32_t & nodeCount);
+		BVHNode * emitLBVH(const std::vector<BVHMortonPrim> & morton, const uint32_t start, const uint32_t end, int bit, uint32_t & nodeCount);
+		BVHNode * emitUpperLBVH(std::vector<BVHNode *> & treelets, const std::vector<BVHMortonPrim> & morton, const uint32_t start, const uint32_t end, int bit, uint32_t & nodeCount);
+		BVHNode * buildUpperSAH(std::vector<BVHNode *> & roots, const uint32_t start, const uint32_t end, uint32_t & nodeCount);
+		BVHNode * buildSBVH(uint32_t & nodeCount);
+		void buildSpatialRecursive(BVHNode * node, std::vector<BVHPrimitiveInfo> & refs, const int depth, uint32_t budget, uint32_t & nodeCount, std::vector<BVHPrimitiveInfo> & leaves, std::vector<BVHSpatialTask> * tasks);
+		void findSpatialSplit(const std::vector<BVHPrimitiveInfo> & refs, const AABB & bbox, BVHSplitCandidate & best) const;
+		bool partitionSpatial(std::vector<BVHPrimitiveInfo> & refs, const AABB & bbox, const BVHSplitCandidate & split, uint32_t & budget, std::vector<BVHPrimitiveInfo> & left, std::vector<BVHPrimitiveInfo> & right) const;
+		bool clipReference(const BVHPrimitiveInfo & ref, const int axis, const float min, const float max, BVHPrimitiveInfo & part) const;
+		void optimizeTreelets(BVHNode * root);
+		uint32_t flatten(const BVHNode * node, uint32_t & offset);
+		void refitNode(const uint32_t index);
+		bool isCached() const;
+		bool loadCache(const uint64_t key, const std::size_t nodeSize, void *& nodes, uint32_t & nodeCount);
+		void saveCache(const uint64_t key, const void * nodes, const std::size_t nodeSize, const uint32_t nodeCount);
+		void freeNodes(void * nodes);
+
+		BVHBuildParams m_params;
+		BVHLinearNode * m_nodes;
+		uint32_t m_nodeCount;
+		float m_builtSAHCost;
+		std::vector<BVHPrimitiveInfo> m_buildPrims;
+		std::vector<BVHPrimitiveInfo> m_buildScratch;
+		uint32_t m_buildTaskSize;
+		float m_buildRootArea;
+		std::vector<Shape *> m_sceneShapes;
+		std::vector<uint32_t> m_buildOrder;
+		MappedFile m_cacheFile;
+		BVHLeafPacks m_leafPacks;
 	};
 
 }
@@ -0,0 +1,230 @@
+#include "bvhcache.h"
+
+// std includes
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+// mirage includes
+#include "../macros.h"
+#include "../core/threadpool.h"
+#include "../shapes/triangle.h"
+#include "../shapes/sphere.h"
+
+namespace mirage
+{
+
+	// Bumped whenever the file layout or a node layout changes
+	static const uint32_t BVH_CACHE_VERSION = 2;
+
+	// Shapes hashed per chunk, the chunk hashes are combined in order so the key doesn't depend on the thread count
+	static const uint32_t BVH_CACHE_HASH_GRAIN = 4096;
+
+	static const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+	static const uint64_t FNV_PRIME = 1099511628211ULL;
+
+	// 64-bit FNV-1a over size bytes
+	static inline uint64_t hashBytes(uint64_t hash, const void * data, const std::size_t size)
+	{
+		const unsigned char * bytes = static_cast<const unsigned char *>(data);
+		for (std::size_t i = 0; i < size; i++)
+		{
+			hash ^= bytes[i];
+			hash *= FNV_PRIME;
+		}
+		return hash;
+	}
+
+	template <typename T>
+	static inline uint64_t hashValue(const uint64_t hash, const T & value)
+	{
+		return hashBytes(hash, &value, sizeof(T));
+	}
+
+	uint64_t getBVHCacheKey(const std::vector<Shape *> & shapes, const BVHBuildParams & params, const unsigned width, const std::size_t nodeSize)
+	{
+		const uint32_t primCount = static_cast<uint32_t>(shapes.size());
+		const uint32_t chunks = (primCount + BVH_CACHE_HASH_GRAIN - 1) / BVH_CACHE_HASH_GRAIN;
+		std::vector<uint64_t> chunkHash(chunks);
+
+		ThreadPool::instance().parallelFor(chunks, [&](size_t c, unsigned)
+		{
+			const uint32_t s = static_cast<uint32_t>(c) * BVH_CACHE_HASH_GRAIN;
+			const uint32_t e = std::min(primCount, s + BVH_CACHE_HASH_GRAIN);
+
+			uint64_t hash = FNV_OFFSET_BASIS;
+			for (uint32_t i = s; i < e; i++)
+			{
+				const AABB bounds = shapes[i]->worldBound();
+				const float planes[6] = { bounds.getMin().x, bounds.getMin().y, bounds.getMin().z, bounds.getMax().x, bounds.getMax().y, bounds.getMax().z };
+				hash = hashBytes(hash, planes, sizeof(planes));
+
+				// A retriangulated mesh can keep every bound, the hierarchy built for it wouldn't fit
+				switch (shapes[i]->getType())
+				{
+				case SHAPE_TRIANGLE:
+				{
+					vec3 v0, edge_a, edge_b;
+					static_cast<const Triangle *>(shapes[i])->getEdges(v0, edge_a, edge_b);
+					const float corners[9] = { v0.x, v0.y, v0.z, edge_a.x, edge_a.y, edge_a.z, edge_b.x, edge_b.y, edge_b.z };
+					hash = hashBytes(hash, corners, sizeof(corners));
+					break;
+				}
+				case SHAPE_SPHERE:
+				{
+					const Sphere * sphere = static_cast<const Sphere *>(shapes[i]);
+					const vec3 center = sphere->getCenterTransformed();
+					const float shape[4] = { center.x, center.y, center.z, sphere->getRadiusTransformed() };
+					hash = hashBytes(hash, shape, sizeof(shape));
+					break;
+				}
+				default:
+					break;
+				}
+			}
+			chunkHash[c] = hash;
+		});
+
+		// Parameters one by one, the struct has padding & the cache directory doesn't matter
+		uint64_t key = FNV_OFFSET_BASIS;
+		key = hashValue(key, BVH_CACHE_VERSION);
+		key = hashValue(key, static_cast<uint32_t>(width));
+		key = hashValue(key, static_cast<uint32_t>(nodeSize));
+		key = hashValue(key, static_cast<int32_t>(params.splitMethod));
+		key = hashValue(key, params.leafThreshold);
+		key = hashValue(key, params.sahBins);
+		key = hashValue(key, params.traversalCost);
+		key = hashValue(key, params.intersectionCost);
+		key = hashValue(key, params.mortonBits);
+		key = hashValue(key, static_cast<uint8_t>(params.lbvhSAHTop));
+		key = hashValue(key, static_cast<uint8_t>(params.quantized));
+		key = hashValue(key, params.duplicationBudget);
+		key = hashValue(key, params.spatialAlpha);
+		key = hashValue(key, params.treeletLeaves);
+		key = hashValue(key, params.optimizeSeconds);
+		key = hashValue(key, primCount);
+		for (uint32_t c = 0; c < chunks; c++)
+			key = hashValue(key, chunkHash[c]);
+
+		return key;
+	}
+
+	std::string getBVHCachePath(const std::string & directory, const uint64_t key)
+	{
+		char name[32];
+		std::snprintf(name, sizeof(name), "bvh_%016llx.cache", static_cast<unsigned long long>(key));
+
+		if (directory.empty() || directory.back() == '/' || directory.back() == '\\')
+			return directory + name;
+		return directory + "/" + name;
+	}
+
+	bool saveBVHCache(const std::string & path, const uint64_t key, const uint32_t shapeCount, const std::vector<uint32_t> & order, const void * nodes, const std::size_t nodeSize, const uint32_t nodeCount)
+	{
+		BVHCacheHeader header;
+		std::memcpy(header.magic, "MBVH", 4);
+		header.version = BVH_CACHE_VERSION;
+		header.key = key;
+		header.nodeSize = static_cast<uint32_t>(nodeSize);
+		header.nodeCount = nodeCount;
+		header.shapeCount = shapeCount;
+		header.refCount = static_cast<uint32_t>(order.size());
+
+		const std::size_t orderEnd = sizeof(BVHCacheHeader) + order.size() * sizeof(uint32_t);
+		header.nodeOffset = static_cast<uint32_t>((orderEnd + 63) & ~static_cast<std::size_t>(63));
+
+		// Written next to the final file & renamed, so a crash never leaves half a cache behind
+		const std::string tempPath = path + ".tmp";
+		{
+			std::ofstream file(tempPath.c_str(), std::ios::binary | std::ios::trunc);
+			if (!file)
+				return false;
+
+			const char padding[64] = { 0 };
+			file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+			file.write(reinterpret_cast<const char *>(order.data()), order.size() * sizeof(uint32_t));
+			file.write(padding, header.nodeOffset - orderEnd);
+			file.write(static_cast<const char *>(nodes), nodeCount * nodeSize);
+			if (!file)
+			{
+				file.close();
+				std::remove(tempPath.c_str());
+				return false;
+			}
+		}
+
+		// rename() won't replace an existing file everywhere
+		std::remove(path.c_str());
+		if (std::rename(tempPath.c_str(), path.c_str()) != 0)
+		{
+			std::remove(tempPath.c_str());
+			return false;
+		}
+
+		return true;
+	}
+
+	bool loadBVHCache(const std::string & path, const uint64_t key, const std::size_t nodeSize, const uint32_t shapeCount, MappedFile & file, const uint32_t *& order, uint32_t & refCount, void *& nodes, uint32_t & nodeCount)
+	{
+		if (!file.open(path))
+			return false;
+
+		BVHCacheHeader header;
+		if (file.getSize() < sizeof(header))
+		{
+			file.close();
+			return false;
+		}
+		std::memcpy(&header, file.getData(), sizeof(header));
+
+		// Keys are only 64 bits, everything that can be checked cheaply is checked as well
+		const bool valid =
+			std::memcmp(header.magic, "MBVH", 4) == 0 &&
+			header.version == BVH_CACHE_VERSION &&
+			header.key == key &&
+			header.nodeSize == nodeSize &&
+			header.shapeCount == shapeCount &&
+			header.refCount >= shapeCount &&
+			header.nodeOffset % 64 == 0 &&
+			header.nodeOffset >= sizeof(header) + static_cast<std::size_t>(header.refCount) * sizeof(uint32_t) &&
+			file.getSize() >= header.nodeOffset + static_cast<std::size_t>(header.nodeCount) * nodeSize;
+		if (!valid)
+		{
+			WRN("BVHCache: " << path << " doesn't match the scene, ignoring it.");
+			file.close();
+			return false;
+		}
+
+		// Every shape has to be referenced, or it would go missing
+		order = reinterpret_cast<const uint32_t *>(file.getData() + sizeof(header));
+		std::vector<bool> seen(shapeCount, false);
+		uint32_t seenCount = 0;
+		for (uint32_t i = 0; i < header.refCount; i++)
+		{
+			if (order[i] >= shapeCount)
+			{
+				WRN("BVHCache: " << path << " is corrupt, ignoring it.");
+				file.close();
+				return false;
+			}
+			if (!seen[order[i]])
+			{
+				seen[order[i]] = true;
+				seenCount++;
+			}
+		}
+		if (seenCount != shapeCount)
+		{
+			WRN("BVHCache: " << path << " is corrupt, ignoring it.");
+			file.close();
+			return false;
+		}
+
+		refCount = header.refCount;
+		nodes = file.getData() + header.nodeOffset;
+		nodeCount = header.nodeCount;
+
+		return true;
+	}
+
+}
@@ -0,0 +1,69 @@
+#ifndef BVHCACHE_H
+#define BVHCACHE_H
+
+// std includes
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// mirage includes
+#include "bvh.h"
+#include "../utils/mappedfile.h"
+
+namespace mirage
+{
+
+	// ------------------------------------------------------------------------
+	// BVH Cache Header
+	// A cache file holds the shape order followed by the flattened nodes at
+	// nodeOffset, which is 64-byte aligned so the nodes can be used right in
+	// the mapping. The order has refCount entries, more than shapeCount when
+	// spatial splits referenced shapes from several leaves.
+	// ------------------------------------------------------------------------
+	struct BVHCacheHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		uint32_t nodeSize;
+		uint32_t nodeCount;
+		uint32_t shapeCount;
+		uint32_t refCount;
+		uint32_t nodeOffset;
+	};
+
+	// ------------------------------------------------------------------------
+	// getBVHCacheKey
+	// Hash of everything a build depends on: the world bounds of the shapes in
+	// their current order, the corners of triangles & the centers and radii
+	// of spheres (shapes with equal bounds can still differ), the build
+	// parameters and the node layout, width is the number of children per
+	// node.
+	// ------------------------------------------------------------------------
+	uint64_t getBVHCacheKey(const std::vector<Shape *> & shapes, const BVHBuildParams & params, const unsigned width, const std::size_t nodeSize);
+
+	// ------------------------------------------------------------------------
+	// getBVHCachePath
+	// File in directory that a hierarchy with key is cached in.
+	// ------------------------------------------------------------------------
+	std::string getBVHCachePath(const std::string & directory, const uint64_t key);
+
+	// ------------------------------------------------------------------------
+	// saveBVHCache
+	// Writes the shape order & nodes of a hierarchy over shapeCount shapes to
+	// path. order[i] is the index the i-th shape had before the build
+	// reordered them.
+	// ------------------------------------------------------------------------
+	bool saveBVHCache(const std::string & path, const uint64_t key, const uint32_t shapeCount, const std::vector<uint32_t> & order, const void * nodes, const std::size_t nodeSize, const uint32_t nodeCount);
+
+	// ------------------------------------------------------------------------
+	// loadBVHCache
+	// Maps path into file and points order & nodes into it. Fails, leaving
+	// file closed, unless the file holds a hierarchy with the same key, node
+	// size and shape count.
+	// ------------------------------------------------------------------------
+	bool loadBVHCache(const std::string & path, const uint64_t key, const std::size_t nodeSize, const uint32_t shapeCount, MappedFile & file, const uint32_t *& order, uint32_t & refCount, void *& nodes, uint32_t & nodeCount);
+
+}
+
+#endif // BVHCACHE_H
@@ -0,0 +1,311 @@
+#include "bvhleafpacks.h"
+
+// std includes
+#include <iostream>
+
+// mirage includes
+#include "../macros.h"
+#include "../core/threadpool.h"
+#include "../shapes/triangle.h"
+#include "../shapes/sphere.h"
+
+namespace mirage
+{
+
+	// Leaves per chunk when packs are filled by several threads
+	static const uint32_t BVH_PACK_GRAIN = 1024;
+
+	// Ray broadcast to all lanes, set up once per leaf
+	struct BVHPackRay
+	{
+		vfloat ox, oy, oz;
+		vfloat dx, dy, dz;
+
+		BVHPackRay(const Ray & ray) :
+			ox(ray.getOrigin().x), oy(ray.getOrigin().y), oz(ray.getOrigin().z),
+			dx(ray.getDirection().x), dy(ray.getDirection().y), dz(ray.getDirection().z)
+		{
+
+		}
+	};
+
+	// Möller-Trumbore against every lane of a pack, the same steps in the same order as Triangle::intersect so the
+	// distances match it exactly. Front faces always count, back faces only in lanes where twoSided is set
+	static inline vmask intersectPack(const BVHTrianglePack & pack, const BVHPackRay & r, const vfloat & twoSided, vfloat & t, vfloat & u, vfloat & v)
+	{
+		const vfloat eps(EPSILON);
+		const vfloat zero(0.0f);
+		const vfloat one(1.0f);
+
+		const vfloat ax = vfloat::load(pack.edge_a[0]);
+		const vfloat ay = vfloat::load(pack.edge_a[1]);
+		const vfloat az = vfloat::load(pack.edge_a[2]);
+		const vfloat bx = vfloat::load(pack.edge_b[0]);
+		const vfloat by = vfloat::load(pack.edge_b[1]);
+		const vfloat bz = vfloat::load(pack.edge_b[2]);
+
+		// P = cross(D, edge_b)
+		const vfloat px = r.dy * bz - by * r.dz;
+		const vfloat py = r.dz * bx - bz * r.dx;
+		const vfloat pz = r.dx * by - bx * r.dy;
+		const vfloat d = ax * px + ay * py + az * pz;
+
+		vmask valid = (d >= eps) | (d * twoSided <= zero - eps);
+
+		// T = O - v0
+		const vfloat inv_d = one / d;
+		const vfloat tx = r.ox - vfloat::load(pack.v0[0]);
+		const vfloat ty = r.oy - vfloat::load(pack.v0[1]);
+		const vfloat tz = r.oz - vfloat::load(pack.v0[2]);
+		u = (tx * px + ty * py + tz * pz) * inv_d;
+		valid = valid & (u >= zero) & (u <= one);
+
+		// Q = cross(T, edge_a)
+		const vfloat qx = ty * az - ay * tz;
+		const vfloat qy = tz * ax - az * tx;
+		const vfloat qz = tx * ay - ax * ty;
+		v = (r.dx * qx + r.dy * qy + r.dz * qz) * inv_d;
+		valid = valid & (v >= zero) & (u + v <= one);
+
+		t = (bx * qx + by * qy + bz * qz) * inv_d;
+		return valid & (t >= eps);
+	}
+
+	// Index of the lowest set bit of a non-zero lane mask
+	static inline unsigned firstLane(int mask)
+	{
+		unsigned lane = 0;
+		for (; !(mask & 1); mask >>= 1)
+			lane++;
+		return lane;
+	}
+
+	// Copies the current corners of the triangles of a pack into its lanes
+	static void fillPack(const std::vector<Shape *> & shapes, BVHTrianglePack & pack)
+	{
+		for (unsigned lane = 0; lane < MIRAGE_SIMD_WIDTH; lane++)
+		{
+			vec3 v0, edge_a, edge_b;
+			if (pack.mask & (1u << lane))
+				static_cast<const Triangle *>(shapes[pack.prim[lane]])->getEdges(v0, edge_a, edge_b);
+
+			// Unused lanes keep zero edges, which no ray can hit
+			for (int axis = 0; axis < 3; axis++)
+			{
+				pack.v0[axis][lane] = v0[axis];
+				pack.edge_a[axis][lane] = edge_a[axis];
+				pack.edge_b[axis][lane] = edge_b[axis];
+			}
+		}
+	}
+
+	// Copies the current center & radius of a sphere
+	static void fillSphere(const std::vector<Shape *> & shapes, BVHSphere & sphere)
+	{
+		const Sphere * shape = static_cast<const Sphere *>(shapes[sphere.prim]);
+		const vec3 center = shape->getCenterTransformed();
+		for (int axis = 0; axis < 3; axis++)
+			sphere.center[axis] = center[axis];
+		sphere.radius = shape->getRadiusTransformed();
+	}
+
+	BVHLeafPacks::BVHLeafPacks()
+	{
+
+	}
+
+	void BVHLeafPacks::build(const std::vector<Shape *> & shapes, const std::vector<BVHLeafRange> & leaves)
+	{
+		// Count the shapes of each type per leaf, the only place that asks a shape what it is
+		m_leaves.assign(leaves.size() + 1, BVHLeafTypes());
+		ThreadPool::instance().parallelFor(leaves.size(), [&](size_t i, unsigned)
+		{
+			uint32_t triangles = 0, spheres = 0, others = 0;
+			for (uint32_t k = leaves[i].offset; k < leaves[i].offset + leaves[i].count; k++)
+			{
+				switch (shapes[k]->getType())
+				{
+				case SHAPE_TRIANGLE:
+					triangles++;
+					break;
+				case SHAPE_SPHERE:
+					spheres++;
+					break;
+				default:
+					others++;
+					break;
+				}
+			}
+			m_leaves[i + 1].firstPack = (triangles + MIRAGE_SIMD_WIDTH - 1) / MIRAGE_SIMD_WIDTH;
+			m_leaves[i + 1].firstSphere = spheres;
+			m_leaves[i + 1].firstShape = others;
+		}, BVH_PACK_GRAIN);
+
+		// Every leaf gets whole packs of its own, laid out in leaf order like its spheres & other shapes
+		for (size_t i = 0; i < leaves.size(); i++)
+		{
+			m_leaves[i + 1].firstPack += m_leaves[i].firstPack;
+			m_leaves[i + 1].firstSphere += m_leaves[i].firstSphere;
+			m_leaves[i + 1].firstShape += m_leaves[i].firstShape;
+		}
+
+		m_packs.assign(m_leaves.back().firstPack, BVHTrianglePack());
+		m_spheres.assign(m_leaves.back().firstSphere, BVHSphere());
+		m_shapes.assign(m_leaves.back().firstShape, 0);
+
+		ThreadPool::instance().parallelFor(leaves.size(), [&](size_t i, unsigned)
+		{
+			const BVHLeafRange & leaf = leaves[i];
+			BVHLeafTypes & first = m_leaves[i];
+			first.offset = leaf.offset;
+
+			uint32_t triangles = 0, spheres = 0, others = 0;
+			for (uint32_t k = leaf.offset; k < leaf.offset + leaf.count; k++)
+			{
+				switch (shapes[k]->getType())
+				{
+				case SHAPE_TRIANGLE:
+				{
+					BVHTrianglePack & pack = m_packs[first.firstPack + triangles / MIRAGE_SIMD_WIDTH];
+					const unsigned lane = triangles % MIRAGE_SIMD_WIDTH;
+					pack.prim[lane] = k;
+					pack.twoSided[lane] = static_cast<const Triangle *>(shapes[k])->isTwoSided() ? 1.0f : 0.0f;
+					pack.mask |= 1u << lane;
+					triangles++;
+					break;
+				}
+				case SHAPE_SPHERE:
+					m_spheres[first.firstSphere + spheres++].prim = k;
+					break;
+				default:
+					m_shapes[first.firstShape + others++] = k;
+					break;
+				}
+			}
+
+			for (uint32_t p = first.firstPack; p < m_leaves[i + 1].firstPack; p++)
+				fillPack(shapes, m_packs[p]);
+			for (uint32_t s = first.firstSphere; s < m_leaves[i + 1].firstSphere; s++)
+				fillSphere(shapes, m_spheres[s]);
+		}, BVH_PACK_GRAIN);
+	}
+
+	void BVHLeafPacks::refit(const std::vector<Shape *> & shapes)
+	{
+		// Same shapes in the same places, only their corners & centers moved
+		ThreadPool::instance().parallelFor(m_packs.size(), [&](size_t i, unsigned)
+		{
+			fillPack(shapes, m_packs[i]);
+		}, BVH_PACK_GRAIN);
+		ThreadPool::instance().parallelFor(m_spheres.size(), [&](size_t i, unsigned)
+		{
+			fillSphere(shapes, m_spheres[i]);
+		}, BVH_PACK_GRAIN);
+	}
+
+	bool BVHLeafPacks::intersect(const std::vector<Shape *> & shapes, const uint32_t leaf, const Ray & ray, Hit & hit) const
+	{
+		const BVHPackRay r(ray);
+		const vfloat mint(ray.mint);
+		const vfloat inf(INFINITY);
+		bool result = false;
+
+		const BVHLeafTypes & first = m_leaves[leaf];
+		const BVHLeafTypes & last = m_leaves[leaf + 1];
+		for (uint32_t p = first.firstPack; p < last.firstPack; p++)
+		{
+			const BVHTrianglePack & pack = m_packs[p];
+
+			// t is only set once the test returns, so it can't share an expression with it
+			vfloat t(0.0f), u(0.0f), v(0.0f);
+			vmask valid = intersectPack(pack, r, vfloat::load(pack.twoSided), t, u, v);
+			valid = valid & (t >= mint) & (t < vfloat(hit.t));
+			const int hits = movemask(valid) & pack.mask;
+			if (hits)
+			{
+				// Nearest lane without leaving the registers, ties go to the first lane like they would in a loop
+				const float tNearest = hmin(select(valid, t, inf));
+				const unsigned lane = firstLane(movemask(valid & (t <= vfloat(tNearest))) & hits);
+
+				float lanes[2][MIRAGE_SIMD_WIDTH];
+				u.store(lanes[0]);
+				v.store(lanes[1]);
+				hit.t = tNearest;
+				hit.u = lanes[0][lane];
+				hit.v = lanes[1][lane];
+				hit.prim = pack.prim[lane];
+				result = true;
+			}
+		}
+
+		for (uint32_t s = first.firstSphere; s < last.firstSphere; s++)
+		{
+			const BVHSphere & sphere = m_spheres[s];
+			if (Sphere::intersectSphere(vec3(sphere.center[0], sphere.center[1], sphere.center[2]), sphere.radius, ray, hit))
+			{
+				hit.prim = sphere.prim;
+				result = true;
+			}
+		}
+
+		for (uint32_t k = first.firstShape; k < last.firstShape; k++)
+		{
+			if (shapes[m_shapes[k]]->intersect(ray, hit))
+			{
+				hit.prim = m_shapes[k];
+				result = true;
+			}
+		}
+
+		return result;
+	}
+
+	bool BVHLeafPacks::intersectP(const std::vector<Shape *> & shapes, const uint32_t leaf, const Ray & ray) const
+	{
+		const BVHPackRay r(ray);
+		const vfloat twoSided(0.0f);
+		const vfloat mint(ray.mint);
+		const vfloat maxt(ray.maxt);
+
+		// Back faces never block, same as Triangle::intersectP
+		const BVHLeafTypes & first = m_leaves[leaf];
+		const BVHLeafTypes & last = m_leaves[leaf + 1];
+		for (uint32_t p = first.firstPack; p < last.firstPack; p++)
+		{
+			const BVHTrianglePack & pack = m_packs[p];
+
+			vfloat t(0.0f), u(0.0f), v(0.0f);
+			vmask valid = intersectPack(pack, r, twoSided, t, u, v);
+			valid = valid & (t >= mint) & (t <= maxt);
+			if (movemask(valid) & pack.mask)
+				return true;
+		}
+
+		for (uint32_t s = first.firstSphere; s < last.firstSphere; s++)
+		{
+			const BVHSphere & sphere = m_spheres[s];
+			if (Sphere::intersectSphereP(vec3(sphere.center[0], sphere.center[1], sphere.center[2]), sphere.radius, ray))
+				return true;
+		}
+
+		for (uint32_t k = first.firstShape; k < last.firstShape; k++)
+		{
+			if (shapes[m_shapes[k]]->intersectP(ray))
+				return true;
+		}
+
+		return false;
+	}
+
+	uint32_t BVHLeafPacks::getOffset(const uint32_t leaf) const
+	{
+		return m_leaves[leaf].offset;
+	}
+
+	std::size_t BVHLeafPacks::getMemoryUsage() const
+	{
+		return m_packs.size() * sizeof(BVHTrianglePack) + m_spheres.size() * sizeof(BVHSphere) +
+			m_shapes.size() * sizeof(uint32_t) + m_leaves.size() * sizeof(BVHLeafTypes);
+	}
+
+}
@@ -0,0 +1,97 @@
+#ifndef BVHLEAFPACKS_H
+#define BVHLEAFPACKS_H
+
+// std includes
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// mirage includes
+#include "../core/shape.h"
+#include "../math/simd.h"
+
+namespace mirage
+{
+
+	// ------------------------------------------------------------------------
+	// BVH Triangle Pack
+	// Up to MIRAGE_SIMD_WIDTH triangles of a leaf with their first vertex &
+	// edges in SoA form so one Möller-Trumbore test covers all of them.
+	// twoSided is 1 for lanes that may be hit from behind and 0 for the rest,
+	// prim holds the shape index of each lane and mask the lanes in use.
+	// ------------------------------------------------------------------------
+	struct BVHTrianglePack
+	{
+		float v0[3][MIRAGE_SIMD_WIDTH];
+		float edge_a[3][MIRAGE_SIMD_WIDTH];
+		float edge_b[3][MIRAGE_SIMD_WIDTH];
+		float twoSided[MIRAGE_SIMD_WIDTH];
+		uint32_t prim[MIRAGE_SIMD_WIDTH];
+		uint32_t mask;
+	};
+
+	// ------------------------------------------------------------------------
+	// BVH Sphere
+	// World space center & radius of a sphere and its shape index.
+	// ------------------------------------------------------------------------
+	struct BVHSphere
+	{
+		float center[3];
+		float radius;
+		uint32_t prim;
+	};
+
+	// ------------------------------------------------------------------------
+	// BVH Leaf Types
+	// Where the primitives of a leaf start in each typed array, the next
+	// leaf's starts end them, and the offset of its first shape.
+	// ------------------------------------------------------------------------
+	struct BVHLeafTypes
+	{
+		uint32_t offset;
+		uint32_t firstPack;
+		uint32_t firstSphere;
+		uint32_t firstShape;
+	};
+
+	// ------------------------------------------------------------------------
+	// BVH Leaf Range
+	// count shapes starting at offset, all referenced by the same leaf.
+	// ------------------------------------------------------------------------
+	struct BVHLeafRange
+	{
+		uint32_t offset;
+		uint32_t count;
+	};
+
+	// ------------------------------------------------------------------------
+	// BVH Leaf Packs
+	// The shapes of every leaf of a hierarchy sorted by type once at build
+	// time: triangles into BVHTrianglePacks, spheres into BVHSpheres and the
+	// rest into a list of shape indices. Leaves are numbered in the order
+	// build() gets them, hierarchies store that number in their leaf nodes
+	// and getOffset() turns it back into the leaf's shapes. Each typed range
+	// is tested with an inlined kernel, only shapes of other types cost a
+	// virtual call. Hits are recorded with prim set to the shape's index.
+	// ------------------------------------------------------------------------
+	class BVHLeafPacks
+	{
+	public:
+		BVHLeafPacks();
+
+		void build(const std::vector<Shape *> & shapes, const std::vector<BVHLeafRange> & leaves);
+		void refit(const std::vector<Shape *> & shapes);
+		bool intersect(const std::vector<Shape *> & shapes, const uint32_t leaf, const Ray & ray, Hit & hit) const;
+		bool intersectP(const std::vector<Shape *> & shapes, const uint32_t leaf, const Ray & ray) const;
+		uint32_t getOffset(const uint32_t leaf) const;
+		std::size_t getMemoryUsage() const;
+	private:
+		std::vector<BVHTrianglePack> m_packs;
+		std::vector<BVHSphere> m_spheres;
+		std::vector<uint32_t> m_shapes;
+		std::vector<BVHLeafTypes> m_leaves;
+	};
+
+}
+
+#endif // BVHLEAFPACKS_H
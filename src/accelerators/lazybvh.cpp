@@ -0,0 +1,415 @@
+#include "lazybvh.h"
+
+// std includes
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+// mirage includes
+#include "../macros.h"
+#include "../core/threadpool.h"
+
+namespace mirage
+{
+
+	// Deepest tree the traversal can walk, the median splits past LAZY_BVH_MAX_SAH_DEPTH stay below it
+	static const int LAZY_BVH_STACK_SIZE = 128;
+
+	// Past this depth the SAH gives way to median splits, same as the full build
+	static const uint32_t LAZY_BVH_MAX_SAH_DEPTH = 64;
+
+	// Levels init() splits before anything is traced
+	static const uint32_t LAZY_BVH_EAGER_DEPTH = 6;
+
+	// Most bins a node is split with
+	static const unsigned LAZY_BVH_MAX_BINS = 64;
+
+	// Primitives bounded per chunk by init()
+	static const uint32_t LAZY_BVH_GRAIN = 4096;
+
+	// A node waiting on the traversal stack with the distance the ray enters its box
+	struct LazyBVHEntry
+	{
+		LazyBVHNode * node;
+		float tEntry;
+	};
+
+	// Slab test of one node against a single ray, a hit if the box overlaps [tNear, tFar]
+	static inline bool intersectNode(const AABB & box, const vec3 & ro, const vec3 & rd_inv, const float tNear, const float tFar, float & tEntry)
+	{
+		const float t1 = (box.getMin().x - ro.x) * rd_inv.x;
+		const float t2 = (box.getMax().x - ro.x) * rd_inv.x;
+		const float t3 = (box.getMin().y - ro.y) * rd_inv.y;
+		const float t4 = (box.getMax().y - ro.y) * rd_inv.y;
+		const float t5 = (box.getMin().z - ro.z) * rd_inv.z;
+		const float t6 = (box.getMax().z - ro.z) * rd_inv.z;
+
+		const float tboxmin = std::max(std::max(std::min(t1, t2), std::min(t3, t4)), std::min(t5, t6));
+		const float tboxmax = std::min(std::min(std::max(t1, t2), std::max(t3, t4)), std::max(t5, t6));
+
+		if (tboxmax < std::max(tboxmin, tNear) || tboxmin > tFar)
+			return false;
+
+		tEntry = tboxmin;
+		return true;
+	}
+
+	// Pushes the children that overlap [tNear, tFar], the nearer one last so it's popped first
+	static inline void pushChildren(LazyBVHNode * children, const vec3 & ro, const vec3 & rd_inv, const float tNear, const float tFar, LazyBVHEntry * stack, int & stackSize)
+	{
+		LazyBVHEntry l = { &children[0], 0.0f };
+		LazyBVHEntry r = { &children[1], 0.0f };
+		const bool hitL = intersectNode(l.node->aabb, ro, rd_inv, tNear, tFar, l.tEntry);
+		const bool hitR = intersectNode(r.node->aabb, ro, rd_inv, tNear, tFar, r.tEntry);
+
+		if (hitL && hitR)
+		{
+			if (l.tEntry <= r.tEntry)
+				std::swap(l, r);
+			stack[stackSize++] = l;
+			stack[stackSize++] = r;
+		}
+		else if (hitL)
+		{
+			stack[stackSize++] = l;
+		}
+		else if (hitR)
+		{
+			stack[stackSize++] = r;
+		}
+	}
+
+	// Bounds of the primitives in [begin, end)
+	static AABB boundRange(const std::vector<BVHPrimitiveInfo> & prims, const uint32_t begin, const uint32_t end)
+	{
+		AABB bbox = prims[begin].bounds;
+		for (uint32_t k = begin + 1; k < end; k++)
+			bbox = bbox.addBox(prims[k].bounds);
+		return bbox;
+	}
+
+	// Deletes everything below node
+	static void freeChildren(LazyBVHNode * node)
+	{
+		if (!node->children)
+			return;
+
+		freeChildren(&node->children[0]);
+		freeChildren(&node->children[1]);
+		delete[] node->children;
+		node->children = nullptr;
+	}
+
+	// ------------------------------------------------------------------------
+	// Lazy BVH Accelerator Object
+	// ------------------------------------------------------------------------
+	LazyBVHAccel::LazyBVHAccel(const std::vector<Shape *> shapes, const BVHBuildParams & params) :
+		Accelerator(shapes),
+		m_params(params),
+		m_root(nullptr),
+		m_expandedCount(0)
+	{
+		LOG("LazyBVHAccel: a New instance was created.");
+		LOG("LazyBVHAccel: Number of loaded shapes: " << m_shapes.size());
+	}
+
+	LazyBVHAccel::~LazyBVHAccel()
+	{
+		if (m_root)
+			LOG("LazyBVHAccel: " << m_expandedCount << " nodes were split in total.");
+
+		freeTree();
+	}
+
+	bool LazyBVHAccel::update()
+	{
+		if (!m_initialized)
+			return false;
+
+		std::atomic<bool> moved(false);
+		ThreadPool::instance().parallelFor(m_shapes.size(), [&](size_t i, unsigned)
+		{
+			if (m_shapes[i]->getTransform().reqStateUpdate())
+			{
+				m_shapes[i]->update();
+				moved = true;
+			}
+		}, LAZY_BVH_GRAIN);
+
+		if (!moved)
+			return false;
+
+		// A rebuild only costs the top levels, the rest regrows where rays go
+		init();
+		return true;
+	}
+
+	bool LazyBVHAccel::intersect(const Ray & ray, Hit & hit)
+	{
+		bool result = false;
+
+		const vec3 ro = ray.getOrigin();
+		const vec3 rd_inv = ray.getDirectionInv();
+
+		LazyBVHEntry stack[LAZY_BVH_STACK_SIZE];
+		int stackSize = 0;
+		if (m_root && intersectNode(m_root->aabb, ro, rd_inv, ray.mint, hit.t, stack[0].tEntry))
+		{
+			stack[0].node = m_root;
+			stackSize = 1;
+		}
+		while (stackSize > 0)
+		{
+			const LazyBVHEntry entry = stack[--stackSize];
+			if (entry.tEntry > hit.t)
+				continue;
+
+			LazyBVHNode * children = expand(*entry.node);
+			if (!children)
+			{
+				for (uint32_t k = entry.node->offset; k < entry.node->offset + entry.node->count; k++)
+				{
+					if (m_shapes[m_prims[k].index]->intersect(ray, hit))
+					{
+						hit.prim = m_prims[k].index;
+						result = true;
+					}
+				}
+			}
+			else
+			{
+				pushChildren(children, ro, rd_inv, ray.mint, hit.t, stack, stackSize);
+			}
+		}
+
+		return result;
+	}
+
+	bool LazyBVHAccel::intersectP(const Ray & ray)
+	{
+		const vec3 ro = ray.getOrigin();
+		const vec3 rd_inv = ray.getDirectionInv();
+
+		LazyBVHEntry stack[LAZY_BVH_STACK_SIZE];
+		int stackSize = 0;
+		if (m_root && intersectNode(m_root->aabb, ro, rd_inv, ray.mint, ray.maxt, stack[0].tEntry))
+		{
+			stack[0].node = m_root;
+			stackSize = 1;
+		}
+		while (stackSize > 0)
+		{
+			const LazyBVHEntry entry = stack[--stackSize];
+
+			LazyBVHNode * children = expand(*entry.node);
+			if (!children)
+			{
+				for (uint32_t k = entry.node->offset; k < entry.node->offset + entry.node->count; k++)
+				{
+					if (m_shapes[m_prims[k].index]->intersectP(ray))
+						return true;
+				}
+			}
+			else
+			{
+				pushChildren(children, ro, rd_inv, ray.mint, ray.maxt, stack, stackSize);
+			}
+		}
+
+		return false;
+	}
+
+	void LazyBVHAccel::init()
+	{
+		LOG("LazyBVHAccel: Started building the top levels...");
+		auto startTime = std::chrono::steady_clock::now();
+
+		freeTree();
+		m_expandedCount = 0;
+
+		const uint32_t primCount = static_cast<uint32_t>(m_shapes.size());
+		m_prims.resize(primCount);
+		ThreadPool & threadPool = ThreadPool::instance();
+		threadPool.parallelFor(primCount, [&](size_t i, unsigned)
+		{
+			m_prims[i].bounds = m_shapes[i]->worldBound();
+			m_prims[i].centroid = m_prims[i].bounds.getCentroid();
+			m_prims[i].index = static_cast<uint32_t>(i);
+		}, LAZY_BVH_GRAIN);
+
+		if (primCount > 0)
+		{
+			m_root = new LazyBVHNode();
+			m_root->aabb = boundRange(m_prims, 0, primCount);
+			m_root->count = primCount;
+
+			// Split the top levels up front, each level's nodes in parallel, so no ray waits on the big splits
+			std::vector<LazyBVHNode *> level(1, m_root);
+			for (uint32_t depth = 0; depth < LAZY_BVH_EAGER_DEPTH && !level.empty(); depth++)
+			{
+				threadPool.parallelFor(level.size(), [&](size_t i, unsigned)
+				{
+					expand(*level[i]);
+				});
+
+				std::vector<LazyBVHNode *> next;
+				for (size_t i = 0; i < level.size(); i++)
+				{
+					if (level[i]->children)
+					{
+						next.push_back(&level[i]->children[0]);
+						next.push_back(&level[i]->children[1]);
+					}
+				}
+				level.swap(next);
+			}
+		}
+
+		float duration = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
+
+		m_initialized = true;
+		LOG("LazyBVHAccel: Top levels built! Time taken: " << duration << "s on " << threadPool.getThreadCount() << " threads, " << m_expandedCount << " nodes split so far.");
+	}
+
+	uint32_t LazyBVHAccel::getExpandedCount() const
+	{
+		return m_expandedCount;
+	}
+
+	LazyBVHNode * LazyBVHAccel::expand(LazyBVHNode & node)
+	{
+		// Ready nodes are final, the acquire makes their children visible
+		if (node.state.load(std::memory_order_acquire) == LazyBVHNode::LAZY_READY)
+			return node.children;
+
+		int expected = LazyBVHNode::LAZY_UNEXPANDED;
+		if (node.state.compare_exchange_strong(expected, LazyBVHNode::LAZY_EXPANDING, std::memory_order_acq_rel))
+		{
+			split(node);
+			node.state.store(LazyBVHNode::LAZY_READY, std::memory_order_release);
+			return node.children;
+		}
+
+		// Another thread got here first, a split takes about as long as tracing through what it produces
+		while (node.state.load(std::memory_order_acquire) != LazyBVHNode::LAZY_READY)
+			std::this_thread::yield();
+
+		return node.children;
+	}
+
+	void LazyBVHAccel::split(LazyBVHNode & node)
+	{
+		if (node.count <= 1)
+			return;
+
+		const uint32_t begin = node.offset;
+		const uint32_t end = node.offset + node.count;
+
+		AABB cbox(m_prims[begin].centroid, m_prims[begin].centroid);
+		for (uint32_t k = begin + 1; k < end; k++)
+			cbox = cbox.addPoint(m_prims[k].centroid);
+
+		const int axis = cbox.getMaximumExtent();
+		const float cmin = cbox.getMin()[axis];
+		const float extent = cbox.getMax()[axis] - cmin;
+
+		uint32_t mid = begin + node.count / 2;
+		if (extent <= 0.0f)
+		{
+			// Nothing tells the centroids apart, halve the range as it is unless it fits a leaf
+			if (node.count <= m_params.leafThreshold)
+				return;
+		}
+		else if (node.depth >= LAZY_BVH_MAX_SAH_DEPTH)
+		{
+			std::nth_element(m_prims.begin() + begin, m_prims.begin() + mid, m_prims.begin() + end, BVHComparePrimitives(axis));
+		}
+		else
+		{
+			// Binned SAH along the longest centroid axis
+			const unsigned binCount = std::min(std::max(m_params.sahBins, 2u), LAZY_BVH_MAX_BINS);
+			const float scale = binCount / extent;
+			auto binOf = [&](const BVHPrimitiveInfo & prim)
+			{
+				return std::min(static_cast<unsigned>((prim.centroid[axis] - cmin) * scale), binCount - 1);
+			};
+
+			AABB binBounds[LAZY_BVH_MAX_BINS];
+			uint32_t binCounts[LAZY_BVH_MAX_BINS] = { 0 };
+			for (uint32_t k = begin; k < end; k++)
+			{
+				const unsigned b = binOf(m_prims[k]);
+				binBounds[b] = binCounts[b] == 0 ? m_prims[k].bounds : binBounds[b].addBox(m_prims[k].bounds);
+				binCounts[b]++;
+			}
+
+			// Right sides swept once, the left side grows along with the candidate planes
+			float rightArea[LAZY_BVH_MAX_BINS];
+			uint32_t rightCount[LAZY_BVH_MAX_BINS];
+			AABB box;
+			uint32_t count = 0;
+			for (unsigned b = binCount - 1; b > 0; b--)
+			{
+				if (binCounts[b] > 0)
+					box = count == 0 ? binBounds[b] : box.addBox(binBounds[b]);
+				count += binCounts[b];
+				rightArea[b] = count > 0 ? box.getSurfaceArea() : 0.0f;
+				rightCount[b] = count;
+			}
+
+			float bestCost = INFINITY;
+			unsigned bestBin = 0;
+			count = 0;
+			for (unsigned b = 1; b < binCount; b++)
+			{
+				if (binCounts[b - 1] > 0)
+					box = count == 0 ? binBounds[b - 1] : box.addBox(binBounds[b - 1]);
+				count += binCounts[b - 1];
+				if (count == 0 || rightCount[b] == 0)
+					continue;
+
+				const float cost = count * box.getSurfaceArea() + rightCount[b] * rightArea[b];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestBin = b;
+				}
+			}
+
+			const float nodeArea = node.aabb.getSurfaceArea();
+			const float splitCost = m_params.traversalCost + m_params.intersectionCost * (nodeArea > 0.0f ? bestCost / nodeArea : static_cast<float>(node.count));
+			if (node.count <= m_params.leafThreshold && m_params.intersectionCost * node.count <= splitCost)
+				return;
+
+			mid = static_cast<uint32_t>(std::partition(m_prims.begin() + begin, m_prims.begin() + end, [&](const BVHPrimitiveInfo & prim)
+			{
+				return binOf(prim) < bestBin;
+			}) - m_prims.begin());
+		}
+
+		LazyBVHNode * children = new LazyBVHNode[2];
+		children[0].offset = begin;
+		children[0].count = mid - begin;
+		children[1].offset = mid;
+		children[1].count = end - mid;
+		for (int c = 0; c < 2; c++)
+		{
+			children[c].depth = node.depth + 1;
+			children[c].aabb = boundRange(m_prims, children[c].offset, children[c].offset + children[c].count);
+		}
+
+		node.children = children;
+		m_expandedCount++;
+	}
+
+	void LazyBVHAccel::freeTree()
+	{
+		if (m_root)
+		{
+			freeChildren(m_root);
+			DELETE(m_root);
+		}
+	}
+
+}
@@ -0,0 +1,76 @@
+#ifndef LAZYBVH_H
+#define LAZYBVH_H
+
+// std includes
+#include <cstdint>
+#include <atomic>
+#include <vector>
+
+// mirage includes
+#include "bvh.h"
+
+namespace mirage
+{
+
+	// ------------------------------------------------------------------------
+	// Lazy BVH Node Object
+	// Covers count primitives from offset on. Starts out unexpanded, the first
+	// thread that needs its children moves it to expanding, splits its range
+	// and publishes it as ready; a ready node without children is a leaf.
+	// ------------------------------------------------------------------------
+	struct LazyBVHNode
+	{
+		enum State
+		{
+			LAZY_UNEXPANDED,
+			LAZY_EXPANDING,
+			LAZY_READY
+		};
+
+		AABB aabb;
+		uint32_t offset;
+		uint32_t count;
+		uint32_t depth;
+		std::atomic<int> state;
+		LazyBVHNode * children;
+
+		LazyBVHNode() : offset(0), count(0), depth(0), state(LAZY_UNEXPANDED), children(nullptr)
+		{
+
+		}
+	};
+
+	// ------------------------------------------------------------------------
+	// Lazy BVH Accelerator Object
+	// Binned SAH hierarchy of which init() only builds the top levels, every
+	// other node is split the first time a ray reaches it. Expansion is safe
+	// from any number of rendering threads, each node is split exactly once
+	// and threads reaching it meanwhile wait for the result. Moving shapes
+	// throws the hierarchy away so it regrows around the new positions.
+	// ------------------------------------------------------------------------
+	class LazyBVHAccel : public virtual Accelerator
+	{
+	public:
+		LazyBVHAccel(const std::vector<Shape *> shapes = std::vector<Shape *>(), const BVHBuildParams & params = BVHBuildParams(BVH_SPLIT_SAH, 4));
+		~LazyBVHAccel();
+
+		virtual bool update() override;
+		using Accelerator::intersect;
+		virtual bool intersect(const Ray & ray, Hit & hit) override;
+		virtual bool intersectP(const Ray & ray) override;
+		virtual void init() override;
+		uint32_t getExpandedCount() const;
+	private:
+		LazyBVHNode * expand(LazyBVHNode & node);
+		void split(LazyBVHNode & node);
+		void freeTree();
+
+		BVHBuildParams m_params;
+		std::vector<BVHPrimitiveInfo> m_prims;
+		LazyBVHNode * m_root;
+		std::atomic<uint32_t> m_expandedCount;
+	};
+
+}
+
+#endif // LAZYBVH_H
@@ -0,0 +1,587 @@
+#include "widebvh.h"
+
+// std includes
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// mirage includes
+#include "bvhcache.h"
+#include "../macros.h"
+#include "../utils/memutils.h"
+#include "../core/threadpool.h"
+
+namespace mirage
+{
+
+	// Deepest binary tree the traversal can walk, every level pushes at most N - 1 entries
+	static const int BVH_WIDE_MAX_DEPTH = 128;
+
+	// Smallest subtree refit by a thread of its own
+	static const uint32_t BVH_WIDE_MIN_REFIT_TASK = 256;
+
+	// A node or a leaf waiting on the traversal stack, with the distances the ray enters & leaves its box
+	struct BVHWideEntry
+	{
+		uint32_t index;
+		uint32_t count;
+		float tEntry;
+		float tExit;
+	};
+
+	// Ray origin & inverse direction broadcast to all lanes
+	struct BVHWideRay
+	{
+		vfloat ox, oy, oz;
+		vfloat idx, idy, idz;
+
+		BVHWideRay(const vec3 & ro, const vec3 & rd_inv) :
+			ox(ro.x), oy(ro.y), oz(ro.z),
+			idx(rd_inv.x), idy(rd_inv.y), idz(rd_inv.z)
+		{
+
+		}
+	};
+
+	// Slab test of all children of a node at once, returns a bit per child whose box overlaps [tNear, tFar]
+	template <typename Node>
+	static inline int intersectChildren(const Node & node, const BVHWideRay & r, const float tNear, const float tFar, float * tEntry, float * tExit)
+	{
+		int hits = 0;
+		for (unsigned c = 0; c < Node::LANES; c += MIRAGE_SIMD_WIDTH)
+		{
+			vfloat lo[3];
+			vfloat hi[3];
+			node.getBounds(c, lo, hi);
+
+			const vfloat t1 = (lo[0] - r.ox) * r.idx;
+			const vfloat t2 = (hi[0] - r.ox) * r.idx;
+			const vfloat t3 = (lo[1] - r.oy) * r.idy;
+			const vfloat t4 = (hi[1] - r.oy) * r.idy;
+			const vfloat t5 = (lo[2] - r.oz) * r.idz;
+			const vfloat t6 = (hi[2] - r.oz) * r.idz;
+
+			const vfloat tboxmin = vmax(vmax(vmin(t1, t2), vmin(t3, t4)), vmin(t5, t6));
+			const vfloat tboxmax = vmin(vmin(vmax(t1, t2), vmax(t3, t4)), vmax(t5, t6));
+			tboxmin.store(tEntry + c);
+			tboxmax.store(tExit + c);
+
+			hits |= movemask((tboxmax >= vmax(tboxmin, vfloat(tNear))) & (tboxmin <= vfloat(tFar))) << c;
+		}
+
+		return hits & lanemask(node.child_count);
+	}
+
+	// Pushes the children that were hit, farthest first so the nearest is popped next
+	template <typename Node>
+	static inline void pushChildren(const Node & node, const int hits, const float * tEntry, const float * tExit, BVHWideEntry * stack, int & stackSize)
+	{
+		BVHWideEntry sorted[Node::WIDTH];
+		unsigned sortedCount = 0;
+		for (unsigned c = 0; c < Node::WIDTH; c++)
+		{
+			if (!(hits & (1 << c)))
+				continue;
+
+			BVHWideEntry entry = { node.child[c], node.count[c], tEntry[c], tExit[c] };
+			unsigned k = sortedCount++;
+			for (; k > 0 && sorted[k - 1].tEntry < entry.tEntry; k--)
+				sorted[k] = sorted[k - 1];
+			sorted[k] = entry;
+		}
+
+		for (unsigned k = 0; k < sortedCount; k++)
+			stack[stackSize++] = sorted[k];
+	}
+
+	// Closest hit over either node layout
+	template <typename Node>
+	static bool intersectWide(const Node * nodes, const uint32_t nodeCount, const std::vector<Shape *> & shapes, const BVHLeafPacks & packs, const Ray & ray, Hit & hit)
+	{
+		bool result = false;
+
+		const BVHWideRay r(ray.getOrigin(), ray.getDirectionInv());
+		float tEntry[Node::LANES];
+		float tExit[Node::LANES];
+
+		BVHWideEntry stack[BVH_WIDE_MAX_DEPTH * Node::WIDTH];
+		int stackSize = 0;
+		if (nodeCount > 0)
+		{
+			BVHWideEntry root = { 0, 0, 0.0f, INFINITY };
+			stack[stackSize++] = root;
+		}
+		while (stackSize > 0)
+		{
+			const BVHWideEntry entry = stack[--stackSize];
+
+			// Closer hits may have been found since this was pushed
+			if (entry.tEntry > hit.t)
+				continue;
+
+			if (entry.count > 0)
+			{
+				if (packs.intersect(shapes, entry.index, ray, hit))
+					result = true;
+			}
+			else
+			{
+				const Node & node = nodes[entry.index];
+				const int hits = intersectChildren(node, r, ray.mint, hit.t, tEntry, tExit);
+				pushChildren(node, hits, tEntry, tExit, stack, stackSize);
+			}
+		}
+
+		return result;
+	}
+
+	// Any hit over either node layout
+	template <typename Node>
+	static bool intersectWideP(const Node * nodes, const uint32_t nodeCount, const std::vector<Shape *> & shapes, const BVHLeafPacks & packs, const Ray & ray)
+	{
+		const BVHWideRay r(ray.getOrigin(), ray.getDirectionInv());
+		float tEntry[Node::LANES];
+		float tExit[Node::LANES];
+
+		BVHWideEntry stack[BVH_WIDE_MAX_DEPTH * Node::WIDTH];
+		int stackSize = 0;
+		if (nodeCount > 0)
+		{
+			BVHWideEntry root = { 0, 0, 0.0f, INFINITY };
+			stack[stackSize++] = root;
+		}
+		while (stackSize > 0)
+		{
+			const BVHWideEntry entry = stack[--stackSize];
+
+			// The first occluder within [mint, maxt] ends the walk
+			if (entry.count > 0)
+			{
+				if (packs.intersectP(shapes, entry.index, ray))
+					return true;
+			}
+			else
+			{
+				const Node & node = nodes[entry.index];
+				const int hits = intersectChildren(node, r, ray.mint, ray.maxt, tEntry, tExit);
+				pushChildren(node, hits, tEntry, tExit, stack, stackSize);
+			}
+		}
+
+		return false;
+	}
+
+	// Shape ranges of the leaves below all nodes, leaf children are pointed at their number in the list instead
+	template <typename Node>
+	static void collectLeaves(Node * nodes, const uint32_t nodeCount, std::vector<BVHLeafRange> & leaves)
+	{
+		for (uint32_t i = 0; i < nodeCount; i++)
+		{
+			for (uint32_t c = 0; c < nodes[i].child_count; c++)
+			{
+				if (nodes[i].count[c] > 0)
+				{
+					BVHLeafRange leaf = { nodes[i].child[c], nodes[i].count[c] };
+					nodes[i].child[c] = static_cast<uint32_t>(leaves.size());
+					leaves.push_back(leaf);
+				}
+			}
+		}
+	}
+
+	// Union of the child boxes of a node
+	template <typename Node>
+	static AABB wideNodeBounds(const Node & node)
+	{
+		AABB bbox = node.getChildBounds(0);
+		for (uint32_t c = 1; c < node.child_count; c++)
+			bbox = bbox.addBox(node.getChildBounds(c));
+		return bbox;
+	}
+
+	// Expected cost of a random ray through the root, a node is paid for once when any of its children is tested
+	template <typename Node>
+	static float wideSAHCost(const Node * nodes, const uint32_t nodeCount, const BVHBuildParams & params, const size_t shapeCount)
+	{
+		if (nodeCount == 0)
+			return 0.0f;
+
+		std::vector<AABB> nodeBounds(nodeCount);
+		for (uint32_t i = 0; i < nodeCount; i++)
+			nodeBounds[i] = wideNodeBounds(nodes[i]);
+
+		const float rootArea = nodeBounds[0].getSurfaceArea();
+		if (rootArea <= 0.0f)
+			return params.intersectionCost * shapeCount;
+
+		double cost = 0.0;
+		for (uint32_t i = 0; i < nodeCount; i++)
+		{
+			cost += params.traversalCost * nodeBounds[i].getSurfaceArea() / rootArea;
+			for (uint32_t c = 0; c < nodes[i].child_count; c++)
+			{
+				if (nodes[i].count[c] > 0)
+					cost += params.intersectionCost * nodes[i].count[c] * nodes[i].getChildBounds(c).getSurfaceArea() / rootArea;
+			}
+		}
+
+		return static_cast<float>(cost);
+	}
+
+	// Encodes the child boxes of a node relative to their union. Every plane is rounded outwards with
+	// an ulp to spare, so the decoded box still contains the real one if the decode rounds differently
+	template <unsigned N>
+	static void quantizeNode(const BVHWideNode<N> & in, BVHQuantizedNode<N> & out)
+	{
+		const AABB box = wideNodeBounds(in);
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const float origin = box.getMin()[axis];
+			const float extent = box.getMax()[axis] - origin;
+
+			// Power of two steps, q * scale is exact & only the add rounds
+			float scale = 0.0f;
+			if (extent > 0.0f)
+			{
+				int exponent;
+				std::frexp(extent / 255.0f, &exponent);
+				scale = std::ldexp(1.0f, exponent);
+				while (std::nextafter(origin + 255.0f * scale, -INFINITY) < box.getMax()[axis])
+					scale *= 2.0f;
+			}
+			out.origin[axis] = origin;
+			out.scale[axis] = scale;
+
+			for (unsigned c = 0; c < BVHQuantizedNode<N>::LANES; c++)
+			{
+				out.qmin[axis][c] = 0;
+				out.qmax[axis][c] = 0;
+				if (c >= in.child_count || scale == 0.0f)
+					continue;
+
+				const float cmin = in.bmin[axis][c];
+				const float cmax = in.bmax[axis][c];
+				int qlo = std::min(std::max(static_cast<int>(std::floor((cmin - origin) / scale)), 0), 255);
+				int qhi = std::min(std::max(static_cast<int>(std::ceil((cmax - origin) / scale)), 0), 255);
+				while (qlo > 0 && std::nextafter(origin + static_cast<float>(qlo) * scale, INFINITY) > cmin)
+					qlo--;
+				while (qhi < 255 && std::nextafter(origin + static_cast<float>(qhi) * scale, -INFINITY) < cmax)
+					qhi++;
+
+				out.qmin[axis][c] = static_cast<uint8_t>(qlo);
+				out.qmax[axis][c] = static_cast<uint8_t>(qhi);
+			}
+		}
+
+		std::copy(in.child, in.child + N, out.child);
+		std::copy(in.count, in.count + N, out.count);
+		out.child_count = in.child_count;
+	}
+
+	// ------------------------------------------------------------------------
+	// Wide BVH Accelerator Object
+	// ------------------------------------------------------------------------
+	template <unsigned N>
+	WideBVHAccel<N>::WideBVHAccel(const std::vector<Shape *> shapes, const BVHBuildParams & params) :
+		Accelerator(shapes),
+		BVHAccel(shapes, params),
+		m_wideNodes(nullptr),
+		m_quantizedNodes(nullptr),
+		m_wideNodeCount(0)
+	{
+		LOG("WideBVHAccel: a New instance was created, " << N << " children per node.");
+	}
+
+	template <unsigned N>
+	WideBVHAccel<N>::~WideBVHAccel()
+	{
+		freeNodes(m_wideNodes);
+		freeNodes(m_quantizedNodes);
+	}
+
+	template <unsigned N>
+	bool WideBVHAccel<N>::intersect(const Ray & ray, Hit & hit)
+	{
+		if (m_quantizedNodes)
+			return intersectWide(m_quantizedNodes, m_wideNodeCount, m_shapes, m_leafPacks, ray, hit);
+		return intersectWide(m_wideNodes, m_wideNodeCount, m_shapes, m_leafPacks, ray, hit);
+	}
+
+	template <unsigned N>
+	bool WideBVHAccel<N>::intersectP(const Ray & ray)
+	{
+		if (m_quantizedNodes)
+			return intersectWideP(m_quantizedNodes, m_wideNodeCount, m_shapes, m_leafPacks, ray);
+		return intersectWideP(m_wideNodes, m_wideNodeCount, m_shapes, m_leafPacks, ray);
+	}
+
+	template <unsigned N>
+	int WideBVHAccel<N>::intersect(const RayPacket & packet, Intersection * iSects)
+	{
+		// The SIMD lanes already go to the children, so packets are split into single rays
+		return Accelerator::intersect(packet, iSects);
+	}
+
+	template <unsigned N>
+	int WideBVHAccel<N>::intersectP(const RayPacket & packet)
+	{
+		return Accelerator::intersectP(packet);
+	}
+
+	template <unsigned N>
+	void WideBVHAccel<N>::init()
+	{
+		LOG("WideBVHAccel: Started building the hierarchy...");
+		auto startTime = std::chrono::steady_clock::now();
+
+		const size_t nodeSize = m_params.quantized ? sizeof(BVHQuantizedNode<N>) : sizeof(BVHWideNode<N>);
+		const bool cached = isCached();
+		const uint64_t cacheKey = cached ? getBVHCacheKey(m_shapes, m_params, N, nodeSize) : 0;
+
+		void * cachedNodes = nullptr;
+		uint32_t nodeCount = 0;
+		if (cached && loadCache(cacheKey, nodeSize, cachedNodes, m_wideNodeCount))
+		{
+			if (m_params.quantized)
+				m_quantizedNodes = static_cast<BVHQuantizedNode<N> *>(cachedNodes);
+			else
+				m_wideNodes = static_cast<BVHWideNode<N> *>(cachedNodes);
+		}
+		else
+		{
+			BVHNode * root = buildTree(nodeCount);
+
+			// Every wide node stands in for at least one binary node
+			std::vector<BVHWideNode<N>> nodes;
+			nodes.reserve(std::max<uint32_t>(nodeCount, 1));
+			if (root)
+				collapse(root, nodes);
+			DELETE(root);
+
+			freeNodes(m_wideNodes);
+			freeNodes(m_quantizedNodes);
+			m_wideNodes = nullptr;
+			m_quantizedNodes = nullptr;
+			m_wideNodeCount = static_cast<uint32_t>(nodes.size());
+			if (m_params.quantized)
+			{
+				m_quantizedNodes = static_cast<BVHQuantizedNode<N> *>(alignedAlloc(std::max<size_t>(nodes.size(), 1) * sizeof(BVHQuantizedNode<N>), 64));
+				ThreadPool::instance().parallelFor(nodes.size(), [&](size_t i, unsigned)
+				{
+					quantizeNode(nodes[i], m_quantizedNodes[i]);
+				}, 1024);
+			}
+			else
+			{
+				m_wideNodes = static_cast<BVHWideNode<N> *>(alignedAlloc(std::max<size_t>(nodes.size(), 1) * sizeof(BVHWideNode<N>), 64));
+				std::copy(nodes.begin(), nodes.end(), m_wideNodes);
+			}
+
+			if (cached)
+				saveCache(cacheKey, m_params.quantized ? static_cast<const void *>(m_quantizedNodes) : static_cast<const void *>(m_wideNodes), nodeSize, m_wideNodeCount);
+		}
+
+		std::vector<BVHLeafRange> leaves;
+		if (m_quantizedNodes)
+			collectLeaves(m_quantizedNodes, m_wideNodeCount, leaves);
+		else
+			collectLeaves(m_wideNodes, m_wideNodeCount, leaves);
+		m_leafPacks.build(m_shapes, leaves);
+
+		float duration = std::chrono::duration<float>(std::chrono::steady_clock::now() - startTime).count();
+
+		m_initialized = true;
+		m_builtSAHCost = getSAHCost();
+		LOG("WideBVHAccel: Build finished! Time taken: " << duration << "s on " << ThreadPool::instance().getThreadCount() << " threads.");
+		LOG("WideBVHAccel: " << m_wideNodeCount << " nodes of " << N << ", " << (m_wideNodeCount * nodeSize + m_shapes.size() * sizeof(Shape *)) / 1024 << " KiB, SAH cost: " << m_builtSAHCost << ".");
+		LOG("WideBVHAccel: " << leaves.size() << " leaves sorted by type, triangles " << MIRAGE_SIMD_WIDTH << " wide, into " << m_leafPacks.getMemoryUsage() / 1024 << " KiB.");
+		if (m_params.quantized && nodeCount > 0)
+		{
+			const size_t quantizedBytes = m_wideNodeCount * sizeof(BVHQuantizedNode<N>);
+			const size_t wideBytes = m_wideNodeCount * sizeof(BVHWideNode<N>);
+			const size_t binaryBytes = nodeCount * sizeof(BVHLinearNode);
+			LOG("WideBVHAccel: Quantized nodes take " << quantizedBytes / 1024 << " KiB, saving " << (wideBytes - quantizedBytes) / 1024 << " KiB against float child bounds and "
+				<< (binaryBytes > quantizedBytes ? (binaryBytes - quantizedBytes) / 1024 : 0) << " KiB against the " << nodeCount << " binary BVH nodes.");
+		}
+	}
+
+	template <unsigned N>
+	float WideBVHAccel<N>::getSAHCost() const
+	{
+		if (m_quantizedNodes)
+			return wideSAHCost(m_quantizedNodes, m_wideNodeCount, m_params, m_shapes.size());
+		return wideSAHCost(m_wideNodes, m_wideNodeCount, m_params, m_shapes.size());
+	}
+
+	template <unsigned N>
+	void WideBVHAccel<N>::refit()
+	{
+		// Laid out depth-first like the binary tree, so subtrees are contiguous & walked backwards bottom-up
+		const uint32_t taskSize = std::max(BVH_WIDE_MIN_REFIT_TASK, m_wideNodeCount / (ThreadPool::instance().getThreadCount() * 8));
+		std::vector<std::pair<uint32_t, uint32_t>> tasks;
+		std::vector<uint32_t> upper;
+		std::vector<std::pair<uint32_t, uint32_t>> ranges;
+		if (m_wideNodeCount > 0)
+			ranges.push_back(std::make_pair(0u, m_wideNodeCount));
+		while (!ranges.empty())
+		{
+			const std::pair<uint32_t, uint32_t> range = ranges.back();
+			ranges.pop_back();
+
+			if (range.second - range.first <= taskSize)
+			{
+				tasks.push_back(range);
+				continue;
+			}
+
+			// Interior children were collapsed in child order, each subtree ends where the next one starts
+			const uint32_t * child = m_quantizedNodes ? m_quantizedNodes[range.first].child : m_wideNodes[range.first].child;
+			const uint16_t * count = m_quantizedNodes ? m_quantizedNodes[range.first].count : m_wideNodes[range.first].count;
+			const uint32_t childCount = m_quantizedNodes ? m_quantizedNodes[range.first].child_count : m_wideNodes[range.first].child_count;
+
+			upper.push_back(range.first);
+			uint32_t end = range.second;
+			for (uint32_t c = childCount; c > 0; c--)
+			{
+				if (count[c - 1] > 0)
+					continue;
+				ranges.push_back(std::make_pair(child[c - 1], end));
+				end = child[c - 1];
+			}
+		}
+
+		ThreadPool::instance().parallelFor(tasks.size(), [&](size_t t, unsigned)
+		{
+			for (uint32_t i = tasks[t].second; i > tasks[t].first; i--)
+				refitWideNode(i - 1);
+		});
+
+		for (size_t i = upper.size(); i > 0; i--)
+			refitWideNode(upper[i - 1]);
+
+		m_leafPacks.refit(m_shapes);
+	}
+
+	template <unsigned N>
+	void WideBVHAccel<N>::refitWideNode(const uint32_t index)
+	{
+		// Quantized nodes are refit through a float copy & quantized again
+		BVHWideNode<N> node;
+		if (m_quantizedNodes)
+		{
+			std::copy(m_quantizedNodes[index].child, m_quantizedNodes[index].child + N, node.child);
+			std::copy(m_quantizedNodes[index].count, m_quantizedNodes[index].count + N, node.count);
+			node.child_count = m_quantizedNodes[index].child_count;
+		}
+		else
+		{
+			node = m_wideNodes[index];
+		}
+
+		for (uint32_t c = 0; c < node.child_count; c++)
+		{
+			AABB bbox;
+			if (node.count[c] > 0)
+			{
+				const uint32_t offset = m_leafPacks.getOffset(node.child[c]);
+				bbox = m_shapes[offset]->worldBound();
+				for (uint32_t k = offset + 1; k < offset + node.count[c]; k++)
+					bbox = bbox.addBox(m_shapes[k]->worldBound());
+			}
+			else
+			{
+				bbox = m_quantizedNodes ? wideNodeBounds(m_quantizedNodes[node.child[c]]) : wideNodeBounds(m_wideNodes[node.child[c]]);
+			}
+
+			for (int axis = 0; axis < 3; axis++)
+			{
+				node.bmin[axis][c] = bbox.getMin()[axis];
+				node.bmax[axis][c] = bbox.getMax()[axis];
+			}
+		}
+
+		if (m_quantizedNodes)
+			quantizeNode(node, m_quantizedNodes[index]);
+		else
+			m_wideNodes[index] = node;
+	}
+
+	template <unsigned N>
+	uint32_t WideBVHAccel<N>::collapse(const BVHNode * node, std::vector<BVHWideNode<N>> & nodes)
+	{
+		// Pull grandchildren up, always opening the interior child with the largest surface area
+		const BVHNode * children[N];
+		unsigned childCount = 0;
+		if (node->isLeaf())
+		{
+			children[childCount++] = node;
+		}
+		else
+		{
+			children[childCount++] = node->l_child;
+			children[childCount++] = node->r_child;
+		}
+
+		while (childCount < N)
+		{
+			int best = -1;
+			float bestArea = -1.0f;
+			for (unsigned c = 0; c < childCount; c++)
+			{
+				if (!children[c]->isLeaf() && children[c]->aabb.getSurfaceArea() > bestArea)
+				{
+					best = static_cast<int>(c);
+					bestArea = children[c]->aabb.getSurfaceArea();
+				}
+			}
+			if (best < 0)
+				break;
+
+			const BVHNode * opened = children[best];
+			children[best] = opened->l_child;
+			children[childCount++] = opened->r_child;
+		}
+
+		// Unused lanes keep empty boxes, child_count masks them out anyway
+		const uint32_t index = static_cast<uint32_t>(nodes.size());
+		nodes.push_back(BVHWideNode<N>());
+		BVHWideNode<N> & wide = nodes.back();
+		for (unsigned c = 0; c < BVHWideNode<N>::LANES; c++)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				wide.bmin[axis][c] = c < childCount ? children[c]->aabb.getMin()[axis] : INFINITY;
+				wide.bmax[axis][c] = c < childCount ? children[c]->aabb.getMax()[axis] : -INFINITY;
+			}
+		}
+		wide.child_count = childCount;
+
+		for (unsigned c = 0; c < N; c++)
+		{
+			nodes[index].child[c] = 0;
+			nodes[index].count[c] = 0;
+			if (c >= childCount)
+				continue;
+
+			if (children[c]->isLeaf())
+			{
+				nodes[index].child[c] = children[c]->prim_offset;
+				nodes[index].count[c] = static_cast<uint16_t>(children[c]->prim_count);
+			}
+			else
+			{
+				// Recursion may grow the vector, so no reference to our node is kept across it
+				const uint32_t child = collapse(children[c], nodes);
+				nodes[index].child[c] = child;
+			}
+		}
+
+		return index;
+	}
+
+	template class WideBVHAccel<4>;
+	template class WideBVHAccel<8>;
+
+}
@@ -0,0 +1,126 @@
+#ifndef WIDEBVH_H
+#define WIDEBVH_H
+
+// std includes
+#include <cstdint>
+
+// mirage includes
+#include "bvh.h"
+#include "../math/simd.h"
+
+namespace mirage
+{
+
+	// ------------------------------------------------------------------------
+	// Wide BVH Node Object
+	// Bounds of up to N children in SoA form so a single slab test covers all
+	// of them. Lanes are padded to whole SIMD registers and only the first
+	// child_count are valid. A child with count > 0 is a leaf of count shapes
+	// starting at child, which becomes its number in the leaf packs once the
+	// shapes are sorted by type. Otherwise child is another wide node.
+	// ------------------------------------------------------------------------
+	template <unsigned N>
+	struct BVHWideNode
+	{
+		static const unsigned WIDTH = N;
+		static const unsigned LANES = N > MIRAGE_SIMD_WIDTH ? N : MIRAGE_SIMD_WIDTH;
+
+		float bmin[3][LANES];
+		float bmax[3][LANES];
+		uint32_t child[N];
+		uint16_t count[N];
+		uint32_t child_count;
+
+		// Bounds of the MIRAGE_SIMD_WIDTH children starting at lane
+		inline void getBounds(const unsigned lane, vfloat * lo, vfloat * hi) const
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				lo[axis] = vfloat::load(&bmin[axis][lane]);
+				hi[axis] = vfloat::load(&bmax[axis][lane]);
+			}
+		}
+
+		AABB getChildBounds(const unsigned c) const
+		{
+			return AABB(vec3(bmin[0][c], bmin[1][c], bmin[2][c]), vec3(bmax[0][c], bmax[1][c], bmax[2][c]));
+		}
+	};
+
+	// ------------------------------------------------------------------------
+	// Quantized Wide BVH Node Object
+	// Same as BVHWideNode, but child bounds are 8-bit steps of scale from the
+	// origin of the node's box. Steps are rounded outwards, so a decoded box
+	// always contains the real one. Costs a multiply-add per plane to decode.
+	// ------------------------------------------------------------------------
+	template <unsigned N>
+	struct BVHQuantizedNode
+	{
+		static const unsigned WIDTH = N;
+		static const unsigned LANES = BVHWideNode<N>::LANES;
+
+		float origin[3];
+		float scale[3];
+		uint8_t qmin[3][LANES];
+		uint8_t qmax[3][LANES];
+		uint32_t child[N];
+		uint16_t count[N];
+		uint32_t child_count;
+
+		inline void getBounds(const unsigned lane, vfloat * lo, vfloat * hi) const
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				lo[axis] = vfloat(origin[axis]) + vfloat::loadu8(&qmin[axis][lane]) * vfloat(scale[axis]);
+				hi[axis] = vfloat(origin[axis]) + vfloat::loadu8(&qmax[axis][lane]) * vfloat(scale[axis]);
+			}
+		}
+
+		AABB getChildBounds(const unsigned c) const
+		{
+			vec3 pmin, pmax;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				pmin[axis] = origin[axis] + static_cast<float>(qmin[axis][c]) * scale[axis];
+				pmax[axis] = origin[axis] + static_cast<float>(qmax[axis][c]) * scale[axis];
+			}
+			return AABB(pmin, pmax);
+		}
+	};
+
+	// ------------------------------------------------------------------------
+	// Wide BVH Accelerator Object
+	// Builds a binary BVH and collapses it so every node has up to N children,
+	// which are traversed nearest first. Packets are traced ray by ray. With
+	// BVHBuildParams::quantized the nodes are stored as BVHQuantizedNodes.
+	// ------------------------------------------------------------------------
+	template <unsigned N>
+	class WideBVHAccel : public BVHAccel
+	{
+	public:
+		WideBVHAccel(const std::vector<Shape *> shapes = std::vector<Shape *>(), const BVHBuildParams & params = BVHBuildParams());
+		~WideBVHAccel();
+
+		using BVHAccel::intersect;
+		virtual bool intersect(const Ray & ray, Hit & hit) override;
+		virtual bool intersectP(const Ray & ray) override;
+		virtual int intersect(const RayPacket & packet, Intersection * iSects) override;
+		virtual int intersectP(const RayPacket & packet) override;
+		virtual void init() override;
+		virtual float getSAHCost() const override;
+		virtual void refit() override;
+	protected:
+		uint32_t collapse(const BVHNode * node, std::vector<BVHWideNode<N>> & nodes);
+		void refitWideNode(const uint32_t index);
+
+		BVHWideNode<N> * m_wideNodes;
+		BVHQuantizedNode<N> * m_quantizedNodes;
+		uint32_t m_wideNodeCount;
+	};
+
+	typedef WideBVHAccel<4> BVH4Accel;
+	typedef WideBVHAccel<8> BVH8Accel;
+
+}
+
+#endif // WIDEBVH_H
@@ -75,11 +75,12 @@ namespace mirage
 		}
 	}
 
-	void CameraOrtho::calcCamRay(const int x, const int y, Ray & ray) const
+	void CameraOrtho::calcCamRay(const int x, const int y, Ray & ray, Sampler & sampler) const
 	{
 		// Tent filter for each ray's xy directions
-		float r1 = 2.0f * pseudorand(), dx = r1 < 1.0f ? std::sqrt(r1) - 1.0f : 1.0f - std::sqrt(2.0f - r1);
-		float r2 = 2.0f * pseudorand(), dy = r2 < 1.0f ? std::sqrt(r2) - 1.0f : 1.0f - std::sqrt(2.0f - r2);
+		vec2 u = sampler.get2D();
+		float r1 = 2.0f * u.x, dx = r1 < 1.0f ? std::sqrt(r1) - 1.0f : 1.0f - std::sqrt(2.0f - r1);
+		float r2 = 2.0f * u.y, dy = r2 < 1.0f ? std::sqrt(r2) - 1.0f : 1.0f - std::sqrt(2.0f - r2);
 
 		// Construct the ray's origin vector
 		vec3 e = m_transform.getPosition();
@@ -12,7 +12,7 @@ namespace mirage
 	public:
 		CameraOrtho(Transform transform = Transform(), Film film = Film(), float speed = 16, float sensitivity = 32, float zoom = 0.1f);
 		virtual void update(float dt) override;
-		virtual void calcCamRay(const int x, const int y, Ray & ray) const override;
+		virtual void calcCamRay(const int x, const int y, Ray & ray, Sampler & sampler) const override;
 	private:
 		float m_zoom;
 	};
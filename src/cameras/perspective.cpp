@@ -83,11 +83,12 @@ namespace mirage
 		}
 	}
 
-	void CameraPersp::calcCamRay(const int x, const int y, Ray & ray) const
+	void CameraPersp::calcCamRay(const int x, const int y, Ray & ray, Sampler & sampler) const
 	{
 		// Tent filter for each ray's xy directions
-		float r1 = 2.0f * pseudorand(), dx = r1 < 1.0f ? std::sqrt(r1) - 1.0f : 1.0f - std::sqrt(2.0f - r1);
-		float r2 = 2.0f * pseudorand(), dy = r2 < 1.0f ? std::sqrt(r2) - 1.0f : 1.0f - std::sqrt(2.0f - r2);
+		vec2 u = sampler.get2D();
+		float r1 = 2.0f * u.x, dx = r1 < 1.0f ? std::sqrt(r1) - 1.0f : 1.0f - std::sqrt(2.0f - r1);
+		float r2 = 2.0f * u.y, dy = r2 < 1.0f ? std::sqrt(r2) - 1.0f : 1.0f - std::sqrt(2.0f - r2);
 
 		// Construct the ray's direction vector and aim it towards the virtual screen's pixel
 		auto x_norm = ((m_film.getResolutionX() * 0.5f - x + dx) / m_film.getResolutionX() * m_film.getAspectRatio()) * m_fov;
@@ -12,7 +12,7 @@ namespace mirage
 	public:
 		CameraPersp(Transform transform = Transform(), Film film = Film(), float speed = 16, float sensitivity = 32, float fov = 70.0f);
 		virtual void update(float dt) override;
-		virtual void calcCamRay(const int x, const int y, Ray & ray) const override;
+		virtual void calcCamRay(const int x, const int y, Ray & ray, Sampler & sampler) const override;
 		void setFoV(float fov);
 		float getFoV() const;
 	private:
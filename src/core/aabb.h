@@ -42,6 +42,8 @@ namespace mirage
 		float getSurfaceArea() const;
 		float getVolume() const;
 		int getMaximumExtent() const;
+		const vec3 & getMin() const { return m_pmin; }
+		const vec3 & getMax() const { return m_pmax; }
 	private:
 		vec3 m_pmin;
 		vec3 m_pmax;
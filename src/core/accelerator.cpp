@@ -19,6 +19,44 @@ namespace mirage
 
 	}
 
+	bool Accelerator::intersect(const Ray & ray, Intersection & iSect)
+	{
+		Hit hit(ray.maxt);
+		if (!intersect(ray, hit))
+			return false;
+
+		getIntersection(ray, hit, iSect);
+		return true;
+	}
+
+	void Accelerator::getIntersection(const Ray & ray, const Hit & hit, Intersection & iSect) const
+	{
+		m_shapes[hit.prim]->getIntersection(ray, hit, iSect);
+	}
+
+	int Accelerator::intersect(const RayPacket & packet, Intersection * iSects)
+	{
+		// Trace the lanes one by one, accelerators with a packet traversal override this
+		int result = 0;
+		for (unsigned i = 0; i < RayPacket::WIDTH; i++)
+		{
+			if ((packet.mask & (1 << i)) && intersect(packet.rays[i], iSects[i]))
+				result |= 1 << i;
+		}
+		return result;
+	}
+
+	int Accelerator::intersectP(const RayPacket & packet)
+	{
+		int result = 0;
+		for (unsigned i = 0; i < RayPacket::WIDTH; i++)
+		{
+			if ((packet.mask & (1 << i)) && intersectP(packet.rays[i]))
+				result |= 1 << i;
+		}
+		return result;
+	}
+
 	AABB Accelerator::objectBound() const
 	{
 		AABB result = m_shapes[0]->objectBound();
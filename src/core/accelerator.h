@@ -1,22 +1,36 @@
 #ifndef ACCELERATOR_H
 #define ACCELERATOR_H
 
+// std includes
+#include <vector>
+
 // mirage includes
 #include "shape.h"
+#include "raypacket.h"
 
 namespace mirage
 {
 
+	// ------------------------------------------------------------------------
+	// Accelerator
+	// intersect() finds the closest hit in [mint, hit.t) as a slim Hit with
+	// prim indexing the accelerator's shapes. getIntersection() fills in the
+	// surface data of such a hit; intersecting into an Intersection does both.
+	// ------------------------------------------------------------------------
 	class Accelerator
 	{
 	public:
 		Accelerator(const std::vector<Shape *> shapes = std::vector<Shape *>());
 		virtual ~Accelerator();
-		virtual void update() const = 0;
+		virtual bool update() = 0;
 		virtual AABB objectBound() const;
 		virtual AABB worldBound() const;
-		virtual bool intersect(const Ray & ray, Intersection & iSect) = 0;
+		virtual bool intersect(const Ray & ray, Hit & hit) = 0;
+		bool intersect(const Ray & ray, Intersection & iSect);
+		void getIntersection(const Ray & ray, const Hit & hit, Intersection & iSect) const;
 		virtual bool intersectP(const Ray & ray) = 0;
+		virtual int intersect(const RayPacket & packet, Intersection * iSects);
+		virtual int intersectP(const RayPacket & packet);
 		virtual void init() = 0;
 	private:
 	protected:
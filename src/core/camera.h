@@ -5,6 +5,7 @@
 #include "transform.h"
 #include "film.h"
 #include "ray.h"
+#include "sampler.h"
 
 namespace mirage
 {
@@ -20,7 +21,7 @@ namespace mirage
 		);
 		virtual ~Camera();
 		virtual void update(float dt) = 0;
-		virtual void calcCamRay(const int x, const int y, Ray & ray) const = 0;
+		virtual void calcCamRay(const int x, const int y, Ray & ray, Sampler & sampler) const = 0;
 		void move(const vec3 & dir, float delta);
 		void rotate(const vec3 & axis, float delta);
 		Transform & getTransform();
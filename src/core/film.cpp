@@ -1,8 +1,10 @@
 // std includes
 #include <cassert>
+#include <fstream>
 
 // mirage includes
 #include "film.h"
+#include "../macros.h"
 
 namespace mirage
 {
@@ -41,6 +43,39 @@ namespace mirage
 		}
 	}
 
+	void Film::saveToPPM(const std::string & filePath) const
+	{
+		std::ofstream file(filePath, std::ios::binary);
+
+		if (!file.is_open())
+		{
+			MLOG_ERROR("Film: Could not open %s for writing.", filePath.c_str());
+			return;
+		}
+
+		// Binary PPM (P6) header
+		std::string header = "P6\n" + std::to_string(m_resolutionX) + " " + std::to_string(m_resolutionY) + "\n255\n";
+		file.write(header.c_str(), header.size());
+
+		// Gamma correct & quantize the averaged samples, same mapping as Display::setPixel
+		std::vector<unsigned char> data(m_samples.size() * 3);
+		for (size_t i = 0; i < m_samples.size(); i++)
+		{
+			vec3 c = (m_samples[i].getNumSamples() > 0) ? m_samples[i].getColorAveraged() : vec3();
+			c = vec3::powv(c, 1.0f * GAMMA);
+			c = vec3::clampv(c, 0.0f, 1.0f);
+
+			data[i * 3 + 0] = static_cast<unsigned char>(c.x * 255.0f);
+			data[i * 3 + 1] = static_cast<unsigned char>(c.y * 255.0f);
+			data[i * 3 + 2] = static_cast<unsigned char>(c.z * 255.0f);
+		}
+		file.write(reinterpret_cast<const char *>(data.data()), data.size());
+
+		file.close();
+
+		MLOG_INFO("Film: Saved the film to %s.", filePath.c_str());
+	}
+
 	int Film::getResolutionX() const
 	{
 		return m_resolutionX;
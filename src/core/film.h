@@ -3,6 +3,7 @@
 
 // std includes
 #include <vector>
+#include <string>
 
 // mirage includes
 #include "sample.h"
@@ -18,6 +19,7 @@ namespace mirage
 		void addSample(int x, int y, const vec3 & sample);
 		void decSample(int x, int y, const vec3 & sample);
 		void clearSamples();
+		void saveToPPM(const std::string & filePath) const;
 		int getResolutionX() const;
 		int getResolutionY() const;
 		float getAspectRatio() const;
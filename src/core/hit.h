@@ -0,0 +1,36 @@
+#ifndef HIT_H
+#define HIT_H
+
+// std includes
+#include <cstdint>
+#include <cmath>
+
+namespace mirage
+{
+
+	// ------------------------------------------------------------------------
+	// Hit
+	// All a traversal keeps of the closest hit so far: its distance, the index
+	// of the primitive in the accelerator's shapes and the surface coordinates
+	// on it, barycentrics for triangles. Through an instance innerPrim is the
+	// primitive hit inside it. Shape::getIntersection() turns the final hit
+	// into an Intersection, nothing else pays for surface data.
+	// ------------------------------------------------------------------------
+	struct Hit
+	{
+		static const uint32_t NONE = 0xFFFFFFFF;
+
+		float t;
+		float u, v;
+		uint32_t prim;
+		uint32_t innerPrim;
+
+		Hit(const float tMax = INFINITY) : t(tMax), u(0.0f), v(0.0f), prim(NONE), innerPrim(NONE)
+		{
+
+		}
+	};
+
+}
+
+#endif // HIT_H
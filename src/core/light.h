@@ -6,6 +6,7 @@
 // mirage includes
 #include "transform.h"
 #include "../math/vec3.h"
+#include "sampler.h"
 
 namespace mirage
 {
@@ -16,7 +17,7 @@ namespace mirage
 		Light(Transform l2w = Transform(), vec3 emission = vec3(1, 1, 1));
 		virtual ~Light();
 		virtual void Le(const vec3 & P, const vec3 & N, const vec3 & Wi, const vec3 & Wo, vec3 & Le) const = 0;
-		virtual void evalWe(const vec3 & P, const vec3 & N, const vec3 & Wo, vec3 & We) const = 0;
+		virtual void evalWe(const vec3 & P, const vec3 & N, const vec3 & Wo, vec3 & We, Sampler & sampler) const = 0;
 		Transform getL2W() const;
 	private:
 	protected:
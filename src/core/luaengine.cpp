@@ -10,8 +10,16 @@
 #include "../macros.h"
 #include "../shapes/mesh.h"
 #include "../shapes/sphere.h"
+#include "../shapes/instance.h"
 #include "accelerator.h"
+#include "threadpool.h"
 #include "../accelerators/bvh.h"
+#include "../accelerators/widebvh.h"
+#include "../accelerators/lazybvh.h"
+#include "../samplers/randomsampler.h"
+#include "../samplers/stratified.h"
+#include "../samplers/halton.h"
+#include "../samplers/sobol.h"
 
 namespace mirage
 {
@@ -23,6 +31,7 @@ namespace mirage
 		Scene * g_scene;
 		DisplayInitInfo g_dispInitInfo;
 		MultiThreadInitInfo g_mThreadInitInfo;
+		TileInitInfo g_tileInitInfo;
 
 		void init(Scene * scene)
 		{
@@ -33,7 +42,8 @@ namespace mirage
 				g_state = luaL_newstate();
 				g_scene = scene;
 				g_dispInitInfo = { 512, 512, 1 };
-				g_mThreadInitInfo = { static_cast<unsigned>(SDL_GetCPUCount()) };
+				g_mThreadInitInfo = { static_cast<unsigned>(SDL_GetCPUCount()), false };
+				g_tileInitInfo = { 32, "hilbert" };
 
 				luaopen_io(g_state);
 				luaopen_base(g_state);
@@ -116,6 +126,8 @@ namespace mirage
 				lua_setglobal(g_state, "NewMesh");
 				lua_pushcfunction(g_state, lua_NewSphere_func);
 				lua_setglobal(g_state, "NewSphere");
+				lua_pushcfunction(g_state, lua_NewInstance_func);
+				lua_setglobal(g_state, "NewInstance");
 				lua_pushcfunction(g_state, lua_NewDiffMaterial_func);
 				lua_setglobal(g_state, "NewDiffMaterial");
 				lua_pushcfunction(g_state, lua_NewEmisMaterial_func);
@@ -144,12 +156,24 @@ namespace mirage
 				lua_setglobal(g_state, "SetDisplayInitInfo");
 				lua_pushcfunction(g_state, lua_SetMThreadInitInfo_func);
 				lua_setglobal(g_state, "SetMThreadInitInfo");
+				lua_pushcfunction(g_state, lua_SetTileInitInfo_func);
+				lua_setglobal(g_state, "SetTileInitInfo");
 				lua_pushcfunction(g_state, lua_SetRadianceClamping_func);
 				lua_setglobal(g_state, "SetRadianceClamping");
 				lua_pushcfunction(g_state, lua_SetMaxRecursion_func);
 				lua_setglobal(g_state, "SetMaxRecursion");
 				lua_pushcfunction(g_state, lua_SetSceneSkyColor_func);
 				lua_setglobal(g_state, "SetSceneSkyColor");
+				lua_pushcfunction(g_state, lua_SetRandomSeed_func);
+				lua_setglobal(g_state, "SetRandomSeed");
+				lua_pushcfunction(g_state, lua_SetSampler_func);
+				lua_setglobal(g_state, "SetSampler");
+				lua_pushcfunction(g_state, lua_SetRenderer_func);
+				lua_setglobal(g_state, "SetRenderer");
+				lua_pushcfunction(g_state, lua_SetAcceleratorCache_func);
+				lua_setglobal(g_state, "SetAcceleratorCache");
+				lua_pushcfunction(g_state, lua_SetAcceleratorOptimization_func);
+				lua_setglobal(g_state, "SetAcceleratorOptimization");
 
 				// Execute the program if no errors found
 				if (status == 0)
@@ -404,6 +428,23 @@ namespace mirage
 			return 1;
 		}
 
+		int lua_NewInstance_func(lua_State * L)
+		{
+			// Get the function arguments 
+			std::size_t address_transform = static_cast<std::size_t>(luaL_checkinteger(L, 1));
+			std::size_t address_mesh = static_cast<std::size_t>(luaL_checkinteger(L, 2));
+
+			// Get the objects from address 
+			Transform *t = reinterpret_cast<Transform *>(address_transform);
+			Mesh *mesh = reinterpret_cast<Mesh *>(address_mesh);
+
+			// Create the object and return the address, the first instance of a mesh builds its hierarchy
+			std::size_t address = reinterpret_cast<std::size_t>(g_scene->getObjFactory()->initShape(new Instance(*t, mesh)));
+			lua_pushinteger(L, address);
+
+			return 1;
+		}
+
 		int lua_NewDiffMaterial_func(lua_State * L)
 		{
 			// Get the function arguments 
@@ -562,13 +603,105 @@ namespace mirage
 			}
 
 			// Create the object and add it to the scene 
-			if (type == "bvh")
+			if (type == "bvh" || type == "bvh_sah")
 			{
-				Accelerator *accel = new BVHAccel(g_scene->getShapes(), param1);
+				// Optional SAH settings: bin count, traversal cost & intersection cost
+				BVHBuildParams params(type == "bvh_sah" ? BVH_SPLIT_SAH : BVH_SPLIT_MEDIAN, param1);
+				params.sahBins = static_cast<unsigned>(luaL_optinteger(L, 3, params.sahBins));
+				params.traversalCost = static_cast<float>(luaL_optnumber(L, 4, params.traversalCost));
+				params.intersectionCost = static_cast<float>(luaL_optnumber(L, 5, params.intersectionCost));
+				params.cacheDirectory = g_scene->getAcceleratorCache();
+				params.optimizeSeconds = g_scene->getAcceleratorOptimization();
+				params.treeletLeaves = g_scene->getAcceleratorTreeletLeaves();
+
+				Accelerator *accel = new BVHAccel(g_scene->getShapes(), params);
 				accel->init();
 				g_scene->setAccelerator(accel);
 
-				MLOG_INFO("Lua: a BVHAccel was added to the current scene. Leaf threshold: %d.", param1);
+				if (params.splitMethod == BVH_SPLIT_SAH)
+					MLOG_INFO("Lua: a BVHAccel (SAH) was added to the current scene. Max leaf size: %d, bins: %u, costs: [%.2f, %.2f].", param1, params.sahBins, params.traversalCost, params.intersectionCost);
+				else
+					MLOG_INFO("Lua: a BVHAccel was added to the current scene. Leaf threshold: %d.", param1);
+			}
+			else if (type == "lbvh")
+			{
+				// Optional LBVH settings: Morton code bits (30 or 63) & whether to join the treelets with the SAH
+				BVHBuildParams params(BVH_SPLIT_LBVH, param1);
+				params.mortonBits = static_cast<unsigned>(luaL_optinteger(L, 3, params.mortonBits));
+				params.lbvhSAHTop = lua_toboolean(L, 4) != 0;
+				params.cacheDirectory = g_scene->getAcceleratorCache();
+				params.optimizeSeconds = g_scene->getAcceleratorOptimization();
+				params.treeletLeaves = g_scene->getAcceleratorTreeletLeaves();
+
+				if (params.mortonBits != 30 && params.mortonBits != 63)
+				{
+					MLOG_WARNING("Lua: LBVH Morton codes are 30 or 63 bits long, got %u. Using 30.", params.mortonBits);
+					params.mortonBits = 30;
+				}
+
+				Accelerator *accel = new BVHAccel(g_scene->getShapes(), params);
+				accel->init();
+				g_scene->setAccelerator(accel);
+
+				MLOG_INFO("Lua: a BVHAccel (LBVH) was added to the current scene. Leaf threshold: %d, Morton bits: %u, SAH top: %s.", param1, params.mortonBits, params.lbvhSAHTop ? "on" : "off");
+			}
+			else if (type == "sbvh")
+			{
+				// Optional SBVH settings: duplication budget, then the same SAH settings as "bvh_sah"
+				BVHBuildParams params(BVH_SPLIT_SBVH, param1);
+				params.duplicationBudget = static_cast<float>(luaL_optnumber(L, 3, params.duplicationBudget));
+				params.sahBins = static_cast<unsigned>(luaL_optinteger(L, 4, params.sahBins));
+				params.traversalCost = static_cast<float>(luaL_optnumber(L, 5, params.traversalCost));
+				params.intersectionCost = static_cast<float>(luaL_optnumber(L, 6, params.intersectionCost));
+				params.cacheDirectory = g_scene->getAcceleratorCache();
+				params.optimizeSeconds = g_scene->getAcceleratorOptimization();
+				params.treeletLeaves = g_scene->getAcceleratorTreeletLeaves();
+
+				Accelerator *accel = new BVHAccel(g_scene->getShapes(), params);
+				accel->init();
+				g_scene->setAccelerator(accel);
+
+				MLOG_INFO("Lua: a BVHAccel (SBVH) was added to the current scene. Max leaf size: %d, duplication budget: %.2f, bins: %u, costs: [%.2f, %.2f].", param1, params.duplicationBudget, params.sahBins, params.traversalCost, params.intersectionCost);
+			}
+			else if (type == "lazybvh")
+			{
+				// Same optional settings as "bvh_sah", only the top levels are built here & the rest while rendering
+				BVHBuildParams params(BVH_SPLIT_SAH, param1);
+				params.sahBins = static_cast<unsigned>(luaL_optinteger(L, 3, params.sahBins));
+				params.traversalCost = static_cast<float>(luaL_optnumber(L, 4, params.traversalCost));
+				params.intersectionCost = static_cast<float>(luaL_optnumber(L, 5, params.intersectionCost));
+
+				Accelerator *accel = new LazyBVHAccel(g_scene->getShapes(), params);
+				accel->init();
+				g_scene->setAccelerator(accel);
+
+				MLOG_INFO("Lua: a LazyBVHAccel was added to the current scene. Max leaf size: %d, bins: %u, costs: [%.2f, %.2f].", param1, params.sahBins, params.traversalCost, params.intersectionCost);
+			}
+			else if (type == "bvh4" || type == "bvh8")
+			{
+				// Built with the SAH & collapsed, takes the same optional settings as "bvh_sah", whether to quantize the nodes
+				// & a duplication budget, which builds with spatial splits when above zero
+				BVHBuildParams params(BVH_SPLIT_SAH, param1);
+				params.sahBins = static_cast<unsigned>(luaL_optinteger(L, 3, params.sahBins));
+				params.traversalCost = static_cast<float>(luaL_optnumber(L, 4, params.traversalCost));
+				params.intersectionCost = static_cast<float>(luaL_optnumber(L, 5, params.intersectionCost));
+				params.cacheDirectory = g_scene->getAcceleratorCache();
+				params.optimizeSeconds = g_scene->getAcceleratorOptimization();
+				params.treeletLeaves = g_scene->getAcceleratorTreeletLeaves();
+				params.quantized = lua_toboolean(L, 6) != 0;
+				params.duplicationBudget = static_cast<float>(luaL_optnumber(L, 7, 0.0));
+				if (params.duplicationBudget > 0.0f)
+					params.splitMethod = BVH_SPLIT_SBVH;
+
+				Accelerator *accel = nullptr;
+				if (type == "bvh4")
+					accel = new BVH4Accel(g_scene->getShapes(), params);
+				else
+					accel = new BVH8Accel(g_scene->getShapes(), params);
+				accel->init();
+				g_scene->setAccelerator(accel);
+
+				MLOG_INFO("Lua: a WideBVHAccel (%s) was added to the current scene. Max leaf size: %d, bins: %u, costs: [%.2f, %.2f], quantized: %s, duplication budget: %.2f.", type.c_str(), param1, params.sahBins, params.traversalCost, params.intersectionCost, params.quantized ? "on" : "off", params.duplicationBudget);
 			}
 			else
 			{
@@ -598,8 +731,26 @@ namespace mirage
 		{
 			// Get the function argument(s) 
 			g_mThreadInitInfo.rThreadCount = luaL_checknumber(L, 1);
+			g_mThreadInitInfo.rThreadAffinity = lua_toboolean(L, 2) != 0;
+
+			// (Re)start the worker pool right away so loading & accelerator builds can use it
+			ThreadPool::init(
+				g_mThreadInitInfo.rThreadCount != 0 ? g_mThreadInitInfo.rThreadCount : static_cast<unsigned>(SDL_GetCPUCount()),
+				g_mThreadInitInfo.rThreadAffinity
+			);
+
+			MLOG_INFO("Lua: Set multithreading init info to [%d, %s].", g_mThreadInitInfo.rThreadCount, g_mThreadInitInfo.rThreadAffinity ? "pinned" : "unpinned");
 
-			MLOG_INFO("Lua: Set multithreading init info to %d.", g_mThreadInitInfo.rThreadCount);
+			return 0;
+		}
+
+		extern int lua_SetTileInitInfo_func(lua_State * L)
+		{
+			// Get the function argument(s)
+			g_tileInitInfo.size = luaL_checknumber(L, 1);
+			g_tileInitInfo.order = luaL_optstring(L, 2, "hilbert");
+
+			MLOG_INFO("Lua: Set tile init info to [%d, %s].", g_tileInitInfo.size, g_tileInitInfo.order.c_str());
 
 			return 0;
 		}
@@ -646,6 +797,114 @@ namespace mirage
 			return 0;
 		}
 
+		extern int lua_SetRandomSeed_func(lua_State * L)
+		{
+			// Get the function argument
+			lua_Integer seed = luaL_checkinteger(L, 1);
+
+			// Set the variable
+			randomseed(static_cast<uint64_t>(seed));
+
+			MLOG_INFO("Lua: Set random seed to %lld.", static_cast<long long>(seed));
+
+			return 0;
+		}
+
+		extern int lua_SetSampler_func(lua_State * L)
+		{
+			// Get the function arguments
+			std::string type(luaL_checkstring(L, 1));
+			uint32_t spp = static_cast<uint32_t>(luaL_optinteger(L, 2, 16));
+
+			// Create the sampler, the scene takes ownership of it
+			Sampler * sampler = nullptr;
+			if (type == "random")
+				sampler = new RandomSampler(spp);
+			else if (type == "stratified")
+				sampler = new StratifiedSampler(spp);
+			else if (type == "halton")
+				sampler = new HaltonSampler(spp);
+			else if (type == "sobol")
+				sampler = new SobolSampler(spp);
+
+			if (!sampler)
+			{
+				MLOG_ERROR("Lua: Invalid sampler type %s. Sampler was not changed.", type.c_str());
+				return 0;
+			}
+
+			g_scene->setSampler(sampler);
+
+			MLOG_INFO("Lua: Set scene sampler to %s, samples per pixel: %u.", type.c_str(), spp);
+
+			return 0;
+		}
+
+		extern int lua_SetRenderer_func(lua_State * L)
+		{
+			// Get the function argument
+			std::string type(luaL_checkstring(L, 1));
+
+			if (type != "pathtracer" && type != "wavefront")
+			{
+				MLOG_ERROR("Lua: Invalid renderer type %s. Renderer was not changed.", type.c_str());
+				return 0;
+			}
+
+			// Set the variable
+			g_scene->setRenderer(type);
+
+			MLOG_INFO("Lua: Set scene renderer to %s.", type.c_str());
+
+			return 0;
+		}
+
+		extern int lua_SetAcceleratorCache_func(lua_State * L)
+		{
+			// Get the function argument, an empty string turns the cache off
+			std::string directory(luaL_checkstring(L, 1));
+
+			// Only accelerators added after this read it
+			if (g_scene->getAccelerator())
+				MLOG_WARNING("Lua: SetAcceleratorCache was called after AddRayAccelerator, the current accelerator won't be cached.");
+
+			// Set the variable
+			g_scene->setAcceleratorCache(directory);
+
+			MLOG_INFO("Lua: Set ray accelerator cache directory to \"%s\".", directory.c_str());
+
+			return 0;
+		}
+
+		extern int lua_SetAcceleratorOptimization_func(lua_State * L)
+		{
+			// Get the function arguments, zero seconds turns the optimization off
+			float seconds = static_cast<float>(luaL_checknumber(L, 1));
+			int treeletLeaves = static_cast<int>(luaL_optinteger(L, 2, 7));
+
+			if (seconds < 0.0f)
+			{
+				MLOG_ERROR("Lua: Invalid accelerator optimization time %.2f. Optimization was not changed.", seconds);
+				return 0;
+			}
+			if (treeletLeaves < 3 || treeletLeaves > 8)
+			{
+				MLOG_WARNING("Lua: Treelets have 3 to 8 leaves, got %d. Using 7.", treeletLeaves);
+				treeletLeaves = 7;
+			}
+
+			// Only accelerators added after this read it
+			if (g_scene->getAccelerator())
+				MLOG_WARNING("Lua: SetAcceleratorOptimization was called after AddRayAccelerator, the current accelerator won't be optimized.");
+
+			// Set the variables
+			g_scene->setAcceleratorOptimization(seconds, static_cast<unsigned>(treeletLeaves));
+
+			MLOG_INFO("Lua: Set ray accelerator optimization to %.2f seconds, treelets of %d leaves.", seconds, treeletLeaves);
+
+			return 0;
+		}
+
 	}
 
 }
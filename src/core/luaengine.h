@@ -27,6 +27,13 @@ struct DisplayInitInfo
 struct MultiThreadInitInfo
 {
 	unsigned rThreadCount;
+	bool rThreadAffinity;
+};
+
+struct TileInitInfo
+{
+	unsigned size;
+	std::string order;
 };
 
 namespace mirage
@@ -39,6 +46,7 @@ namespace mirage
 		extern Scene * g_scene;
 		extern DisplayInitInfo g_dispInitInfo;
 		extern MultiThreadInitInfo g_mThreadInitInfo;
+		extern TileInitInfo g_tileInitInfo;
 
 		extern void init(Scene * scene);
 		extern void kill();
@@ -62,6 +70,7 @@ namespace mirage
 		extern int lua_NewLightSpot_func(lua_State * L);
 		extern int lua_NewMesh_func(lua_State * L);
 		extern int lua_NewSphere_func(lua_State * L);
+		extern int lua_NewInstance_func(lua_State * L);
 		extern int lua_NewDiffMaterial_func(lua_State * L);
 		extern int lua_NewEmisMaterial_func(lua_State * L);
 		extern int lua_NewDielectricMaterial_func(lua_State  *L);
@@ -78,9 +87,15 @@ namespace mirage
 		// C++ Scene setting setters
 		extern int lua_SetDisplayInitInfo_func(lua_State * L);
 		extern int lua_SetMThreadInitInfo_func(lua_State * L);
+		extern int lua_SetTileInitInfo_func(lua_State * L);
 		extern int lua_SetRadianceClamping_func(lua_State * L);
 		extern int lua_SetMaxRecursion_func(lua_State * L);
 		extern int lua_SetSceneSkyColor_func(lua_State * L);
+		extern int lua_SetRandomSeed_func(lua_State * L);
+		extern int lua_SetSampler_func(lua_State * L);
+		extern int lua_SetRenderer_func(lua_State * L);
+		extern int lua_SetAcceleratorCache_func(lua_State * L);
+		extern int lua_SetAcceleratorOptimization_func(lua_State * L);
 
 	}
 
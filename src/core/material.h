@@ -7,6 +7,7 @@
 // mirage includes
 #include "../math/vec3.h"
 #include "ray.h"
+#include "sampler.h"
 
 namespace mirage
 {
@@ -22,10 +23,10 @@ namespace mirage
 		Material(const std::string & kdText = "", const std::string & ksText = "", const std::string & keText = "",
 			vec3 kd = vec3(), vec3 ks = vec3(), vec3 ke = vec3(), bool refr = false);
 		virtual ~Material();
-		virtual void evalBSDF(const vec3 &P, const vec3 &N, const vec3 &Wr, const vec3 &Wt, const vec3 &Wo, float &brdf, float &btdf) const = 0;
+		virtual void evalBSDF(const vec3 &P, const vec3 &N, const vec3 &Wr, const vec3 &Wt, const vec3 &Wo, float &brdf, float &btdf, Sampler &sampler) const = 0;
 		virtual void evalBSDF_direct(const vec3 &P, const vec3 &N, const vec3 &We, const vec3 &Wr, const vec3 &Wt, const vec3 &Wo, float &brdf, float &btdf) const = 0;
-		virtual void evalPDF(float &pdf) const = 0;
-		virtual void evalWi(const vec3 &Wo, const vec3 &N, vec3 &Wr, vec3 &Wt) = 0;
+		virtual void evalPDF(const vec3 &N, const vec3 &Wi, float &pdf) const = 0;
+		virtual void evalWi(const vec3 &Wo, const vec3 &N, vec3 &Wr, vec3 &Wt, Sampler &sampler) = 0;
 		void setKdText(Texture * const kdText);
 		void setKsText(Texture * const ksText);
 		void setKeText(Texture * const keText);
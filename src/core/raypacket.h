@@ -0,0 +1,59 @@
+#ifndef RAYPACKET_H
+#define RAYPACKET_H
+
+// mirage includes
+#include "ray.h"
+#include "../math/simd.h"
+
+namespace mirage
+{
+
+	// ------------------------------------------------------------------------
+	// Ray Packet Object
+	// Up to WIDTH coherent rays traced together, the ray data is kept both as
+	// regular Ray objects (for scalar fallbacks) and in SoA arrays that load
+	// straight into SIMD registers. Bit i of mask marks lane i as in use.
+	// ------------------------------------------------------------------------
+	struct RayPacket
+	{
+		static const unsigned WIDTH = MIRAGE_SIMD_WIDTH;
+
+		Ray rays[WIDTH];
+		float ox[WIDTH], oy[WIDTH], oz[WIDTH];
+		float dx[WIDTH], dy[WIDTH], dz[WIDTH];
+		float idx[WIDTH], idy[WIDTH], idz[WIDTH];
+		float mint[WIDTH], maxt[WIDTH];
+		int mask;
+
+		RayPacket() : mask(0)
+		{
+			// Unused lanes still get loaded, keep them finite & harmless
+			for (unsigned i = 0; i < WIDTH; i++)
+			{
+				ox[i] = oy[i] = oz[i] = 0.0f;
+				dx[i] = dy[i] = dz[i] = 0.0f;
+				idx[i] = idy[i] = idz[i] = INFINITY;
+				mint[i] = 0.0f;
+				maxt[i] = -INFINITY;
+			}
+		}
+
+		inline void set(const unsigned lane, const Ray & ray)
+		{
+			const vec3 o = ray.getOrigin();
+			const vec3 d = ray.getDirection();
+			const vec3 id = ray.getDirectionInv();
+
+			rays[lane] = ray;
+			ox[lane] = o.x; oy[lane] = o.y; oz[lane] = o.z;
+			dx[lane] = d.x; dy[lane] = d.y; dz[lane] = d.z;
+			idx[lane] = id.x; idy[lane] = id.y; idz[lane] = id.z;
+			mint[lane] = ray.mint;
+			maxt[lane] = ray.maxt;
+			mask |= 1 << lane;
+		}
+	};
+
+}
+
+#endif // RAYPACKET_H
@@ -14,6 +14,7 @@ namespace mirage
 	class Renderer
 	{
 	public:
+		virtual ~Renderer() {}
 		virtual void render(const Scene * const scene, Display * const display, const unsigned w, const unsigned h, const unsigned xa, const unsigned ya) = 0;
 	private:
 	protected:
@@ -0,0 +1,64 @@
+// mirage includes
+#include "sampler.h"
+#include "../macros.h"
+
+namespace mirage
+{
+
+	Sampler::Sampler(const uint32_t samplesPerPixel) :
+		m_samplesPerPixel(samplesPerPixel > 0 ? samplesPerPixel : 1),
+		m_x(0),
+		m_y(0),
+		m_sampleIndex(0),
+		m_dimension(0)
+	{
+
+	}
+
+	Sampler::~Sampler()
+	{
+
+	}
+
+	void Sampler::startPixel(const uint32_t x, const uint32_t y, const uint32_t sampleIndex)
+	{
+		m_x = x;
+		m_y = y;
+		m_sampleIndex = sampleIndex;
+		m_dimension = 0;
+
+		// Keep the counter based generator in sync for anything still calling pseudorand()
+		randomstart(x, y, sampleIndex);
+	}
+
+	void Sampler::saveState(SamplerState & state) const
+	{
+		state.x = m_x;
+		state.y = m_y;
+		state.sampleIndex = m_sampleIndex;
+		state.dimension = m_dimension;
+		state.random = g_randomState;
+	}
+
+	void Sampler::restoreState(const SamplerState & state)
+	{
+		m_x = state.x;
+		m_y = state.y;
+		m_sampleIndex = state.sampleIndex;
+		m_dimension = state.dimension;
+		g_randomState = state.random;
+	}
+
+	uint32_t Sampler::getSamplesPerPixel() const
+	{
+		return m_samplesPerPixel;
+	}
+
+	uint32_t Sampler::pixelSeed(const uint32_t dimension) const
+	{
+		// Same for every sample of the pixel, differs per pixel & dimension
+		const uint64_t pixel = (static_cast<uint64_t>(m_y) << 32) | m_x;
+		return static_cast<uint32_t>(randomhash(randomhash(g_randomSeed ^ randomhash(pixel)) ^ (0xA0761D6478BD642Full * (dimension + 1))) >> 32);
+	}
+
+}
@@ -0,0 +1,54 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+// std includes
+#include <cstdint>
+
+// mirage includes
+#include "../math/vec2.h"
+#include "../math/rng.h"
+
+namespace mirage
+{
+
+	// Where a pixel sample is in its sequence, lets one sampler interleave
+	// many in-flight paths
+	struct SamplerState
+	{
+		uint32_t x;
+		uint32_t y;
+		uint32_t sampleIndex;
+		uint32_t dimension;
+		RandomState random;
+	};
+
+	// ------------------------------------------------------------------------
+	// Sampler Object
+	// Produces the random numbers of one pixel sample, dimension by dimension.
+	// startPixel() must be called before each pixel sample, every get1D() /
+	// get2D() call after it consumes the next dimension of the sequence.
+	// ------------------------------------------------------------------------
+	class Sampler
+	{
+	public:
+		Sampler(const uint32_t samplesPerPixel = 1);
+		virtual ~Sampler();
+		virtual void startPixel(const uint32_t x, const uint32_t y, const uint32_t sampleIndex);
+		virtual float get1D() = 0;
+		virtual vec2 get2D() = 0;
+		virtual Sampler * clone() const = 0;
+		void saveState(SamplerState & state) const;
+		void restoreState(const SamplerState & state);
+		uint32_t getSamplesPerPixel() const;
+	protected:
+		uint32_t pixelSeed(const uint32_t dimension) const;
+		uint32_t m_samplesPerPixel;
+		uint32_t m_x;
+		uint32_t m_y;
+		uint32_t m_sampleIndex;
+		uint32_t m_dimension;
+	};
+
+}
+
+#endif // SAMPLER_H
@@ -14,16 +14,21 @@
 #include "../cameras/perspective.h"
 #include "light.h"
 #include "../lights/pointlight.h"
+#include "../samplers/randomsampler.h"
 
 namespace mirage
 {
 
 	Scene::Scene() :
 		m_accelerator(nullptr),
+		m_sampler(new RandomSampler()),
 		m_objFactory(new ObjFactory()),
 		m_radianceClamping(100.0f),
 		m_maxRecursion(5),
-		m_skyColor(vec3(0.0f, 0.0f, 0.0f))
+		m_skyColor(vec3(0.0f, 0.0f, 0.0f)),
+		m_renderer("pathtracer"),
+		m_acceleratorOptimization(0.0f),
+		m_acceleratorTreeletLeaves(7)
 	{
 		LOG("Scene: a New Scene object was created.");
 	}
@@ -32,6 +37,7 @@ namespace mirage
 	{
 		/* Destroy heap objects in order */
 		DELETE(m_accelerator);
+		DELETE(m_sampler);
 		DELETE(m_objFactory);
 	}
 
@@ -45,11 +51,27 @@ namespace mirage
 		return m_accelerator->intersectP(ray);
 	}
 
+	int Scene::intersect(const RayPacket &packet, Intersection *iSects) const
+	{
+		return m_accelerator->intersect(packet, iSects);
+	}
+
+	int Scene::intersectP(const RayPacket &packet) const
+	{
+		return m_accelerator->intersectP(packet);
+	}
+
 	void Scene::setAccelerator(Accelerator *accel)
 	{
 		m_accelerator = accel;
 	}
 
+	void Scene::setSampler(Sampler *sampler)
+	{
+		DELETE(m_sampler);
+		m_sampler = sampler;
+	}
+
 	void Scene::setObjFactory(ObjFactory *objfac)
 	{
 		m_objFactory = objfac;
@@ -90,11 +112,32 @@ namespace mirage
 		m_skyColor = c;
 	}
 
+	void Scene::setRenderer(const std::string & type)
+	{
+		m_renderer = type;
+	}
+
+	void Scene::setAcceleratorCache(const std::string & directory)
+	{
+		m_acceleratorCache = directory;
+	}
+
+	void Scene::setAcceleratorOptimization(float seconds, unsigned treeletLeaves)
+	{
+		m_acceleratorOptimization = seconds;
+		m_acceleratorTreeletLeaves = treeletLeaves;
+	}
+
 	Accelerator *Scene::getAccelerator() const
 	{
 		return m_accelerator;
 	}
 
+	Sampler *Scene::getSampler() const
+	{
+		return m_sampler;
+	}
+
 	ObjFactory *Scene::getObjFactory() const
 	{
 		return m_objFactory;
@@ -158,4 +201,24 @@ namespace mirage
 		return m_skyColor;
 	}
 
+	std::string Scene::getRenderer() const
+	{
+		return m_renderer;
+	}
+
+	std::string Scene::getAcceleratorCache() const
+	{
+		return m_acceleratorCache;
+	}
+
+	float Scene::getAcceleratorOptimization() const
+	{
+		return m_acceleratorOptimization;
+	}
+
+	unsigned Scene::getAcceleratorTreeletLeaves() const
+	{
+		return m_acceleratorTreeletLeaves;
+	}
+
 }
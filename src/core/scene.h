@@ -12,6 +12,7 @@
 #include "ray.h"
 #include "intersection.h"
 #include "light.h"
+#include "sampler.h"
 #include "../shapes/mesh.h"
 
 namespace mirage
@@ -26,7 +27,10 @@ namespace mirage
 		~Scene();
 		bool intersect(const Ray &ray, Intersection &iSect) const;
 		bool intersectP(const Ray &ray) const;
+		int intersect(const RayPacket &packet, Intersection *iSects) const;
+		int intersectP(const RayPacket &packet) const;
 		void setAccelerator(Accelerator *accel);
+		void setSampler(Sampler *sampler);
 		void setObjFactory(ObjFactory *objfac);
 		void addCamera(Camera *c);
 		void addLight(Light *l);
@@ -35,7 +39,11 @@ namespace mirage
 		void setRadianceClamping(float f);
 		void setMaxRecursion(int n);
 		void setSkyColor(const vec3 & c);
+		void setRenderer(const std::string & type);
+		void setAcceleratorCache(const std::string & directory);
+		void setAcceleratorOptimization(float seconds, unsigned treeletLeaves);
 		Accelerator *getAccelerator() const;
+		Sampler *getSampler() const;
 		ObjFactory *getObjFactory() const;
 		Camera *getCamera() const;
 		std::vector<Light *> getLights() const;
@@ -44,8 +52,13 @@ namespace mirage
 		float getRadianceClamping() const;
 		int getMaxRecursion() const;
 		vec3 getSkyColor() const;
+		std::string getRenderer() const;
+		std::string getAcceleratorCache() const;
+		float getAcceleratorOptimization() const;
+		unsigned getAcceleratorTreeletLeaves() const;
 	private:
 		Accelerator *m_accelerator;
+		Sampler *m_sampler;
 		ObjFactory *m_objFactory;
 		std::vector<Camera *> m_cameras;
 		std::vector<Light *> m_lights;
@@ -54,6 +67,10 @@ namespace mirage
 		float m_radianceClamping;
 		int m_maxRecursion;
 		vec3 m_skyColor;
+		std::string m_renderer;
+		std::string m_acceleratorCache;
+		float m_acceleratorOptimization;
+		unsigned m_acceleratorTreeletLeaves;
 	};
 
 }
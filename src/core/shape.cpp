@@ -1,5 +1,6 @@
 // std includes
 #include <iostream>
+#include <algorithm>
 
 // mirage includes
 #include "shape.h"
@@ -9,7 +10,7 @@
 namespace mirage
 {
 
-	Shape::Shape(const Transform o2w, Material *m) : m_objToWorld(o2w), m_worldToObj(o2w.inverse()), m_material(m)
+	Shape::Shape(const Transform o2w, Material *m) : m_objToWorld(o2w), m_material(m)
 	{
 
 	}
@@ -19,11 +20,81 @@ namespace mirage
 
 	}
 
+	void Shape::setTransform(const Transform &o2w)
+	{
+		// Picked up by update(), which the accelerator calls for every shape that moved
+		m_objToWorld = o2w;
+		m_objToWorld.setState(true);
+	}
+
+	const Transform &Shape::getTransform() const
+	{
+		return m_objToWorld;
+	}
+
 	AABB Shape::worldBound() const
 	{
 		return objectBound() * m_objToWorld.getMatrix();
 	}
 
+	bool Shape::clipBound(const int axis, const float min, const float max, AABB &bounds) const
+	{
+		// Bounds of the part of the shape between min & max along axis, false if there is none.
+		// Shapes that can't be clipped exactly just cut their world bounds down to the slab
+		const AABB world = worldBound();
+		if (world.getMax()[axis] < min || world.getMin()[axis] > max)
+		{
+			return false;
+		}
+
+		vec3 pmin = world.getMin();
+		vec3 pmax = world.getMax();
+		pmin[axis] = std::max(pmin[axis], min);
+		pmax[axis] = std::min(pmax[axis], max);
+		bounds = AABB(pmin, pmax);
+
+		return true;
+	}
+
+	bool Shape::intersect(const Ray &ray, Intersection &iSect) const
+	{
+		Hit hit(ray.maxt);
+		if (!intersect(ray, hit))
+			return false;
+
+		getIntersection(ray, hit, iSect);
+		return true;
+	}
+
+	int Shape::intersect(const RayPacket &packet, const int mask, Hit *hits) const
+	{
+		// Lane by lane fallback, returns the lanes whose closest hit moved onto this shape
+		int result = 0;
+		for (unsigned i = 0; i < RayPacket::WIDTH; i++)
+		{
+			if ((mask & (1 << i)) && intersect(packet.rays[i], hits[i]))
+				result |= 1 << i;
+		}
+		return result;
+	}
+
+	int Shape::intersectP(const RayPacket &packet, const int mask) const
+	{
+		// Lane by lane fallback, returns the lanes blocked within [mint, maxt]
+		int result = 0;
+		for (unsigned i = 0; i < RayPacket::WIDTH; i++)
+		{
+			if ((mask & (1 << i)) && intersectP(packet.rays[i]))
+				result |= 1 << i;
+		}
+		return result;
+	}
+
+	ShapeType Shape::getType() const
+	{
+		return SHAPE_GENERIC;
+	}
+
 	void Shape::setMaterial(Material &m)
 	{
 		m_material = &m;
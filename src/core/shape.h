@@ -7,10 +7,32 @@
 #include "aabb.h"
 #include "ray.h"
 #include "intersection.h"
+#include "raypacket.h"
+#include "hit.h"
 
 namespace mirage
 {
 
+	// ------------------------------------------------------------------------
+	// Shape Type
+	// Lets accelerators sort shapes into arrays of one concrete type each and
+	// test those without virtual calls. Shapes they have no such array for
+	// report SHAPE_GENERIC and are tested through the Shape interface.
+	// ------------------------------------------------------------------------
+	enum ShapeType
+	{
+		SHAPE_GENERIC,
+		SHAPE_TRIANGLE,
+		SHAPE_SPHERE
+	};
+
+	// ------------------------------------------------------------------------
+	// Shape
+	// intersect() stores a hit closer than hit.t, and not closer than the
+	// ray's mint, in hit; prim is left to the accelerator. The packet test
+	// does the same for every lane in mask, with hits[lane] as its hit.
+	// getIntersection() fills in the surface data of a hit stored that way.
+	// ------------------------------------------------------------------------
 	class Shape
 	{
 	public:
@@ -19,14 +41,21 @@ namespace mirage
 		virtual void update() = 0;
 		virtual AABB objectBound() const = 0;
 		virtual AABB worldBound() const = 0;
-		virtual bool intersect(const Ray &ray, Intersection &iSect) const = 0;
+		virtual bool clipBound(const int axis, const float min, const float max, AABB &bounds) const;
+		virtual bool intersect(const Ray &ray, Hit &hit) const = 0;
+		virtual void getIntersection(const Ray &ray, const Hit &hit, Intersection &iSect) const = 0;
+		bool intersect(const Ray &ray, Intersection &iSect) const;
 		virtual bool intersectP(const Ray &ray) const = 0;
+		virtual int intersect(const RayPacket &packet, const int mask, Hit *hits) const;
+		virtual int intersectP(const RayPacket &packet, const int mask) const;
 		virtual float getSurfaceArea() const = 0;
+		virtual ShapeType getType() const;
 		virtual void setMaterial(Material &m);
 		virtual Material *getMaterial() const;
+		virtual void setTransform(const Transform &o2w);
+		const Transform &getTransform() const;
 	protected:
-		const Transform m_objToWorld;
-		const Transform m_worldToObj;
+		Transform m_objToWorld;
 		Material *m_material;
 	private:
 	};
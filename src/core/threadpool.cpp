@@ -0,0 +1,238 @@
+#include "threadpool.h"
+
+// std includes
+#include <algorithm>
+#include <memory>
+
+// mirage includes
+#include "../macros.h"
+
+#if defined(OS_WINDOWS)
+#define NOMINMAX
+#include <windows.h>
+#elif defined(OS_LINUX)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace mirage
+{
+
+	// Process-wide pool shared by the renderer, accelerator builds, etc..
+	static std::unique_ptr<ThreadPool> g_threadPool;
+	static std::mutex g_threadPoolMutex;
+
+	// Set for the lifetime of each worker, nested calls are executed inline
+	static thread_local bool g_isWorkerThread = false;
+
+	ThreadPool::ThreadPool(const unsigned threadCount, const bool pinThreads) :
+		m_task(nullptr),
+		m_epoch(0),
+		m_pending(0),
+		m_pinThreads(pinThreads),
+		m_quit(false)
+	{
+		const unsigned tcount = std::max(1u, threadCount);
+
+		m_threads.reserve(tcount);
+		for (unsigned i = 0; i < tcount; i++)
+		{
+			m_threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+		}
+
+		MLOG_INFO("ThreadPool: Started %u worker threads, pinned to cores: %s.", tcount, m_pinThreads ? "yes" : "no");
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_quit = true;
+		}
+		m_cvStart.notify_all();
+
+		for (auto & t : m_threads)
+		{
+			t.join();
+		}
+	}
+
+	void ThreadPool::run(const std::function<void(unsigned)> & task)
+	{
+		// Called from inside a worker, there is nobody left to hand the work to
+		if (g_isWorkerThread)
+		{
+			for (unsigned i = 0; i < getThreadCount(); i++)
+			{
+				task(i);
+			}
+			return;
+		}
+
+		// Only one epoch can be in flight at a time
+		std::lock_guard<std::mutex> runLock(m_runMutex);
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_task = &task;
+		m_pending = getThreadCount();
+		m_epoch++;
+		m_cvStart.notify_all();
+
+		// Barrier, wait for every worker to finish the current epoch
+		m_cvDone.wait(lock, [this] { return m_pending == 0; });
+		m_task = nullptr;
+	}
+
+	void ThreadPool::parallelFor(const size_t count, const std::function<void(size_t, unsigned)> & task, const size_t grainSize)
+	{
+		if (count == 0)
+		{
+			return;
+		}
+
+		// Not worth waking the workers up for a single chunk
+		const size_t grain = std::max<size_t>(1, grainSize);
+		if (count <= grain || g_isWorkerThread)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				task(i, 0);
+			}
+			return;
+		}
+
+		// Workers grab chunks of the index range until it runs out
+		std::atomic<size_t> next(0);
+		run([&](unsigned threadIndex)
+		{
+			for (;;)
+			{
+				const size_t start = next.fetch_add(grain);
+				if (start >= count)
+				{
+					break;
+				}
+
+				const size_t end = std::min(count, start + grain);
+				for (size_t i = start; i < end; i++)
+				{
+					task(i, threadIndex);
+				}
+			}
+		});
+	}
+
+	unsigned ThreadPool::getThreadCount() const
+	{
+		return static_cast<unsigned>(m_threads.size());
+	}
+
+	bool ThreadPool::getPinThreads() const
+	{
+		return m_pinThreads;
+	}
+
+	uint64_t ThreadPool::getEpoch() const
+	{
+		return m_epoch;
+	}
+
+	bool ThreadPool::isWorkerThread()
+	{
+		return g_isWorkerThread;
+	}
+
+	void ThreadPool::init(const unsigned threadCount, const bool pinThreads)
+	{
+		std::lock_guard<std::mutex> lock(g_threadPoolMutex);
+
+		// Keep the current pool if it already matches the request
+		if (g_threadPool && g_threadPool->getThreadCount() == std::max(1u, threadCount) && g_threadPool->getPinThreads() == pinThreads)
+		{
+			return;
+		}
+
+		g_threadPool.reset();
+		g_threadPool.reset(new ThreadPool(threadCount, pinThreads));
+	}
+
+	void ThreadPool::kill()
+	{
+		std::lock_guard<std::mutex> lock(g_threadPoolMutex);
+
+		g_threadPool.reset();
+	}
+
+	ThreadPool & ThreadPool::instance()
+	{
+		std::lock_guard<std::mutex> lock(g_threadPoolMutex);
+
+		if (!g_threadPool)
+		{
+			g_threadPool.reset(new ThreadPool(std::thread::hardware_concurrency()));
+		}
+
+		return *g_threadPool;
+	}
+
+	void ThreadPool::workerLoop(const unsigned index)
+	{
+		g_isWorkerThread = true;
+
+		if (m_pinThreads)
+		{
+			pinThread(index);
+		}
+
+		uint64_t epoch = 0;
+		for (;;)
+		{
+			const std::function<void(unsigned)> * task = nullptr;
+
+			// Sleep until a new epoch starts or the pool is destroyed
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cvStart.wait(lock, [&] { return m_quit || m_epoch != epoch; });
+
+				if (m_quit)
+				{
+					return;
+				}
+
+				epoch = m_epoch;
+				task = m_task;
+			}
+
+			(*task)(index);
+
+			// Last one out signals the waiting caller
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (--m_pending == 0)
+				{
+					m_cvDone.notify_one();
+				}
+			}
+		}
+	}
+
+	void ThreadPool::pinThread(const unsigned index)
+	{
+		const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+
+#if defined(OS_WINDOWS)
+		SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << (index % cores));
+#elif defined(OS_LINUX)
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		CPU_SET(index % cores, &cpuset);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) != 0)
+		{
+			MLOG_WARNING("ThreadPool: Could not pin worker %u to core %u.", index, index % cores);
+		}
+#else
+		MLOG_WARNING("ThreadPool: Pinning threads to cores is not supported on this platform.");
+#endif
+	}
+
+}
@@ -0,0 +1,53 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+// std includes
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+namespace mirage
+{
+
+	// ------------------------------------------------------------------------
+	// Thread Pool Object
+	// Long-lived worker threads that are handed work one epoch at a time.
+	// run() wakes every worker with the same task and acts as a barrier,
+	// it returns once all of the workers have finished the task.
+	// ------------------------------------------------------------------------
+	class ThreadPool
+	{
+	public:
+		ThreadPool(const unsigned threadCount = 1, const bool pinThreads = false);
+		~ThreadPool();
+		void run(const std::function<void(unsigned)> & task);
+		void parallelFor(const size_t count, const std::function<void(size_t, unsigned)> & task, const size_t grainSize = 1);
+		unsigned getThreadCount() const;
+		bool getPinThreads() const;
+		uint64_t getEpoch() const;
+		static bool isWorkerThread();
+		static void init(const unsigned threadCount, const bool pinThreads = false);
+		static void kill();
+		static ThreadPool & instance();
+	private:
+		void workerLoop(const unsigned index);
+		void pinThread(const unsigned index);
+		std::vector<std::thread> m_threads;
+		std::mutex m_runMutex;
+		std::mutex m_mutex;
+		std::condition_variable m_cvStart;
+		std::condition_variable m_cvDone;
+		const std::function<void(unsigned)> * m_task;
+		uint64_t m_epoch;
+		unsigned m_pending;
+		bool m_pinThreads;
+		bool m_quit;
+	};
+
+}
+
+#endif // THREADPOOL_H
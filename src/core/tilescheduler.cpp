@@ -0,0 +1,232 @@
+#include "tilescheduler.h"
+
+// std includes
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+
+// mirage includes
+#include "../macros.h"
+
+namespace mirage
+{
+
+	// Interleave the bits of x & y, x in the even bits
+	static uint32_t mortonIndex(uint32_t x, uint32_t y)
+	{
+		uint32_t result = 0;
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			result |= ((x >> i) & 1u) << (2 * i);
+			result |= ((y >> i) & 1u) << (2 * i + 1);
+		}
+		return result;
+	}
+
+	// Distance along a hilbert curve covering a n * n grid, n must be a power of two
+	static uint32_t hilbertIndex(uint32_t n, uint32_t x, uint32_t y)
+	{
+		uint32_t d = 0;
+		for (uint32_t s = n >> 1; s > 0; s >>= 1)
+		{
+			const uint32_t rx = (x & s) > 0;
+			const uint32_t ry = (y & s) > 0;
+			d += s * s * ((3 * rx) ^ ry);
+
+			// Rotate the quadrant
+			if (ry == 0)
+			{
+				if (rx == 1)
+				{
+					x = s - 1 - x;
+					y = s - 1 - y;
+				}
+				std::swap(x, y);
+			}
+		}
+		return d;
+	}
+
+	TileScheduler::TileScheduler(const unsigned width, const unsigned height, const unsigned tileSize, const TileOrder order) :
+		m_width(width),
+		m_height(height),
+		m_tileSize(std::max(1u, tileSize)),
+		m_order(order)
+	{
+		buildTiles();
+
+		MLOG_INFO("TileScheduler: Split the %ux%u film into %zu tiles of %ux%u pixels.", m_width, m_height, m_tiles.size(), m_tileSize, m_tileSize);
+	}
+
+	void TileScheduler::beginPass(const unsigned threadCount)
+	{
+		const unsigned tcount = std::max(1u, threadCount);
+
+		while (m_queues.size() < tcount)
+		{
+			m_queues.push_back(std::unique_ptr<TileQueue>(new TileQueue));
+		}
+		for (auto & q : m_queues)
+		{
+			q->tiles.clear();
+		}
+
+		const bool hasTimings = std::any_of(m_tileTimes.begin(), m_tileTimes.end(), [](double t) { return t > 0.0; });
+		if (!hasTimings)
+		{
+			// No timings yet, give each thread a contiguous run of the curve for coherence
+			const size_t count = m_tiles.size();
+			for (size_t i = 0; i < count; i++)
+			{
+				m_queues[i * tcount / count]->tiles.push_back(static_cast<unsigned>(i));
+			}
+			return;
+		}
+
+		// Most expensive tiles first, ties keep the curve order
+		std::vector<unsigned> sorted(m_tiles.size());
+		std::iota(sorted.begin(), sorted.end(), 0u);
+		std::stable_sort(sorted.begin(), sorted.end(), [this](unsigned a, unsigned b)
+		{
+			return m_tileTimes[a] > m_tileTimes[b];
+		});
+
+		// Greedy longest-processing-time assignment, each tile goes to the least loaded thread
+		std::vector<double> load(tcount, 0.0);
+		for (unsigned i : sorted)
+		{
+			const size_t t = std::min_element(load.begin(), load.end()) - load.begin();
+			m_queues[t]->tiles.push_back(i);
+			load[t] += m_tileTimes[i];
+		}
+	}
+
+	bool TileScheduler::nextTile(const unsigned threadIndex, Tile & tile)
+	{
+		const size_t qcount = m_queues.size();
+
+		// Own queue first, take from the front
+		{
+			TileQueue & own = *m_queues[threadIndex % qcount];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.tiles.empty())
+			{
+				tile = m_tiles[own.tiles.front()];
+				own.tiles.pop_front();
+				return true;
+			}
+		}
+
+		// Steal the cheapest tile from the back of someone else's queue
+		for (size_t i = 1; i < qcount; i++)
+		{
+			TileQueue & victim = *m_queues[(threadIndex + i) % qcount];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.tiles.empty())
+			{
+				tile = m_tiles[victim.tiles.back()];
+				victim.tiles.pop_back();
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void TileScheduler::endTile(const Tile & tile, const double seconds)
+	{
+		// Each tile is rendered by exactly one thread per pass, no locking needed
+		m_tileTimes[tile.index] = seconds;
+	}
+
+	void TileScheduler::resetTimings()
+	{
+		std::fill(m_tileTimes.begin(), m_tileTimes.end(), 0.0);
+	}
+
+	unsigned TileScheduler::getTileSize() const
+	{
+		return m_tileSize;
+	}
+
+	TileOrder TileScheduler::getOrder() const
+	{
+		return m_order;
+	}
+
+	const std::vector<Tile> & TileScheduler::getTiles() const
+	{
+		return m_tiles;
+	}
+
+	TileOrder TileScheduler::strToOrder(const std::string & str)
+	{
+		if (str == "scanline")
+			return TILE_ORDER_SCANLINE;
+		else if (str == "morton")
+			return TILE_ORDER_MORTON;
+		else if (str == "hilbert")
+			return TILE_ORDER_HILBERT;
+
+		MLOG_WARNING("TileScheduler: Unknown tile order %s, defaulting to hilbert.", str.c_str());
+		return TILE_ORDER_HILBERT;
+	}
+
+	void TileScheduler::buildTiles()
+	{
+		const unsigned tilesX = (m_width + m_tileSize - 1) / m_tileSize;
+		const unsigned tilesY = (m_height + m_tileSize - 1) / m_tileSize;
+
+		// Edge tiles are clipped so no rows or columns are left out
+		std::vector<std::pair<uint32_t, Tile>> keyed;
+		keyed.reserve(tilesX * tilesY);
+
+		uint32_t n = 1;
+		while (n < std::max(tilesX, tilesY))
+			n <<= 1;
+
+		for (unsigned ty = 0; ty < tilesY; ty++)
+		{
+			for (unsigned tx = 0; tx < tilesX; tx++)
+			{
+				Tile t;
+				t.x = tx * m_tileSize;
+				t.y = ty * m_tileSize;
+				t.w = std::min(m_tileSize, m_width - t.x);
+				t.h = std::min(m_tileSize, m_height - t.y);
+
+				uint32_t key;
+				switch (m_order)
+				{
+				case TILE_ORDER_MORTON:
+					key = mortonIndex(tx, ty);
+					break;
+				case TILE_ORDER_HILBERT:
+					key = hilbertIndex(n, tx, ty);
+					break;
+				default:
+					key = ty * tilesX + tx;
+					break;
+				}
+
+				keyed.push_back(std::make_pair(key, t));
+			}
+		}
+
+		std::sort(keyed.begin(), keyed.end(), [](const std::pair<uint32_t, Tile> & a, const std::pair<uint32_t, Tile> & b)
+		{
+			return a.first < b.first;
+		});
+
+		m_tiles.clear();
+		m_tiles.reserve(keyed.size());
+		for (auto & k : keyed)
+		{
+			k.second.index = static_cast<unsigned>(m_tiles.size());
+			m_tiles.push_back(k.second);
+		}
+
+		m_tileTimes.assign(m_tiles.size(), 0.0);
+	}
+
+}
@@ -0,0 +1,72 @@
+#ifndef TILESCHEDULER_H
+#define TILESCHEDULER_H
+
+// std includes
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <string>
+
+namespace mirage
+{
+
+	// ------------------------------------------------------------------------
+	// Tile traversal orders
+	// ------------------------------------------------------------------------
+	enum TileOrder
+	{
+		TILE_ORDER_SCANLINE,
+		TILE_ORDER_MORTON,
+		TILE_ORDER_HILBERT
+	};
+
+	// ------------------------------------------------------------------------
+	// Tile Object
+	// ------------------------------------------------------------------------
+	struct Tile
+	{
+		unsigned x, y;
+		unsigned w, h;
+		unsigned index;
+	};
+
+	// ------------------------------------------------------------------------
+	// Tile Scheduler Object
+	// Splits the film into tiles and hands them out to the render threads.
+	// Each thread owns a deque of tiles and steals from the others when its
+	// own runs dry. Tile render times of the previous pass are used to hand
+	// out the most expensive tiles first.
+	// ------------------------------------------------------------------------
+	class TileScheduler
+	{
+	public:
+		TileScheduler(const unsigned width = 128, const unsigned height = 128, const unsigned tileSize = 32, const TileOrder order = TILE_ORDER_HILBERT);
+		void beginPass(const unsigned threadCount);
+		bool nextTile(const unsigned threadIndex, Tile & tile);
+		void endTile(const Tile & tile, const double seconds);
+		void resetTimings();
+		unsigned getTileSize() const;
+		TileOrder getOrder() const;
+		const std::vector<Tile> & getTiles() const;
+		static TileOrder strToOrder(const std::string & str);
+	private:
+		struct TileQueue
+		{
+			std::mutex mutex;
+			std::deque<unsigned> tiles;
+		};
+
+		void buildTiles();
+		unsigned m_width;
+		unsigned m_height;
+		unsigned m_tileSize;
+		TileOrder m_order;
+		std::vector<Tile> m_tiles;
+		std::vector<double> m_tileTimes;
+		std::vector<std::unique_ptr<TileQueue>> m_queues;
+	};
+
+}
+
+#endif // TILESCHEDULER_H
@@ -18,7 +18,7 @@ namespace mirage
 		Le = m_emission;
 	}
 
-	void DirectionalLight::evalWe(const vec3 & P, const vec3 & N, const vec3 & Wo, vec3 & We) const
+	void DirectionalLight::evalWe(const vec3 & P, const vec3 & N, const vec3 & Wo, vec3 & We, Sampler & sampler) const
 	{
 		We = m_lightToWorld.getOrientation().getForwardVector().negate() * m_distance;
 	}
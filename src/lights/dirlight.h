@@ -14,7 +14,7 @@ namespace mirage
 	public:
 		DirectionalLight(Transform l2w = Transform(), vec3 emission = vec3(1, 1, 1), float distance = 1028);
 		virtual void Le(const vec3 & P, const vec3 & N, const vec3 & Wi, const vec3 & Wo, vec3 & Li) const override;
-		virtual void evalWe(const vec3 & P, const vec3 & N, const vec3 & Wo, vec3 & We) const override;
+		virtual void evalWe(const vec3 & P, const vec3 & N, const vec3 & Wo, vec3 & We, Sampler & sampler) const override;
 	private:
 		float m_distance;
 	};
@@ -25,7 +25,7 @@ void PointLight::Le(const vec3 &P, const vec3 &N, const vec3 &Wi, const vec3 &Wo
     Le = m_emission * attenuation;
 }
 
-void PointLight::evalWe(const vec3 &P, const vec3 &N, const vec3 &Wo, vec3 &We) const
+void PointLight::evalWe(const vec3 &P, const vec3 &N, const vec3 &Wo, vec3 &We, Sampler &sampler) const
 {
     We = m_lightToWorld.getPosition() - P;
 }
@@ -36,7 +36,7 @@ namespace mirage
 		}
 	}
 
-	void SpotLight::evalWe(const vec3 &P, const vec3 &N, const vec3 &Wo, vec3 &We) const
+	void SpotLight::evalWe(const vec3 &P, const vec3 &N, const vec3 &Wo, vec3 &We, Sampler &sampler) const
 	{
 		We = m_lightToWorld.getPosition() - P;
 	}
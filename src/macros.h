@@ -10,7 +10,7 @@
 #define VERSION_A 2
 
 // Use SIMD optimizations in critical functions
-// #define MIRAGE_SIMD
+#define MIRAGE_SIMD
 
 // Use OpenCL for accelerated rendering
 // #define MIRAGE_OPENCL
@@ -3,6 +3,10 @@
 #include <thread>
 #include <string>
 #include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+#include <memory>
 
 // lib includes
 #include <SDL2/SDL.h>
@@ -14,7 +18,10 @@
 #include "core/display.h"
 #include "core/scene.h"
 #include "core/luaengine.h"
+#include "core/threadpool.h"
+#include "core/tilescheduler.h"
 #include "renderers/pathtracer.h"
+#include "renderers/wavefront.h"
 
 using namespace mirage;
 
@@ -30,8 +37,72 @@ int main(int argc, char * argv[])
 	// Print info and version
 	MLOG_INFO("Main: MirageRender, version %d.%d.%d", VERSION_R, VERSION_B, VERSION_A);
 
-	// Initialize SDL2
-	if (SDL_Init(SDL_INIT_VIDEO) != 0)
+	// Parse launch parameters, get script, etc objects..
+	std::string script("example.lua");
+	std::string output("render.ppm");
+	bool headless = false;
+	unsigned targetSpp = 0;
+	double targetTime = 0.0;
+	long long seed = -1;
+	for (int i = 1; i < argc; i++)
+	{
+		switch (cstr2int(argv[i]))
+		{
+		case cstr2int("--script"):
+		case cstr2int("-s"):
+			if (i + 1 < argc)
+				script = argv[++i];
+			else
+				LOG("No script file specified. Loading default script (" << script << ").");
+			break;
+		case cstr2int("--headless"):
+		case cstr2int("-b"):
+			headless = true;
+			break;
+		case cstr2int("--spp"):
+			if (i + 1 < argc)
+				targetSpp = static_cast<unsigned>(std::max(0, std::atoi(argv[++i])));
+			break;
+		case cstr2int("--time"):
+			if (i + 1 < argc)
+				targetTime = std::max(0.0, std::atof(argv[++i]));
+			break;
+		case cstr2int("--seed"):
+			if (i + 1 < argc)
+				seed = std::max(0LL, std::atoll(argv[++i]));
+			break;
+		case cstr2int("--output"):
+		case cstr2int("-o"):
+			if (i + 1 < argc)
+				output = argv[++i];
+			break;
+		case cstr2int("--help"):
+		case cstr2int("-h"):
+			LOG("Usage: mirage.exe --script scriptfilename.lua, folder for scripts is ./res/scripts/\n"
+				<< "      Available launch parameters:\n"
+				<< "      Show this help message: --help, -h\n"
+				<< "      Load a scene file: --script, -s\n"
+				<< "      Render without a window and exit when done: --headless, -b\n"
+				<< "      Headless target samples per pixel: --spp n\n"
+				<< "      Headless wall-clock budget in seconds: --time s\n"
+				<< "      Headless output image file (.ppm): --output, -o\n"
+				<< "      Random seed, overrides SetRandomSeed: --seed n"
+			);
+			return 0;
+		default:
+			LOG("Unknown launch parameter " << argv[i] << ", see --help.");
+			break;
+		}
+	}
+
+	// Headless renders need something to stop at, default to a fixed sample count
+	if (headless && targetSpp == 0 && targetTime <= 0.0)
+	{
+		targetSpp = 64;
+	}
+
+	// Initialize SDL2, the video subsystem is only needed for the window
+	if (SDL_Init(headless ? 0 : SDL_INIT_VIDEO) != 0)
 	{
 		MLOG_ERROR("Main: SDL_Init Error: %s", SDL_GetError());
 		return 1;
@@ -41,56 +112,111 @@ int main(int argc, char * argv[])
 	// Initialize function hooks
 	atexit(dispose);
 
-	// Parse launch parameters, get script, etc objects..
-	std::string script("example.lua");
-	switch (cstr2int(argc > 1 ? argv[1] : "default"))
-	{
-	case cstr2int("--script"):
-	case cstr2int("-s"):
-		if (argc > 2)
-			script = argv[2];
-		else
-			LOG("No script file specified. Loading default script (" << script << ").");
-		break;
-	case cstr2int("--help"):
-	case cstr2int("-h"):
-		LOG("Usage: mirage.exe --script scriptfilename.lua, folder for scripts is ./res/scripts/\n"
-			<< "      Available launch parameters:\n"
-			<< "      Show this help message: --help, -h\n"
-			<< "      Load a scene file: --script, -s"
-		);
-		return 0;
-	default:
-		LOG("No script file specified. Loading default script (" << script << ").");
-		break;
-	}
-
 	// Initialize Scene & Lua 5.3.x + load script(s)
 	Scene scene;
 	lua::init(&scene);
 	lua::load(std::string("./res/scripts/") + script);
 
-	// Initialize render threads
+	// A seed given on the command line wins over the script
+	if (seed >= 0)
+	{
+		randomseed(static_cast<uint64_t>(seed));
+	}
+
+	// Initialize the render thread pool, it is reused by every pass
 	lua::g_mThreadInitInfo.rThreadCount = (lua::g_mThreadInitInfo.rThreadCount != 0) ? lua::g_mThreadInitInfo.rThreadCount : static_cast<unsigned>(SDL_GetCPUCount());
-	const unsigned tcount = lua::g_mThreadInitInfo.rThreadCount;
-	std::thread * threads = new std::thread[tcount];
+	ThreadPool::init(lua::g_mThreadInitInfo.rThreadCount, lua::g_mThreadInitInfo.rThreadAffinity);
+	ThreadPool & threadPool = ThreadPool::instance();
+	const unsigned tcount = threadPool.getThreadCount();
 
 	MLOG_INFO("MThreading: Using %u threads for rendering.", tcount);
 
-	// Initialize the main display
-	Display display("MirageRender v" +
-		std::to_string(VERSION_R) + "." + std::to_string(VERSION_B) + "." + std::to_string(VERSION_A),
-		lua::g_dispInitInfo.width, lua::g_dispInitInfo.height, lua::g_dispInitInfo.scale
-	);
-
-	MLOG_INFO("MThreading: Split the screen into %d pixel vertical slices.", display.getHeight() / tcount);
-
 	// Choose a camera and an accelerator
 	Camera * camera = scene.getCamera();
 	Accelerator * accelerator = scene.getAccelerator();
 
 	// Initialize the chosen renderer
-	Pathtracer renderer(scene.getRadianceClamping(), scene.getMaxRecursion());
+	std::unique_ptr<Renderer> renderer;
+	if (scene.getRenderer() == "wavefront")
+		renderer.reset(new WavefrontPathtracer(scene.getRadianceClamping(), scene.getMaxRecursion()));
+	else
+		renderer.reset(new Pathtracer(scene.getRadianceClamping(), scene.getMaxRecursion()));
+
+	MLOG_INFO("Main: Using the %s renderer.", scene.getRenderer().c_str());
+
+	// Split the film into tiles for the workers
+	TileScheduler scheduler(
+		camera ? camera->getFilm().getResolutionX() : lua::g_dispInitInfo.width,
+		camera ? camera->getFilm().getResolutionY() : lua::g_dispInitInfo.height,
+		lua::g_tileInitInfo.size,
+		TileScheduler::strToOrder(lua::g_tileInitInfo.order)
+	);
+
+	// Renders one progressive pass over the whole film, display may be null
+	auto renderPass = [&](Display * display)
+	{
+		// Workers pull tiles until every queue is empty, run() returns once all of them are done
+		scheduler.beginPass(tcount);
+		threadPool.run([&](unsigned i)
+		{
+			Tile tile;
+			while (scheduler.nextTile(i, tile))
+			{
+				auto t_tile = std::chrono::steady_clock::now();
+				renderer->render(&scene, display, tile.w, tile.h, tile.x, tile.y);
+				scheduler.endTile(tile, std::chrono::duration<double>(std::chrono::steady_clock::now() - t_tile).count());
+			}
+		});
+	};
+
+	// Headless batch mode, render to the requested target and write the film to disk
+	if (headless)
+	{
+		if (!camera || !accelerator)
+		{
+			MLOG_ERROR("Main: Headless rendering requires a camera and a ray accelerator in the scene.");
+			lua::kill();
+			ThreadPool::kill();
+			return 1;
+		}
+
+		MLOG_INFO("Main: Headless render, target: %u samples per pixel, %.2fs time budget.", targetSpp, targetTime);
+
+		auto t_start = std::chrono::steady_clock::now();
+		double elapsed = 0.0;
+		uint32_t passCount = 0;
+
+		while ((targetSpp == 0 || passCount < targetSpp) && (targetTime <= 0.0 || elapsed < targetTime))
+		{
+			renderPass(nullptr);
+			passCount++;
+
+			elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+		}
+
+		camera->getFilm().saveToPPM(output);
+
+		const double pixels = static_cast<double>(camera->getFilm().getResolutionX()) * camera->getFilm().getResolutionY();
+		MLOG_INFO("Main: Headless render finished. Samples per pixel: %u, Time: %.3fs, Per pass: %.3fms, Samples/s: %.0f.",
+			passCount,
+			elapsed,
+			passCount > 0 ? elapsed * 1000.0 / passCount : 0.0,
+			elapsed > 0.0 ? pixels * passCount / elapsed : 0.0
+		);
+
+		lua::kill();
+		ThreadPool::kill();
+
+		MLOG_INFO("MirageRender, exit program successfully.");
+
+		return 0;
+	}
+
+	// Initialize the main display
+	Display display("MirageRender v" +
+		std::to_string(VERSION_R) + "." + std::to_string(VERSION_B) + "." + std::to_string(VERSION_A),
+		lua::g_dispInitInfo.width, lua::g_dispInitInfo.height, lua::g_dispInitInfo.scale
+	);
 
 	// Runtime related state variables
 	uint32_t frameCount = 0;
@@ -122,22 +248,16 @@ int main(int argc, char * argv[])
 			// Update everything
 			camera->update(0.025);
 
-			// Give a portion of the screen as a task for each thread
-			int width = camera->getFilm().getResolutionX();
-			int height = camera->getFilm().getResolutionY();
-			for (unsigned int i = 0; i < tcount; i++)
+			// Refit the accelerator around shapes that moved, the old samples & tile costs no longer match the scene
+			if (accelerator->update())
 			{
-				threads[i] = std::thread([=, &renderer, &scene, &display]
-				{
-					renderer.render(&scene, &display, width, height / tcount, 0, height / tcount * i);
-				});
+				camera->getFilm().clearSamples();
+				scheduler.resetTimings();
+				frameCount = 0;
 			}
 
-			// Wait for all the threads to finish on the main thread by joining them
-			for (unsigned int i = 0; i < tcount; i++)
-			{
-				threads[i].join();
-			}
+			// Render a pass over the whole screen
+			renderPass(&display);
 
 			// Display results on screen
 			display.render();
@@ -196,8 +316,8 @@ int main(int argc, char * argv[])
 	// Unload lua 5.3.x
 	lua::kill();
 
-	// Free the allocated rendering threads
-	DELETEA(threads);
+	// Stop the rendering threads
+	ThreadPool::kill();
 
 	// Inform that the program exit successfully
 	MLOG_INFO("MirageRender, exit program successfully.");
@@ -22,7 +22,7 @@ namespace mirage
 	// https://graphics.stanford.edu/courses/cs148-10-summer/docs/2006--degreve--reflection_refraction.pdf
 	// Optimized versions of the functions:
 	// http://www.kevinbeason.com/smallpt/
-	void DielectricMaterial::evalBSDF(const vec3 & P, const vec3 & N, const vec3 & Wr, const vec3 & Wt, const vec3 & Wo, float & brdf, float & btdf) const
+	void DielectricMaterial::evalBSDF(const vec3 & P, const vec3 & N, const vec3 & Wr, const vec3 & Wt, const vec3 & Wo, float & brdf, float & btdf, Sampler & sampler) const
 	{
 		// Are we going into the medium or out of it?
 		auto normal = vec3::dot(N, Wo) > 0.0f ? N : N.negate();
@@ -51,22 +51,10 @@ namespace mirage
 		float c = 1.0f - (direct ? NdotWo : vec3::dot(Wt, N)); // c  = (1.0 - cos(θi ? θt))^5
 		float Rs = R0 + (1.0f - R0) * c * c * c * c * c; // Rschlick(θi) = R0 + (1.0 - R0) * (1.0 - cos(θi ? θt))^5
 		float Tr = 1.0f - Rs;
-		float P_ = 0.5f * Rs + 0.25f;
-		float R = Rs / P_;
-		float T = Tr / (1.0f - P_);
 
-		// Assign reflectivity and refractivity
-		if (btdf > 2.0f)
-		{
-			float r = pseudorand();
-			brdf = (r < P_) ? R : 0.0f;
-			btdf = (r > P_) ? T : 0.0f;
-		}
-		else
-		{
-			brdf = Rs;
-			btdf = Tr;
-		}
+		// Assign reflectivity and refractivity, the integrator picks the lobe to follow
+		brdf = Rs;
+		btdf = Tr;
 	}
 
 	void DielectricMaterial::evalBSDF_direct(const vec3 & P, const vec3 & N, const vec3 & We, const vec3 & Wr, const vec3 & Wt, const vec3 & Wo, float & brdf, float & btdf) const
@@ -75,12 +63,12 @@ namespace mirage
 		btdf = 0.0f;
 	}
 
-	void DielectricMaterial::evalPDF(float & pdf) const
+	void DielectricMaterial::evalPDF(const vec3 & N, const vec3 & Wi, float & pdf) const
 	{
 		pdf = 1.0f;
 	}
 
-	void DielectricMaterial::evalWi(const vec3 & Wo, const vec3 & N, vec3 & Wr, vec3 & Wt)
+	void DielectricMaterial::evalWi(const vec3 & Wo, const vec3 & N, vec3 & Wr, vec3 & Wt, Sampler & sampler)
 	{
 		// Are we going into the medium or out of it?
 		auto normal = vec3::dot(N, Wo) > 0.0f ? N : N.negate();
@@ -25,7 +25,7 @@ namespace mirage
 
 	}
 
-	void DiffuseMaterial::evalBSDF(const vec3 & P, const vec3 & N, const vec3 & Wr, const vec3 & Wt, const vec3 & Wo, float & brdf, float & btdf) const
+	void DiffuseMaterial::evalBSDF(const vec3 & P, const vec3 & N, const vec3 & Wr, const vec3 & Wt, const vec3 & Wo, float & brdf, float & btdf, Sampler & sampler) const
 	{
 		// Calculate the cosi term
 		float cosi = vec3::dot(Wr, N);
@@ -49,15 +49,17 @@ namespace mirage
 		btdf = 0.0f;
 	}
 
-	void DiffuseMaterial::evalPDF(float & pdf) const
+	void DiffuseMaterial::evalPDF(const vec3 & N, const vec3 & Wi, float & pdf) const
 	{
-		pdf = 1.0f / (2.0f * PI);
+		// Wi is drawn cosine weighted, match it so brdf / pdf stays at unity
+		pdf = PI_INV * std::max(vec3::dot(N, Wi), EPSILON);
 	}
 
-	void DiffuseMaterial::evalWi(const vec3 & Wo, const vec3 & N, vec3 & Wr, vec3 & Wt)
+	void DiffuseMaterial::evalWi(const vec3 & Wo, const vec3 & N, vec3 & Wr, vec3 & Wt, Sampler & sampler)
 	{
-		// Uniform hemispherical sampling
-		Wr = vec3::sampleHemisphere(N).normalize();
+		// Cosine weighted hemispherical sampling
+		vec2 u = sampler.get2D();
+		Wr = vec3::sampleHemisphere(N, u.x, u.y).normalize();
 
 		// No transmission, Wt stays 0.0f
 		Wt = vec3();
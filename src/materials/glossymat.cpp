@@ -20,7 +20,7 @@ namespace mirage
 
 	// The cook-torrance microfacet model:
 	// http://ruh.li/GraphicsCookTorrance.html
-	void GlossyMaterial::evalBSDF(const vec3 & P, const vec3 & N, const vec3 & Wr, const vec3 & Wt, const vec3 & Wo, float & brdf, float & btdf) const
+	void GlossyMaterial::evalBSDF(const vec3 & P, const vec3 & N, const vec3 & Wr, const vec3 & Wt, const vec3 & Wo, float & brdf, float & btdf, Sampler & sampler) const
 	{
 		// Surface properties
 		float R = m_r + EPSILON; // Roughness
@@ -100,16 +100,17 @@ namespace mirage
 		btdf = 0.0f;
 	}
 
-	void GlossyMaterial::evalPDF(float & pdf) const
+	void GlossyMaterial::evalPDF(const vec3 & N, const vec3 & Wi, float & pdf) const
 	{
 		pdf = 1.0f / (2.0f * PI * m_r);
 	}
 
-	void GlossyMaterial::evalWi(const vec3 & Wo, const vec3 & N, vec3 & Wr, vec3 & Wt)
+	void GlossyMaterial::evalWi(const vec3 & Wo, const vec3 & N, vec3 & Wr, vec3 & Wt, Sampler & sampler)
 	{
 		// Calculate mirror & random reflection vectors
 		vec3 Wr_mirr = vec3::reflect(Wo.negate(), N).normalize();
-		vec3 Wr_rand = vec3::sampleHemisphere(Wr_mirr, m_r, 1.0f - m_r);
+		vec2 u = sampler.get2D();
+		vec3 Wr_rand = vec3::sampleHemisphere(Wr_mirr, m_r, 1.0f - m_r, u.x, u.y, sampler.get1D());
 
 		// Make sure the random ray doesn't go through the hit surface
 		if (vec3::dot(N, Wr_rand) < 0.0f)
@@ -18,7 +18,7 @@ namespace mirage
 
 	}
 
-	void SpecularMaterial::evalBSDF(const vec3 &P, const vec3 &N, const vec3 &Wr, const vec3 &Wt, const vec3 &Wo, float &brdf, float &btdf) const
+	void SpecularMaterial::evalBSDF(const vec3 &P, const vec3 &N, const vec3 &Wr, const vec3 &Wt, const vec3 &Wo, float &brdf, float &btdf, Sampler &sampler) const
 	{
 		brdf = 1.0f;
 		btdf = 0.0f;
@@ -40,12 +40,12 @@ namespace mirage
 		btdf = 0.0f;
 	}
 
-	void SpecularMaterial::evalPDF(float &pdf) const
+	void SpecularMaterial::evalPDF(const vec3 &N, const vec3 &Wi, float &pdf) const
 	{
 		pdf = 1.0f;
 	}
 
-	void SpecularMaterial::evalWi(const vec3 &Wo, const vec3 &N, vec3 &Wr, vec3 &Wt)
+	void SpecularMaterial::evalWi(const vec3 &Wo, const vec3 &N, vec3 &Wr, vec3 &Wt, Sampler &sampler)
 	{
 		Wr = vec3::reflect(Wo.negate(), N).normalize();
 		Wt = vec3();
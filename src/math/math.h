@@ -3,11 +3,12 @@
 
 // std includes
 #include <cmath>
-#include <random>
 #include <algorithm>
-#include <ctime>
 #include <cstdio>
 
+// mirage includes
+#include "rng.h"
+
 // Constant definitions
 #define PI 3.14159265359f
 #define PI_2 2.0f * PI
@@ -17,20 +18,15 @@
 namespace mirage
 {
 
-	// Static objects
-	static std::mt19937 g_randomGen(time(NULL));
-	static std::uniform_real_distribution<float>g_randomRealDis01(0.0f, 1.0f);
-	static std::uniform_real_distribution<float>g_randomRealDis02pi(0.0f, PI_2);
-
 	// Static functions
 	static inline float pseudorand()
 	{
-		return g_randomRealDis01(g_randomGen);
+		return randomfloat();
 	}
 
 	static inline float pseudorand02pi()
 	{
-		return g_randomRealDis02pi(g_randomGen);
+		return randomfloat() * PI_2;
 	}
 
 	static inline float clampf(float f, float min, float max)
@@ -0,0 +1,9 @@
+#include "rng.h"
+
+namespace mirage
+{
+
+	uint64_t g_randomSeed = 0;
+	thread_local RandomState g_randomState = { 0, 0 };
+
+}
@@ -0,0 +1,71 @@
+#ifndef RNG_H
+#define RNG_H
+
+// std includes
+#include <cstdint>
+
+namespace mirage
+{
+
+	// ------------------------------------------------------------------------
+	// Counter based random number generator
+	// Every number is a hash of (key, counter), the key is derived from the
+	// global seed, pixel and sample index, the counter is the dimension. A
+	// pixel sample therefore always sees the same sequence no matter which
+	// thread renders it or in which order the tiles are processed.
+	// ------------------------------------------------------------------------
+	struct RandomState
+	{
+		uint64_t key;
+		uint32_t counter;
+	};
+
+	// Global seed, shared by all threads
+	extern uint64_t g_randomSeed;
+
+	// Per-thread generator state
+	extern thread_local RandomState g_randomState;
+
+	// SplitMix64 finalizer, a strong 64-bit integer hash
+	static inline uint64_t randomhash(uint64_t x)
+	{
+		x += 0x9E3779B97F4A7C15ull;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+		return x ^ (x >> 31);
+	}
+
+	static inline void randomseed(const uint64_t seed)
+	{
+		g_randomSeed = seed;
+	}
+
+	// Start the sequence of a pixel sample on the calling thread
+	static inline void randomstart(const uint32_t x, const uint32_t y, const uint32_t sampleIndex)
+	{
+		const uint64_t pixel = (static_cast<uint64_t>(y) << 32) | x;
+		g_randomState.key = randomhash(randomhash(g_randomSeed ^ randomhash(pixel)) + sampleIndex);
+		g_randomState.counter = 0;
+	}
+
+	// Value of an arbitrary dimension of the current sample, doesn't advance the counter
+	static inline uint32_t randomuint(const uint32_t dimension)
+	{
+		return static_cast<uint32_t>(randomhash(g_randomState.key + dimension * 0xD1B54A32D192ED03ull) >> 32);
+	}
+
+	// Next dimension of the current sample
+	static inline uint32_t randomuint()
+	{
+		return randomuint(g_randomState.counter++);
+	}
+
+	// Uniform float in [0, 1) from the top 24 bits
+	static inline float randomfloat()
+	{
+		return (randomuint() >> 8) * (1.0f / 16777216.0f);
+	}
+
+}
+
+#endif // RNG_H
@@ -0,0 +1,178 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// std includes
+#include <cstdint>
+#include <cstring>
+
+// mirage includes
+#include "../macros.h"
+
+// Pick the widest instruction set the compiler was told it may use
+#if defined(MIRAGE_SIMD) && defined(__AVX__)
+#define MIRAGE_SIMD_AVX
+#define MIRAGE_SIMD_WIDTH 8
+#include <immintrin.h>
+#elif defined(MIRAGE_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define MIRAGE_SIMD_SSE
+#define MIRAGE_SIMD_WIDTH 4
+#include <emmintrin.h>
+#else
+#define MIRAGE_SIMD_WIDTH 4
+#endif
+
+namespace mirage
+{
+
+	// ------------------------------------------------------------------------
+	// vfloat / vmask
+	// MIRAGE_SIMD_WIDTH floats processed in lockstep, maps to an AVX or SSE
+	// register when available and falls back to plain loops otherwise. Masks
+	// are all-ones / all-zeros per lane, movemask() packs them into an int.
+	// loadu8() widens MIRAGE_SIMD_WIDTH bytes to floats, hmin() is the
+	// smallest lane.
+	// ------------------------------------------------------------------------
+#if defined(MIRAGE_SIMD_AVX)
+
+	struct vmask
+	{
+		__m256 m;
+		vmask() { }
+		vmask(const __m256 m) : m(m) { }
+	};
+
+	struct vfloat
+	{
+		__m256 v;
+		vfloat() { }
+		vfloat(const __m256 v) : v(v) { }
+		vfloat(const float f) : v(_mm256_set1_ps(f)) { }
+		static inline vfloat load(const float * p) { return _mm256_loadu_ps(p); }
+		static inline vfloat loadu8(const uint8_t * p)
+		{
+			const __m128i b = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+			const __m128i lo = _mm_cvtepu8_epi32(b);
+			const __m128i hi = _mm_cvtepu8_epi32(_mm_srli_si128(b, 4));
+			return _mm256_cvtepi32_ps(_mm256_insertf128_si256(_mm256_castsi128_si256(lo), hi, 1));
+		}
+		inline void store(float * p) const { _mm256_storeu_ps(p, v); }
+	};
+
+	inline vfloat operator+(const vfloat & a, const vfloat & b) { return _mm256_add_ps(a.v, b.v); }
+	inline vfloat operator-(const vfloat & a, const vfloat & b) { return _mm256_sub_ps(a.v, b.v); }
+	inline vfloat operator*(const vfloat & a, const vfloat & b) { return _mm256_mul_ps(a.v, b.v); }
+	inline vfloat operator/(const vfloat & a, const vfloat & b) { return _mm256_div_ps(a.v, b.v); }
+	inline vfloat vmin(const vfloat & a, const vfloat & b) { return _mm256_min_ps(a.v, b.v); }
+	inline vfloat vmax(const vfloat & a, const vfloat & b) { return _mm256_max_ps(a.v, b.v); }
+	inline vmask operator<(const vfloat & a, const vfloat & b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+	inline vmask operator<=(const vfloat & a, const vfloat & b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+	inline vmask operator>(const vfloat & a, const vfloat & b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+	inline vmask operator>=(const vfloat & a, const vfloat & b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+	inline vmask operator&(const vmask & a, const vmask & b) { return _mm256_and_ps(a.m, b.m); }
+	inline vmask operator|(const vmask & a, const vmask & b) { return _mm256_or_ps(a.m, b.m); }
+	inline vfloat select(const vmask & m, const vfloat & a, const vfloat & b) { return _mm256_blendv_ps(b.v, a.v, m.m); }
+	inline int movemask(const vmask & m) { return _mm256_movemask_ps(m.m); }
+	inline float hmin(const vfloat & a)
+	{
+		__m256 m = _mm256_min_ps(a.v, _mm256_permute2f128_ps(a.v, a.v, 1));
+		m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+		m = _mm256_min_ps(m, _mm256_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm256_cvtss_f32(m);
+	}
+
+#elif defined(MIRAGE_SIMD_SSE)
+
+	struct vmask
+	{
+		__m128 m;
+		vmask() { }
+		vmask(const __m128 m) : m(m) { }
+	};
+
+	struct vfloat
+	{
+		__m128 v;
+		vfloat() { }
+		vfloat(const __m128 v) : v(v) { }
+		vfloat(const float f) : v(_mm_set1_ps(f)) { }
+		static inline vfloat load(const float * p) { return _mm_loadu_ps(p); }
+		static inline vfloat loadu8(const uint8_t * p)
+		{
+			int32_t bytes;
+			std::memcpy(&bytes, p, sizeof(bytes));
+			const __m128i zero = _mm_setzero_si128();
+			return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero));
+		}
+		inline void store(float * p) const { _mm_storeu_ps(p, v); }
+	};
+
+	inline vfloat operator+(const vfloat & a, const vfloat & b) { return _mm_add_ps(a.v, b.v); }
+	inline vfloat operator-(const vfloat & a, const vfloat & b) { return _mm_sub_ps(a.v, b.v); }
+	inline vfloat operator*(const vfloat & a, const vfloat & b) { return _mm_mul_ps(a.v, b.v); }
+	inline vfloat operator/(const vfloat & a, const vfloat & b) { return _mm_div_ps(a.v, b.v); }
+	inline vfloat vmin(const vfloat & a, const vfloat & b) { return _mm_min_ps(a.v, b.v); }
+	inline vfloat vmax(const vfloat & a, const vfloat & b) { return _mm_max_ps(a.v, b.v); }
+	inline vmask operator<(const vfloat & a, const vfloat & b) { return _mm_cmplt_ps(a.v, b.v); }
+	inline vmask operator<=(const vfloat & a, const vfloat & b) { return _mm_cmple_ps(a.v, b.v); }
+	inline vmask operator>(const vfloat & a, const vfloat & b) { return _mm_cmpgt_ps(a.v, b.v); }
+	inline vmask operator>=(const vfloat & a, const vfloat & b) { return _mm_cmpge_ps(a.v, b.v); }
+	inline vmask operator&(const vmask & a, const vmask & b) { return _mm_and_ps(a.m, b.m); }
+	inline vmask operator|(const vmask & a, const vmask & b) { return _mm_or_ps(a.m, b.m); }
+	inline vfloat select(const vmask & m, const vfloat & a, const vfloat & b) { return _mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v)); }
+	inline int movemask(const vmask & m) { return _mm_movemask_ps(m.m); }
+	inline float hmin(const vfloat & a)
+	{
+		__m128 m = _mm_min_ps(a.v, _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(1, 0, 3, 2)));
+		m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_cvtss_f32(m);
+	}
+
+#else
+
+	struct vmask
+	{
+		bool m[MIRAGE_SIMD_WIDTH];
+	};
+
+	struct vfloat
+	{
+		float v[MIRAGE_SIMD_WIDTH];
+		vfloat() { }
+		vfloat(const float f) { for (int i = 0; i < MIRAGE_SIMD_WIDTH; i++) v[i] = f; }
+		static inline vfloat load(const float * p) { vfloat r; for (int i = 0; i < MIRAGE_SIMD_WIDTH; i++) r.v[i] = p[i]; return r; }
+		static inline vfloat loadu8(const uint8_t * p) { vfloat r; for (int i = 0; i < MIRAGE_SIMD_WIDTH; i++) r.v[i] = p[i]; return r; }
+		inline void store(float * p) const { for (int i = 0; i < MIRAGE_SIMD_WIDTH; i++) p[i] = v[i]; }
+	};
+
+#define MIRAGE_VFLOAT_OP(op, expr) inline vfloat op(const vfloat & a, const vfloat & b) { vfloat r; for (int i = 0; i < MIRAGE_SIMD_WIDTH; i++) r.v[i] = (expr); return r; }
+#define MIRAGE_VMASK_OP(op, expr) inline vmask op(const vfloat & a, const vfloat & b) { vmask r; for (int i = 0; i < MIRAGE_SIMD_WIDTH; i++) r.m[i] = (expr); return r; }
+	MIRAGE_VFLOAT_OP(operator+, a.v[i] + b.v[i])
+	MIRAGE_VFLOAT_OP(operator-, a.v[i] - b.v[i])
+	MIRAGE_VFLOAT_OP(operator*, a.v[i] * b.v[i])
+	MIRAGE_VFLOAT_OP(operator/, a.v[i] / b.v[i])
+	MIRAGE_VFLOAT_OP(vmin, a.v[i] < b.v[i] ? a.v[i] : b.v[i])
+	MIRAGE_VFLOAT_OP(vmax, a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+	MIRAGE_VMASK_OP(operator<, a.v[i] < b.v[i])
+	MIRAGE_VMASK_OP(operator<=, a.v[i] <= b.v[i])
+	MIRAGE_VMASK_OP(operator>, a.v[i] > b.v[i])
+	MIRAGE_VMASK_OP(operator>=, a.v[i] >= b.v[i])
+#undef MIRAGE_VFLOAT_OP
+#undef MIRAGE_VMASK_OP
+
+	inline vmask operator&(const vmask & a, const vmask & b) { vmask r; for (int i = 0; i < MIRAGE_SIMD_WIDTH; i++) r.m[i] = a.m[i] && b.m[i]; return r; }
+	inline vmask operator|(const vmask & a, const vmask & b) { vmask r; for (int i = 0; i < MIRAGE_SIMD_WIDTH; i++) r.m[i] = a.m[i] || b.m[i]; return r; }
+	inline vfloat select(const vmask & m, const vfloat & a, const vfloat & b) { vfloat r; for (int i = 0; i < MIRAGE_SIMD_WIDTH; i++) r.v[i] = m.m[i] ? a.v[i] : b.v[i]; return r; }
+	inline int movemask(const vmask & m) { int r = 0; for (int i = 0; i < MIRAGE_SIMD_WIDTH; i++) r |= m.m[i] ? (1 << i) : 0; return r; }
+	inline float hmin(const vfloat & a) { float r = a.v[0]; for (int i = 1; i < MIRAGE_SIMD_WIDTH; i++) r = a.v[i] < r ? a.v[i] : r; return r; }
+
+#endif
+
+	// Lane mask with the lowest n bits set
+	inline int lanemask(const unsigned n)
+	{
+		return (n >= 32) ? -1 : static_cast<int>((1u << n) - 1u);
+	}
+
+}
+
+#endif // SIMD_H
@@ -201,10 +201,10 @@ namespace mirage
 				return eta * I - (eta * dot(N, I) + std::sqrt(k)) * N;
 		}
 
-		static inline vec3 sampleHemisphere(const vec3 &N)
+		static inline vec3 sampleHemisphere(const vec3 &N, float u1, float u2)
 		{
-			float r1 = pseudorand02pi(); // Spherical coordinates
-			float r2 = pseudorand();
+			float r1 = u1 * PI_2; // Spherical coordinates
+			float r2 = u2;
 			float r2s = std::sqrt(r2);
 			vec3 w = N; // w = normal
 			vec3 u = (cross((std::abs(w.x) > 0.1f ? vec3(0, 1) : vec3(1)), w)).normalize(); // u is perpendicular to w
@@ -212,17 +212,15 @@ namespace mirage
 			return (u * std::cos(r1) * r2s + v * std::sin(r1) * r2s + w * std::sqrt(1.0f - r2)).normalize();
 		}
 
-		static inline vec3 sampleHemisphere(const vec3 &N, float scalar, float chance)
+		static inline vec3 sampleHemisphere(const vec3 &N, float scalar, float chance, float u1, float u2, float uc)
 		{
-			std::uniform_real_distribution<float>brdf_dis(0.0f, scalar);
-
-			float r1 = pseudorand02pi(); // Spherical coordinates
+			float r1 = u1 * PI_2; // Spherical coordinates
 			float r2;
 
-			if (pseudorand() < chance) // Importance sampling, should we bias the distribution or not?
-				r2 = brdf_dis(g_randomGen);
+			if (uc < chance) // Importance sampling, should we bias the distribution or not?
+				r2 = scalar * u2;
 			else
-				r2 = pseudorand();
+				r2 = u2;
 
 			float r2s = std::sqrt(r2);
 			vec3 w = N; // w = normal
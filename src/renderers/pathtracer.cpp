@@ -1,5 +1,7 @@
 // std includes
 #include <iostream>
+#include <memory>
+#include <algorithm>
 
 // mirage includes
 #include "pathtracer.h"
@@ -23,40 +25,124 @@ namespace mirage
 		Film * const film = &camera->getFilm();
 		Ray r_primary;
 
-		for (size_t j = ya; j < ya + h; j++)
-		{
-			for (size_t i = xa; i < xa + w; i++)
-			{
-				// Project the primary ray through the camera's lens
-				camera->calcCamRay(i, j, r_primary);
+		// Every render call gets its own copy of the scene sampler, they carry per-thread state
+		std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
 
-				// Let's find the final radiance along the ray
-				vec3 lambda = radiance(scene, r_primary, 1.0f, 0);
+		// Neighbouring pixels of a row form a packet, their first bounce is traced together
+		const unsigned W = RayPacket::WIDTH;
+		PathState paths[RayPacket::WIDTH];
+		SamplerState states[RayPacket::WIDTH];
+		Intersection iSects[RayPacket::WIDTH];
+		std::vector<ShadowRay> shadowRays;
 
-				// Add the radiance to film sample
-				film->addSample(i, j, lambda);
-
-				// Update the pixel on screen
-				display->setPixel(i, j, film->getSample(i, j).getColorAveraged());
+		for (unsigned j = ya; j < ya + h; j++)
+		{
+			for (unsigned i0 = xa; i0 < xa + w; i0 += W)
+			{
+				const unsigned count = std::min(W, xa + w - i0);
+
+				RayPacket packet;
+				for (unsigned lane = 0; lane < count; lane++)
+				{
+					// Start the sample sequence of this pixel sample, keeps renders reproducible
+					sampler->startPixel(i0 + lane, j, film->getSample(i0 + lane, j).getNumSamples());
+
+					// Project the primary ray through the camera's lens
+					camera->calcCamRay(i0 + lane, j, r_primary, *sampler);
+
+					paths[lane].start(r_primary);
+					packet.set(lane, r_primary);
+					sampler->saveState(states[lane]);
+					iSects[lane] = Intersection();
+				}
+
+				// Camera rays are coherent, trace & shade their first vertex as a packet
+				shadowRays.clear();
+				if (m_maxRecursion > 0)
+				{
+					const int hits = scene->intersect(packet, iSects);
+					for (unsigned lane = 0; lane < count; lane++)
+					{
+						sampler->restoreState(states[lane]);
+						if (hits & (1 << lane))
+						{
+							shade(scene, paths[lane], iSects[lane], *sampler, &shadowRays, lane);
+						}
+						else
+						{
+							paths[lane].L += clampContribution(paths[lane].throughput * scene->getSkyColor());
+							paths[lane].active = false;
+						}
+						sampler->saveState(states[lane]);
+					}
+					connect(scene, shadowRays, paths);
+				}
+
+				for (unsigned lane = 0; lane < count; lane++)
+				{
+					// Past the first bounce the rays scatter, follow each path on its own
+					sampler->restoreState(states[lane]);
+					trace(scene, paths[lane], *sampler);
+
+					// Add the radiance to film sample
+					film->addSample(i0 + lane, j, paths[lane].L);
+
+					// Update the pixel on screen, if there is one
+					if (display)
+						display->setPixel(i0 + lane, j, film->getSample(i0 + lane, j).getColorAveraged());
+				}
 			}
 		}
 	}
 
-	vec3 Pathtracer::radiance(const Scene * const scene, const Ray &ray, const float weight, const int n)
+	vec3 Pathtracer::radiance(const Scene * const scene, const Ray &ray, Sampler &sampler) const
+	{
+		PathState path;
+		path.start(ray);
+		trace(scene, path, sampler);
+		return path.L;
+	}
+
+	void Pathtracer::trace(const Scene * const scene, PathState &path, Sampler &sampler) const
 	{
-		// Return if recursion limit was reached
-		if (n >= m_maxRecursion || weight <= 0.0f)
+		// Trace the path one vertex at a time, no recursion means no stack growth per bounce
+		while (path.active && path.depth < m_maxRecursion)
 		{
-			return COLOR_NULL;
+			// Find the closest intersection, escaped paths pick up the sky
+			Intersection iSect;
+			if (!scene->intersect(path.ray, iSect))
+			{
+				path.L += clampContribution(path.throughput * scene->getSkyColor());
+				path.active = false;
+				break;
+			}
+
+			shade(scene, path, iSect, sampler);
 		}
+	}
 
-		// Find the closest intersection
-		Intersection iSect;
-		if (!scene->getAccelerator()->intersect(ray, iSect))
+	void Pathtracer::connect(const Scene * const scene, const std::vector<ShadowRay> &shadowRays, PathState * const paths) const
+	{
+		// Shadow rays toward the same light from neighbouring points, test them a packet at a time
+		for (size_t k = 0; k < shadowRays.size(); k += RayPacket::WIDTH)
 		{
-			return weight * scene->getSkyColor();
+			const unsigned count = static_cast<unsigned>(std::min<size_t>(RayPacket::WIDTH, shadowRays.size() - k));
+
+			RayPacket packet;
+			for (unsigned lane = 0; lane < count; lane++)
+				packet.set(lane, shadowRays[k + lane].ray);
+
+			const int blocked = scene->intersectP(packet);
+			for (unsigned lane = 0; lane < count; lane++)
+			{
+				if (!(blocked & (1 << lane)))
+					paths[shadowRays[k + lane].path].L += shadowRays[k + lane].L;
+			}
 		}
+	}
 
+	void Pathtracer::shade(const Scene * const scene, PathState &path, const Intersection &iSect, Sampler &sampler, std::vector<ShadowRay> * const shadowQueue, const uint32_t pathIndex) const
+	{
 		// Get a pointer to the surface material
 		Material * const M = iSect.getMaterial();
 
@@ -65,43 +151,89 @@ namespace mirage
 		if (M->getKdText() != nullptr)
 			Kd *= M->getKdText()->sample(vec2(iSect.getTexcoord().x, iSect.getTexcoord().y));
 		//vec3 Ks = M->getKs();
-		vec3 Ke = M->getKe();
-
-		// Find the maximum reflectance amount
-		const float Kd_max = Kd.x > Kd.y && Kd.x > Kd.z ? Kd.x : Kd.y > Kd.z ? Kd.y : Kd.z;
-
-		// Russian roulette, absorb or continue
-		float p = pseudorand();
-		p = (p != 0.0f) ? p : 0.0001f;
-		p = (p != 1.0f) ? p : 0.9999f;
-		if (weight < p)
-		{
-			return (1.0f / p) * Ke;
-		}
+		const vec3 &Ke = M->getKe();
 
 		// Assign intersection data into aliases
-		const vec3 &Wo = ray.getDirection().negate();
+		const vec3 Wo = path.ray.getDirection().negate();
 		const vec3 &P = iSect.getPosition();
 		const vec3 &N = iSect.getNormal();
 
+		// Surface emission
+		path.L += clampContribution(path.throughput * Ke);
+
 		// Get the Wr & Wt vectors (reflected & transmitted)
 		vec3 Wr;
 		vec3 Wt;
-		M->evalWi(Wo, N, Wr, Wt);
+		M->evalWi(Wo, N, Wr, Wt, sampler);
+
+		// Direct light sampling, traced right away or left for the caller to batch
+		connectLights(scene, path, M, Kd, P, N, Wo, Wr, Wt, sampler, shadowQueue, pathIndex);
 
 		// Get the surface brdf & btdf function output values
-		float BRDF;
-		float BRDF_direct;
-		float BTDF = n;
-		float BTDF_direct = n;
-		M->evalBSDF(P, N, Wr, Wt, Wo, BRDF, BTDF);
+		float BRDF = 0.0f;
+		float BTDF = 0.0f;
+		M->evalBSDF(P, N, Wr, Wt, Wo, BRDF, BTDF, sampler);
+
+		// Follow a single lobe, picked in proportion to its weight when there are two
+		const bool hasWr = Wr.length() > 0.0f && BRDF > 0.0f;
+		const bool hasWt = Wt.length() > 0.0f && BTDF > 0.0f;
+		vec3 Wi;
+		float f;
+		if (hasWr && hasWt)
+		{
+			const float pr = BRDF / (BRDF + BTDF);
+			if (sampler.get1D() < pr)
+			{
+				Wi = Wr;
+				f = BRDF / pr;
+			}
+			else
+			{
+				Wi = Wt;
+				f = BTDF / (1.0f - pr);
+			}
+		}
+		else if (hasWr)
+		{
+			Wi = Wr;
+			f = BRDF;
+		}
+		else if (hasWt)
+		{
+			Wi = Wt;
+			f = BTDF;
+		}
+		else
+		{
+			path.active = false;
+			return;
+		}
 
-		// Get the surface pdf
+		// Get the surface pdf of the chosen direction
 		float PDF;
-		M->evalPDF(PDF);
+		M->evalPDF(N, Wi, PDF);
+
+		// Carry the lobe's weight in the path throughput
+		path.throughput *= Kd * (f / PDF);
+		path.ray = Ray(P, Wi);
+		path.depth++;
+
+		// Russian roulette on the throughput, survivors are scaled up to stay unbiased
+		if (path.depth >= RR_MIN_DEPTH)
+		{
+			const vec3 &T = path.throughput;
+			const float q = std::min(1.0f, T.x > T.y && T.x > T.z ? T.x : T.y > T.z ? T.y : T.z);
+			if (q <= 0.0f || sampler.get1D() >= q)
+			{
+				path.active = false;
+				return;
+			}
+			path.throughput *= 1.0f / q;
+		}
+	}
 
-		// Direct light sampling
-		vec3 Le;
+	void Pathtracer::connectLights(const Scene * const scene, PathState &path, const Material * const M, const vec3 &Kd, const vec3 &P, const vec3 &N, const vec3 &Wo, const vec3 &Wr, const vec3 &Wt, Sampler &sampler, std::vector<ShadowRay> * const shadowQueue, const uint32_t pathIndex) const
+	{
 		const std::vector<Light *> &lights = scene->getLights();
 		for (size_t i = 0; i < lights.size(); i++)
 		{
@@ -110,51 +242,40 @@ namespace mirage
 
 			// Calculate the We vector from P to L
 			vec3 We;
-			currlight->evalWe(P, N, Wo, We);
-
-			// Generate a shadow ray
-			Ray r_shadow(P, We, 0.0f, We.length() - EPSILON);
+			currlight->evalWe(P, N, Wo, We, sampler);
 
-			// Intersect the scene with it and add light contribution to Le if nothing was hit
-			if (!scene->intersectP(r_shadow))
-			{
-				// Create a temporary variable to hold the current Le
-				vec3 Ler;
+			// Get the light amount from We
+			vec3 Ler;
+			currlight->Le(P, N, We, Wo, Ler);
 
-				// Get the light amount from We
-				currlight->Le(P, N, We, Wo, Ler);
+			// Continue to next light if Ler is <= 0.0f
+			if (Ler.length() <= 0.0f)
+				continue;
 
-				// Continue to next light if Ler_ is <= 0.0f
-				if (Ler.length() <= 0.0f)
-					continue;
+			// Get the surface brdf & btdf
+			float BRDF_direct;
+			float BTDF_direct;
+			M->evalBSDF_direct(P, N, We.normalize(), Wr, Wt, Wo, BRDF_direct, BTDF_direct);
 
-				// Get the surface brdf & btdf
-				M->evalBSDF_direct(P, N, We.normalize(), Wr, Wt, Wo, BRDF_direct, BTDF_direct);
-
-				// Scale the current Le_ by BRDF_direct
-				Ler *= BRDF_direct;
-
-				// Add the Le_'s contribution to the total Le
-				Le += Ler;
-			}
-		}
+			// The radiance this light adds to the path if nothing blocks it
+			const vec3 L = clampContribution(path.throughput * Kd * (BRDF_direct * Ler));
+			if (L.x <= 0.0f && L.y <= 0.0f && L.z <= 0.0f)
+				continue;
 
-		// Get the light amount from Wr
-		vec3 Lr;
-		if (Wr.length() > 0.0f)
-		{
-			Lr = radiance(scene, Ray(P, Wr), weight * Kd_max, n + 1);
-		}
+			// Generate a shadow ray
+			ShadowRay shadow = { Ray(P, We, 0.0f, We.length() - EPSILON), L, pathIndex };
 
-		// Get the light amount from Wt
-		vec3 Lt;
-		if (Wt.length() > 0.0f)
-		{
-			Lt = radiance(scene, Ray(P, Wt), weight, n + 1);
+			// Either queue it, or intersect the scene with it and add the contribution if nothing was hit
+			if (shadowQueue)
+				shadowQueue->push_back(shadow);
+			else if (!scene->intersectP(shadow.ray))
+				path.L += shadow.L;
 		}
+	}
 
-		// Return the final radiance
-		return vec3::clampv((1.0f / (1.0f - p)) * Ke + Kd * (weight * Le + (BRDF / PDF) * Lr + (BTDF / PDF) * Lt), 0.0f, m_maxRadiance);
+	vec3 Pathtracer::clampContribution(const vec3 &L) const
+	{
+		return vec3::clampv(L, 0.0f, m_maxRadiance);
 	}
 
 }
@@ -2,22 +2,63 @@
 #define PATHTRACER_H
 
 // std includes
+#include <cstdint>
+#include <vector>
 
 // mirage includes
 #include "../core/renderer.h"
 #include "../math/math.h"
 #include "../math/vec3.h"
+#include "../core/ray.h"
+#include "../core/intersection.h"
+#include "../core/raypacket.h"
+#include "../core/material.h"
 
 namespace mirage
 {
 
+// Everything a path needs between two bounces, fixed size so it can live in a flat array
+struct PathState
+{
+    Ray ray;
+    vec3 throughput;
+    vec3 L;
+    int depth;
+    bool active;
+
+    void start(const Ray &r)
+    {
+        ray = r;
+        throughput = vec3(1.0f, 1.0f, 1.0f);
+        L = vec3();
+        depth = 0;
+        active = true;
+    }
+};
+
+// Light sample waiting on its visibility test, L is added to the path if it isn't blocked
+struct ShadowRay
+{
+    Ray ray;
+    vec3 L;
+    uint32_t path;
+};
+
 class Pathtracer : public virtual Renderer
 {
 public:
     Pathtracer(float maxRadiance = 10.0f, int maxRecursion = 1);
     virtual void render(const Scene * const scene, Display * const display, const unsigned w, const unsigned h, const unsigned xa, const unsigned ya) override;
-    vec3 radiance(const Scene * const scene, const Ray &ray, const float weight, const int n);
-private:
+    vec3 radiance(const Scene * const scene, const Ray &ray, Sampler &sampler) const;
+    void trace(const Scene * const scene, PathState &path, Sampler &sampler) const;
+    void connect(const Scene * const scene, const std::vector<ShadowRay> &shadowRays, PathState * const paths) const;
+    void shade(const Scene * const scene, PathState &path, const Intersection &iSect, Sampler &sampler, std::vector<ShadowRay> * const shadowQueue = nullptr, const uint32_t pathIndex = 0) const;
+    void connectLights(const Scene * const scene, PathState &path, const Material * const M, const vec3 &Kd, const vec3 &P, const vec3 &N, const vec3 &Wo, const vec3 &Wr, const vec3 &Wt, Sampler &sampler, std::vector<ShadowRay> * const shadowQueue, const uint32_t pathIndex) const;
+    vec3 clampContribution(const vec3 &L) const;
+protected:
+    // Bounces before russian roulette may terminate a path
+    static const int RR_MIN_DEPTH = 2;
+
     float m_maxRadiance;
     int m_maxRecursion;
 };
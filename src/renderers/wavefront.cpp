@@ -0,0 +1,141 @@
+// std includes
+#include <algorithm>
+#include <memory>
+
+// mirage includes
+#include "wavefront.h"
+#include "../macros.h"
+
+namespace mirage
+{
+
+	WavefrontPathtracer::WavefrontPathtracer(float maxRadiance, int maxRecursion) : Pathtracer(maxRadiance, maxRecursion)
+	{
+
+	}
+
+	void WavefrontPathtracer::render(const Scene * const scene, Display * const display, const unsigned w, const unsigned h, const unsigned xa, const unsigned ya)
+	{
+		Film * const film = &scene->getCamera()->getFilm();
+
+		// Every render call gets its own copy of the scene sampler, the paths take turns on it
+		std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+
+		// The render loop calls us from many threads, each keeps its own queues
+		static thread_local Queues queues;
+		Queues &q = queues;
+
+		// One path per pixel of the tile, all of them bounce in lockstep
+		generate(scene, q, *sampler, w, h, xa, ya);
+		while (!q.active.empty())
+		{
+			extend(scene, q);
+			shadeQueue(scene, q, *sampler);
+			connect(scene, q);
+			compact(q);
+		}
+
+		// Add the radiance of each finished path to its film sample
+		for (size_t p = 0; p < q.paths.size(); p++)
+		{
+			const unsigned i = xa + static_cast<unsigned>(p % w);
+			const unsigned j = ya + static_cast<unsigned>(p / w);
+			film->addSample(i, j, q.paths[p].L);
+
+			// Update the pixel on screen, if there is one
+			if (display)
+				display->setPixel(i, j, film->getSample(i, j).getColorAveraged());
+		}
+	}
+
+	void WavefrontPathtracer::generate(const Scene * const scene, Queues &q, Sampler &sampler, const unsigned w, const unsigned h, const unsigned xa, const unsigned ya) const
+	{
+		Camera * const camera = scene->getCamera();
+		Film * const film = &camera->getFilm();
+		const size_t count = static_cast<size_t>(w) * h;
+
+		q.paths.resize(count);
+		q.samplerStates.resize(count);
+		q.hits.resize(count);
+		q.active.clear();
+
+		Ray r_primary;
+		for (unsigned j = 0; j < h; j++)
+		{
+			for (unsigned i = 0; i < w; i++)
+			{
+				const uint32_t p = j * w + i;
+
+				// Start the sample sequence of this pixel sample, keeps renders reproducible
+				sampler.startPixel(xa + i, ya + j, film->getSample(xa + i, ya + j).getNumSamples());
+
+				// Project the primary ray through the camera's lens
+				camera->calcCamRay(xa + i, ya + j, r_primary, sampler);
+
+				q.paths[p].start(r_primary);
+				sampler.saveState(q.samplerStates[p]);
+				q.active.push_back(p);
+			}
+		}
+	}
+
+	void WavefrontPathtracer::extend(const Scene * const scene, Queues &q) const
+	{
+		Accelerator * const accel = scene->getAccelerator();
+
+		q.shadeQueue.clear();
+		for (size_t k = 0; k < q.active.size(); k++)
+		{
+			const uint32_t p = q.active[k];
+			PathState &path = q.paths[p];
+
+			// Find the closest intersection, escaped paths pick up the sky and finish
+			q.hits[p] = Intersection();
+			if (!accel->intersect(path.ray, q.hits[p]))
+			{
+				path.L += clampContribution(path.throughput * scene->getSkyColor());
+				path.active = false;
+				continue;
+			}
+
+			q.shadeQueue.push_back(std::make_pair(q.hits[p].getMaterial(), p));
+		}
+
+		// Group the hits by material so the shading stage runs the same code & data back to back
+		std::sort(q.shadeQueue.begin(), q.shadeQueue.end());
+	}
+
+	void WavefrontPathtracer::shadeQueue(const Scene * const scene, Queues &q, Sampler &sampler) const
+	{
+		q.shadowQueue.clear();
+		for (size_t k = 0; k < q.shadeQueue.size(); k++)
+		{
+			const uint32_t p = q.shadeQueue[k].second;
+
+			// Pick up the path's sample sequence where it left off
+			sampler.restoreState(q.samplerStates[p]);
+			shade(scene, q.paths[p], q.hits[p], sampler, &q.shadowQueue, p);
+			sampler.saveState(q.samplerStates[p]);
+		}
+	}
+
+	void WavefrontPathtracer::connect(const Scene * const scene, Queues &q) const
+	{
+		// Any-hit tests only, the contributions were computed while shading
+		Pathtracer::connect(scene, q.shadowQueue, q.paths.data());
+	}
+
+	void WavefrontPathtracer::compact(Queues &q) const
+	{
+		// Drop terminated paths, keeps the next extend stage dense
+		size_t n = 0;
+		for (size_t k = 0; k < q.active.size(); k++)
+		{
+			const PathState &path = q.paths[q.active[k]];
+			if (path.active && path.depth < m_maxRecursion)
+				q.active[n++] = q.active[k];
+		}
+		q.active.resize(n);
+	}
+
+}
@@ -0,0 +1,44 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+// std includes
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// mirage includes
+#include "pathtracer.h"
+
+namespace mirage
+{
+
+// Wavefront path tracer, every path of a tile advances one bounce per stage:
+// generate, extend (intersect), shade (sorted per material), connect (shadow rays), compact.
+// Same estimator as the Pathtracer, each stage just runs over a homogeneous queue.
+class WavefrontPathtracer : public Pathtracer
+{
+public:
+    WavefrontPathtracer(float maxRadiance = 10.0f, int maxRecursion = 1);
+    virtual void render(const Scene * const scene, Display * const display, const unsigned w, const unsigned h, const unsigned xa, const unsigned ya) override;
+private:
+    // Per-thread queues, kept between calls so a tile doesn't reallocate them
+    struct Queues
+    {
+        std::vector<PathState> paths;
+        std::vector<SamplerState> samplerStates;
+        std::vector<Intersection> hits;
+        std::vector<uint32_t> active;
+        std::vector<std::pair<const Material *, uint32_t>> shadeQueue;
+        std::vector<ShadowRay> shadowQueue;
+    };
+
+    void generate(const Scene * const scene, Queues &q, Sampler &sampler, const unsigned w, const unsigned h, const unsigned xa, const unsigned ya) const;
+    void extend(const Scene * const scene, Queues &q) const;
+    void shadeQueue(const Scene * const scene, Queues &q, Sampler &sampler) const;
+    void connect(const Scene * const scene, Queues &q) const;
+    void compact(Queues &q) const;
+};
+
+}
+
+#endif // WAVEFRONT_H
@@ -0,0 +1,76 @@
+// mirage includes
+#include "halton.h"
+#include "../math/rng.h"
+
+namespace mirage
+{
+
+	static const uint32_t HALTON_PRIMES[] =
+	{
+		2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+		59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+		137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+		227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311
+	};
+	static const uint32_t HALTON_DIMENSIONS = sizeof(HALTON_PRIMES) / sizeof(*HALTON_PRIMES);
+
+	static float radicalInverse(const uint32_t base, uint32_t i)
+	{
+		const float invBase = 1.0f / base;
+		float invBaseN = 1.0f;
+		uint32_t reversed = 0;
+
+		// Accumulate the mirrored digits in integer form until they no longer fit in float precision
+		while (i > 0 && invBaseN * invBase > 1e-7f)
+		{
+			const uint32_t next = i / base;
+			reversed = reversed * base + (i - next * base);
+			invBaseN *= invBase;
+			i = next;
+		}
+
+		return std::min(reversed * invBaseN, 0.99999994f);
+	}
+
+	HaltonSampler::HaltonSampler(const uint32_t samplesPerPixel) : Sampler(samplesPerPixel)
+	{
+
+	}
+
+	float HaltonSampler::get1D()
+	{
+		return sample(m_dimension++);
+	}
+
+	vec2 HaltonSampler::get2D()
+	{
+		float u = sample(m_dimension++);
+		float v = sample(m_dimension++);
+		return vec2(u, v);
+	}
+
+	Sampler * HaltonSampler::clone() const
+	{
+		return new HaltonSampler(*this);
+	}
+
+	float HaltonSampler::sample(const uint32_t dimension) const
+	{
+		// Per pixel & dimension toroidal shift
+		const float offset = (pixelSeed(dimension) >> 8) * (1.0f / 16777216.0f);
+
+		float u;
+		if (dimension < HALTON_DIMENSIONS)
+		{
+			u = radicalInverse(HALTON_PRIMES[dimension], m_sampleIndex);
+		}
+		else
+		{
+			u = (randomuint(dimension) >> 8) * (1.0f / 16777216.0f);
+		}
+
+		u += offset;
+		return (u >= 1.0f) ? u - 1.0f : u;
+	}
+
+}
@@ -0,0 +1,26 @@
+#ifndef HALTON_H
+#define HALTON_H
+
+// mirage includes
+#include "../core/sampler.h"
+
+namespace mirage
+{
+
+	// Halton sequence, dimension i uses the i:th prime as its base. Each pixel
+	// gets its own Cranley-Patterson rotation of the sequence, dimensions past
+	// the prime table fall back to random numbers.
+	class HaltonSampler : public virtual Sampler
+	{
+	public:
+		HaltonSampler(const uint32_t samplesPerPixel = 1);
+		virtual float get1D() override;
+		virtual vec2 get2D() override;
+		virtual Sampler * clone() const override;
+	private:
+		float sample(const uint32_t dimension) const;
+	};
+
+}
+
+#endif // HALTON_H
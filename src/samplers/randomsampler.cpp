@@ -0,0 +1,32 @@
+// mirage includes
+#include "randomsampler.h"
+#include "../math/rng.h"
+
+namespace mirage
+{
+
+	RandomSampler::RandomSampler(const uint32_t samplesPerPixel) : Sampler(samplesPerPixel)
+	{
+
+	}
+
+	float RandomSampler::get1D()
+	{
+		m_dimension++;
+		return randomfloat();
+	}
+
+	vec2 RandomSampler::get2D()
+	{
+		m_dimension += 2;
+		float u = randomfloat();
+		float v = randomfloat();
+		return vec2(u, v);
+	}
+
+	Sampler * RandomSampler::clone() const
+	{
+		return new RandomSampler(*this);
+	}
+
+}
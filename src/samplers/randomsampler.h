@@ -0,0 +1,21 @@
+#ifndef RANDOMSAMPLER_H
+#define RANDOMSAMPLER_H
+
+// mirage includes
+#include "../core/sampler.h"
+
+namespace mirage
+{
+
+	class RandomSampler : public virtual Sampler
+	{
+	public:
+		RandomSampler(const uint32_t samplesPerPixel = 1);
+		virtual float get1D() override;
+		virtual vec2 get2D() override;
+		virtual Sampler * clone() const override;
+	};
+
+}
+
+#endif // RANDOMSAMPLER_H
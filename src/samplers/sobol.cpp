@@ -0,0 +1,94 @@
+// mirage includes
+#include "sobol.h"
+#include "../math/rng.h"
+
+namespace mirage
+{
+
+	static inline uint32_t reverseBits(uint32_t x)
+	{
+		x = (x << 16) | (x >> 16);
+		x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+		x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+		x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+		x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+		return x;
+	}
+
+	static inline uint32_t laineKarrasPermutation(uint32_t x, const uint32_t seed)
+	{
+		x += seed;
+		x ^= x * 0x6c50b47cu;
+		x ^= x * 0xb82f1e52u;
+		x ^= x * 0xc7afe638u;
+		x ^= x * 0x8d22f6e6u;
+		return x;
+	}
+
+	static inline uint32_t nestedUniformScramble(uint32_t x, const uint32_t seed)
+	{
+		x = reverseBits(x);
+		x = laineKarrasPermutation(x, seed);
+		x = reverseBits(x);
+		return x;
+	}
+
+	static inline uint32_t hashCombine(const uint32_t seed, const uint32_t v)
+	{
+		return seed ^ (v + (seed << 6) + (seed >> 2));
+	}
+
+	// Sobol dimension 0 is the van der Corput sequence
+	static inline uint32_t sobol0(const uint32_t i)
+	{
+		return reverseBits(i);
+	}
+
+	// Sobol dimension 1, direction numbers of the primitive polynomial x + 1
+	static inline uint32_t sobol1(uint32_t i)
+	{
+		uint32_t result = 0;
+		uint32_t v = 1u << 31;
+		for (; i; i >>= 1, v ^= v >> 1)
+		{
+			if (i & 1)
+				result ^= v;
+		}
+		return result;
+	}
+
+	static inline float toFloat(const uint32_t x)
+	{
+		return (x >> 8) * (1.0f / 16777216.0f);
+	}
+
+	SobolSampler::SobolSampler(const uint32_t samplesPerPixel) : Sampler(samplesPerPixel)
+	{
+
+	}
+
+	float SobolSampler::get1D()
+	{
+		const uint32_t seed = pixelSeed(m_dimension++);
+		const uint32_t index = nestedUniformScramble(m_sampleIndex, seed);
+
+		return toFloat(nestedUniformScramble(sobol0(index), hashCombine(seed, 0)));
+	}
+
+	vec2 SobolSampler::get2D()
+	{
+		const uint32_t seed = pixelSeed(m_dimension);
+		const uint32_t index = nestedUniformScramble(m_sampleIndex, seed);
+		m_dimension += 2;
+
+		const float u = toFloat(nestedUniformScramble(sobol0(index), hashCombine(seed, 0)));
+		const float v = toFloat(nestedUniformScramble(sobol1(index), hashCombine(seed, 1)));
+		return vec2(u, v);
+	}
+
+	Sampler * SobolSampler::clone() const
+	{
+		return new SobolSampler(*this);
+	}
+
+}
@@ -0,0 +1,25 @@
+#ifndef SOBOL_H
+#define SOBOL_H
+
+// mirage includes
+#include "../core/sampler.h"
+
+namespace mirage
+{
+
+	// Shuffled & Owen scrambled Sobol sequence, Brent Burley, "Practical
+	// Hash-based Owen Scrambling" (JCGT 2020). Every 1D / 2D request uses the
+	// first two Sobol dimensions with its own shuffle & scramble seed, so
+	// there is no limit on the path length.
+	class SobolSampler : public virtual Sampler
+	{
+	public:
+		SobolSampler(const uint32_t samplesPerPixel = 1);
+		virtual float get1D() override;
+		virtual vec2 get2D() override;
+		virtual Sampler * clone() const override;
+	};
+
+}
+
+#endif // SOBOL_H
@@ -0,0 +1,88 @@
+// std includes
+#include <cmath>
+
+// mirage includes
+#include "stratified.h"
+#include "../math/rng.h"
+
+namespace mirage
+{
+
+	// Andrew Kensler, "Correlated Multi-Jittered Sampling", permutes i within [0, l)
+	static uint32_t permute(uint32_t i, const uint32_t l, const uint32_t p)
+	{
+		uint32_t w = l - 1;
+		w |= w >> 1;
+		w |= w >> 2;
+		w |= w >> 4;
+		w |= w >> 8;
+		w |= w >> 16;
+
+		do
+		{
+			i ^= p;
+			i *= 0xe170893d;
+			i ^= p >> 16;
+			i ^= (i & w) >> 4;
+			i ^= p >> 8;
+			i *= 0x0929eb3f;
+			i ^= p >> 23;
+			i ^= (i & w) >> 1;
+			i *= 1 | p >> 27;
+			i *= 0x6935fa69;
+			i ^= (i & w) >> 11;
+			i *= 0x74dcb303;
+			i ^= (i & w) >> 2;
+			i *= 0x9e501cc3;
+			i ^= (i & w) >> 2;
+			i *= 0xc860a3df;
+			i &= w;
+			i ^= i >> 5;
+		} while (i >= l);
+
+		return (i + p) % l;
+	}
+
+	StratifiedSampler::StratifiedSampler(const uint32_t samplesPerPixel) : Sampler(samplesPerPixel)
+	{
+		// 2D strata form the most square grid that has at least samplesPerPixel cells
+		m_strataX = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(m_samplesPerPixel))));
+		m_strataY = (m_samplesPerPixel + m_strataX - 1) / m_strataX;
+	}
+
+	float StratifiedSampler::get1D()
+	{
+		const uint32_t seed = pixelSeed(m_dimension++);
+		const uint32_t s = stratum(m_samplesPerPixel, seed);
+		const float jitter = (static_cast<uint32_t>(randomhash(seed ^ (static_cast<uint64_t>(m_sampleIndex) << 32)) >> 40)) * (1.0f / 16777216.0f);
+
+		return (s + jitter) / m_samplesPerPixel;
+	}
+
+	vec2 StratifiedSampler::get2D()
+	{
+		const uint32_t seed = pixelSeed(m_dimension);
+		m_dimension += 2;
+
+		const uint32_t count = m_strataX * m_strataY;
+		const uint32_t s = stratum(count, seed);
+		const uint64_t h = randomhash(seed ^ (static_cast<uint64_t>(m_sampleIndex) << 32));
+		const float jx = static_cast<uint32_t>(h >> 40) * (1.0f / 16777216.0f);
+		const float jy = static_cast<uint32_t>((h >> 8) & 0xFFFFFF) * (1.0f / 16777216.0f);
+
+		return vec2(((s % m_strataX) + jx) / m_strataX, ((s / m_strataX) + jy) / m_strataY);
+	}
+
+	Sampler * StratifiedSampler::clone() const
+	{
+		return new StratifiedSampler(*this);
+	}
+
+	uint32_t StratifiedSampler::stratum(const uint32_t count, const uint32_t seed) const
+	{
+		// Every full round of samples visits all strata once, each round in a new order
+		const uint32_t round = m_sampleIndex / count;
+		return permute(m_sampleIndex % count, count, seed ^ static_cast<uint32_t>(randomhash(round)));
+	}
+
+}
@@ -0,0 +1,27 @@
+#ifndef STRATIFIED_H
+#define STRATIFIED_H
+
+// mirage includes
+#include "../core/sampler.h"
+
+namespace mirage
+{
+
+	// Jittered stratification, samplesPerPixel strata per dimension. The strata
+	// are visited in a different random order for every pixel & dimension.
+	class StratifiedSampler : public virtual Sampler
+	{
+	public:
+		StratifiedSampler(const uint32_t samplesPerPixel = 16);
+		virtual float get1D() override;
+		virtual vec2 get2D() override;
+		virtual Sampler * clone() const override;
+	private:
+		uint32_t stratum(const uint32_t count, const uint32_t seed) const;
+		uint32_t m_strataX;
+		uint32_t m_strataY;
+	};
+
+}
+
+#endif // STRATIFIED_H
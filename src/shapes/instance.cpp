@@ -0,0 +1,132 @@
+#include "instance.h"
+
+// std includes
+#include <iostream>
+
+// mirage includes
+#include "../macros.h"
+
+namespace mirage
+{
+
+	// Bounds of all eight corners of a box after m, AABB's own operator only moves two of them
+	static AABB transformBound(const AABB &box, const mat4 &m)
+	{
+		const vec3 &lo = box.getMin();
+		const vec3 &hi = box.getMax();
+
+		AABB result;
+		for (int i = 0; i < 8; i++)
+		{
+			const vec4 corner = m * vec4((i & 1) ? hi.x : lo.x, (i & 2) ? hi.y : lo.y, (i & 4) ? hi.z : lo.z, 1.0f);
+			const vec3 p(corner.x, corner.y, corner.z);
+			result = i == 0 ? AABB(p, p) : result.addPoint(p);
+		}
+
+		return result;
+	}
+
+	Instance::Instance(const Transform o2w, Mesh * mesh) : Shape(o2w, nullptr), m_mesh(mesh), m_accelerator(mesh->getAccelerator())
+	{
+		m_mesh->addInstance(this);
+
+		update();
+	}
+
+	void Instance::update()
+	{
+		if (m_objToWorld.reqStateUpdate())
+		{
+			// Either this instance or the mesh below it moved
+			m_mesh->updateAccelerator();
+			m_objectBound = m_mesh->getAcceleratorBound();
+
+			m_objToWorldMatrix = m_objToWorld.getMatrix();
+			m_worldToObjMatrix = m_objToWorldMatrix.inverse();
+			m_worldBound = transformBound(m_objectBound, m_objToWorldMatrix);
+			m_objToWorld.setState(false);
+		}
+	}
+
+	AABB Instance::objectBound() const
+	{
+		return m_objectBound;
+	}
+
+	AABB Instance::worldBound() const
+	{
+		return m_worldBound;
+	}
+
+	Ray Instance::toObject(const Ray &ray, float &scale) const
+	{
+		// Ray directions are normalized, scale converts distances along the world ray to the object ray
+		const vec3 o = ray.getOrigin();
+		const vec4 origin = m_worldToObjMatrix * vec4(o.x, o.y, o.z, 1.0f);
+		const vec3 direction = m_worldToObjMatrix * ray.getDirection();
+		scale = direction.length();
+
+		return Ray(vec3(origin.x, origin.y, origin.z), direction, ray.mint * scale, ray.maxt * scale);
+	}
+
+	bool Instance::intersect(const Ray &ray, Hit &hit) const
+	{
+		// Only hits closer than the best so far are of interest, the mesh hierarchy can skip the rest
+		Ray bounded = ray;
+		bounded.maxt = hit.t;
+
+		float scale;
+		const Ray object = toObject(bounded, scale);
+		Hit inner(object.maxt);
+		if (!m_accelerator->intersect(object, inner))
+		{
+			return false;
+		}
+
+		// The hit counts as long as it's still closer in world distances
+		const float t = inner.t / scale;
+		if (t >= hit.t)
+		{
+			return false;
+		}
+
+		hit.t = t;
+		hit.u = inner.u;
+		hit.v = inner.v;
+		hit.innerPrim = inner.prim;
+
+		return true;
+	}
+
+	void Instance::getIntersection(const Ray &ray, const Hit &hit, Intersection &iSect) const
+	{
+		// The mesh fills in its surface data in its own space
+		float scale;
+		const Ray object = toObject(ray, scale);
+		Hit inner(hit.t * scale);
+		inner.u = hit.u;
+		inner.v = hit.v;
+		inner.prim = hit.innerPrim;
+		m_accelerator->getIntersection(object, inner, iSect);
+
+		// Normals go back through the inverse transpose, which keeps them perpendicular under non-uniform scales
+		mat4 normalMatrix = m_worldToObjMatrix;
+		normalMatrix = normalMatrix.transpose();
+
+		iSect.setT(hit.t);
+		iSect.setPosition(ray(hit.t));
+		iSect.setNormal((normalMatrix * iSect.getNormal()).normalize());
+	}
+
+	bool Instance::intersectP(const Ray &ray) const
+	{
+		float scale;
+		return m_accelerator->intersectP(toObject(ray, scale));
+	}
+
+	float Instance::getSurfaceArea() const
+	{
+		return 0.0f;
+	}
+
+}
@@ -0,0 +1,46 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+// mirage includes
+#include "../core/shape.h"
+#include "../core/accelerator.h"
+#include "../math/mat4.h"
+#include "mesh.h"
+
+namespace mirage
+{
+
+	// ---------------------------------------------------------------------------
+	// Instance
+	// One more placement of a loaded mesh. The mesh's triangles & hierarchy are
+	// shared by all of its instances, an instance only stores its transform,
+	// which is applied on top of the mesh's own. Rays are moved into the mesh's
+	// space instead of the triangles into the world, so the scene accelerator
+	// over the instances and the mesh hierarchies below them form two levels.
+	// Moving the mesh refits its hierarchy & flags every instance to update.
+	// ---------------------------------------------------------------------------
+	class Instance : public Shape
+	{
+	public:
+		Instance(const Transform o2w, Mesh * mesh);
+		virtual void update() override;
+		virtual AABB objectBound() const override;
+		virtual AABB worldBound() const override;
+		virtual bool intersect(const Ray &ray, Hit &hit) const override;
+		virtual void getIntersection(const Ray &ray, const Hit &hit, Intersection &iSect) const override;
+		virtual bool intersectP(const Ray &ray) const override;
+		virtual float getSurfaceArea() const override;
+	private:
+		Ray toObject(const Ray &ray, float &scale) const;
+
+		Mesh * m_mesh;
+		Accelerator * m_accelerator;
+		AABB m_objectBound;
+		AABB m_worldBound;
+		mat4 m_objToWorldMatrix;
+		mat4 m_worldToObjMatrix;
+	};
+
+}
+
+#endif // INSTANCE_H
@@ -7,16 +7,42 @@
 #include <algorithm>
 #include <regex>
 #include <functional>
+#include <unordered_map>
 
 // mirage includes
 #include "../macros.h"
 #include "../utils/strutils.h"
 #include "../core/wavefrontfile.h"
+#include "../accelerators/bvh.h"
 
 namespace mirage
 {
 
-	Mesh::Mesh(const Transform o2w, Material *m, ObjFactory *objFactory, std::string fileName) : Shape(o2w, m), m_objFactory(objFactory)
+	// The .obj indices of one face corner, corners with the same ones share a vertex
+	struct MeshVertexKey
+	{
+		int point;
+		int normal;
+		int texcoord;
+
+		bool operator==(const MeshVertexKey &other) const
+		{
+			return point == other.point && normal == other.normal && texcoord == other.texcoord;
+		}
+	};
+
+	struct MeshVertexKeyHash
+	{
+		std::size_t operator()(const MeshVertexKey &key) const
+		{
+			std::size_t hash = static_cast<std::size_t>(key.point) * 73856093u;
+			hash ^= static_cast<std::size_t>(key.normal) * 19349663u;
+			hash ^= static_cast<std::size_t>(key.texcoord) * 83492791u;
+			return hash;
+		}
+	};
+
+	Mesh::Mesh(const Transform o2w, Material *m, ObjFactory *objFactory, std::string fileName) : Shape(o2w, m), m_objFactory(objFactory), m_accelerator(nullptr), m_accelStale(false)
 	{
 		if (!m_objFactory)
 		{
@@ -39,6 +65,18 @@ namespace mirage
 			auto & meshes = file.getMeshes();
 			auto & materials = file.getMaterials();
 
+			if (points.empty())
+			{
+				ERR("Mesh::Mesh - WavefrontMaterial - Point vectors empty! Critical error converting .obj model to mesh.");
+			}
+			if (normals.empty())
+			{
+				ERR("Mesh::Mesh - WavefrontMaterial - Normal vectors empty! Critical error converting .obj model to mesh.");
+			}
+
+			// Face corners that repeat the same point, normal & texcoord are stored once
+			std::unordered_map<MeshVertexKey, uint32_t, MeshVertexKeyHash> loadedVertices;
+
 			// Extract the shapes from the model
 			for (auto const & mesh : meshes)
 			{
@@ -47,37 +85,25 @@ namespace mirage
 
 				for (auto const & face : mesh.second.faces)
 				{
-					// Create the vertices for our triangle
-					std::array<Vertex, 3> verts;
-
-					// Assign values
-					if (!points.empty())
+					// Find or add the vertices of our triangle
+					uint32_t corners[3];
+					for (int i = 0; i < 3; i++)
 					{
-						verts[0].setPosition(points[face.points[0]]);
-						verts[1].setPosition(points[face.points[1]]);
-						verts[2].setPosition(points[face.points[2]]);
-					}
-					else
-					{
-						ERR("Mesh::Mesh - WavefrontMaterial - Point vectors empty! Critical error converting .obj model to mesh.");
-					}
-
-					if (!normals.empty())
-					{
-						verts[0].setNormal(normals[face.normals[0]]);
-						verts[1].setNormal(normals[face.normals[1]]);
-						verts[2].setNormal(normals[face.normals[2]]);
-					}
-					else
-					{
-						ERR("Mesh::Mesh - WavefrontMaterial - Normal vectors empty! Critical error converting .obj model to mesh.");
-					}
+						const MeshVertexKey key = {
+							points.empty() ? -1 : face.points[i],
+							normals.empty() ? -1 : face.normals[i],
+							texcoords.empty() ? -1 : face.texcoords[i]
+						};
 
-					if (!texcoords.empty())
-					{
-						verts[0].setTexcoord(texcoords[face.texcoords[0]]);
-						verts[1].setTexcoord(texcoords[face.texcoords[1]]);
-						verts[2].setTexcoord(texcoords[face.texcoords[2]]);
+						auto found = loadedVertices.find(key);
+						if (found == loadedVertices.end())
+						{
+							const vec3 p = key.point < 0 ? vec3() : points[key.point];
+							const vec3 n = key.normal < 0 ? vec3() : normals[key.normal].normalize();
+							const vec2 t = key.texcoord < 0 ? vec2() : texcoords[key.texcoord];
+							found = loadedVertices.emplace(key, m_data.addVertex(p, n, t)).first;
+						}
+						corners[i] = found->second;
 					}
 
 					// Get current face material properties if they differ from previous and if the wf material exists
@@ -126,9 +152,14 @@ namespace mirage
 					}
 
 					// Push our triangle to the vector
-					m_triangles.push_back(Triangle(m_objToWorld, loadedMaterials[face.material], verts));
+					const uint32_t index = m_data.addTriangle(corners[0], corners[1], corners[2]);
+					m_triangles.push_back(Triangle(m_objToWorld, loadedMaterials[face.material], &m_data, index));
 				}
 			}
+
+			// Place the shared vertices, the triangles read them from here on
+			m_data.setTransform(m_objToWorld);
+			m_data.update();
 		}
 		else
 		{
@@ -136,7 +167,12 @@ namespace mirage
 			std::exit(1);
 		}
 
-		LOG("Mesh::Mesh - Loaded mesh successfully! Number of triangles: " << m_triangles.size());
+		LOG("Mesh::Mesh - Loaded mesh successfully! Number of triangles: " << m_triangles.size() << ", vertices: " << m_data.getVertexCount() << ", " << (m_data.getMemoryUsage() + m_triangles.size() * sizeof(Triangle)) / 1024 << " KiB.");
+	}
+
+	Mesh::~Mesh()
+	{
+		DELETE(m_accelerator);
 	}
 
 	void Mesh::update()
@@ -147,6 +183,25 @@ namespace mirage
 			{
 				m_triangles[i].update();
 			}
+			m_objToWorld.setState(false);
+		}
+	}
+
+	void Mesh::setTransform(const Transform &o2w)
+	{
+		Shape::setTransform(o2w);
+		m_data.setTransform(o2w);
+
+		for (size_t i = 0; i < m_triangles.size(); i++)
+		{
+			m_triangles[i].setTransform(o2w);
+		}
+
+		// The instances sit on top of the moved triangles, they refit the shared hierarchy on their next update
+		m_accelStale = m_accelerator != nullptr;
+		for (size_t i = 0; i < m_instances.size(); i++)
+		{
+			m_instances[i]->setTransform(m_instances[i]->getTransform());
 		}
 	}
 
@@ -162,12 +217,17 @@ namespace mirage
 		return AABB();
 	}
 
-	bool Mesh::intersect(const Ray &ray, Intersection &iSect) const
+	bool Mesh::intersect(const Ray &ray, Hit &hit) const
 	{
 		ERR("Called unimplemented method Mesh::intersect!");
 		return false;
 	}
 
+	void Mesh::getIntersection(const Ray &ray, const Hit &hit, Intersection &iSect) const
+	{
+		ERR("Called unimplemented method Mesh::getIntersection!");
+	}
+
 	bool Mesh::intersectP(const Ray &ray) const
 	{
 		ERR("Called unimplemented method Mesh::intersectP!");
@@ -190,4 +250,45 @@ namespace mirage
 		return result;
 	}
 
+	Accelerator * Mesh::getAccelerator()
+	{
+		// Built on first use & shared by every Instance of the mesh, over the triangles as the mesh's own transform placed them
+		if (!m_accelerator)
+		{
+			m_accelerator = new BVHAccel(getShapes(), BVHBuildParams(BVH_SPLIT_SAH, 4));
+			m_accelerator->init();
+			m_accelBound = m_accelerator->worldBound();
+		}
+
+		return m_accelerator;
+	}
+
+	AABB Mesh::getAcceleratorBound() const
+	{
+		return m_accelBound;
+	}
+
+	void Mesh::addInstance(Shape * instance)
+	{
+		m_instances.push_back(instance);
+	}
+
+	void Mesh::updateAccelerator()
+	{
+		// Every instance of a moved mesh calls this, possibly from several threads, only the first refits
+		if (!m_accelStale.load(std::memory_order_acquire))
+			return;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_accelStale.load(std::memory_order_relaxed))
+			return;
+
+		// The triangles' own flags are left alone, the scene accelerator still needs them if the mesh is also added to it
+		m_data.update();
+		m_accelerator->refit();
+		m_accelBound = m_accelerator->worldBound();
+
+		m_accelStale.store(false, std::memory_order_release);
+	}
+
 }
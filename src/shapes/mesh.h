@@ -4,6 +4,8 @@
 // std includes
 #include <string>
 #include <map>
+#include <mutex>
+#include <atomic>
 
 // mirage includes
 #include "../core/shape.h"
@@ -16,20 +18,36 @@
 namespace mirage
 {
 
-	class Mesh : public virtual Shape
+	class Accelerator;
+	class BVHAccel;
+
+	class Mesh : public Shape
 	{
 	public:
 		Mesh(const Transform o2w, Material * m = nullptr, ObjFactory * objFactory = nullptr, std::string fileName = "null");
+		~Mesh();
 		virtual void update() override;
+		virtual void setTransform(const Transform &o2w) override;
 		virtual AABB objectBound() const override;
 		virtual AABB worldBound() const override;
-		virtual bool intersect(const Ray &ray, Intersection &iSect) const override;
+		virtual bool intersect(const Ray &ray, Hit &hit) const override;
+		virtual void getIntersection(const Ray &ray, const Hit &hit, Intersection &iSect) const override;
 		virtual bool intersectP(const Ray &ray) const override;
 		virtual float getSurfaceArea() const override;
 		std::vector<Shape *> getShapes();
+		Accelerator * getAccelerator();
+		AABB getAcceleratorBound() const;
+		void addInstance(Shape * instance);
+		void updateAccelerator();
 	private:
 		ObjFactory * m_objFactory;
+		TriangleMesh m_data;
 		std::vector<Triangle> m_triangles;
+		BVHAccel * m_accelerator;
+		AABB m_accelBound;
+		std::vector<Shape *> m_instances;
+		std::mutex m_mutex;
+		std::atomic<bool> m_accelStale;
 	};
 
 }
@@ -1,5 +1,6 @@
 // std includes
 #include <iostream>
+#include <algorithm>
 
 // mirage includes
 #include "sphere.h"
@@ -21,6 +22,7 @@ void Sphere::update()
         vec4 c_t = m_objToWorld.getMatrix() * c_i;
         m_centerTransformed = vec3(c_t.x, c_t.y, c_t.z);
         m_radiusTransformed = m_objToWorld.getScale().x * m_radiusInit;
+        m_objToWorld.setState(false);
     }
 }
 
@@ -34,78 +36,23 @@ AABB Sphere::worldBound() const
     return objectBound() * m_objToWorld.getMatrix();
 }
 
-bool Sphere::intersect(const Ray &ray, Intersection &iSect) const
+bool Sphere::intersect(const Ray &ray, Hit &hit) const
 {
-    vec3 C, SP;
-    float r, b, d, t;
-
-    // Get sphere center in world space
-    C = m_centerTransformed;
-
-    // Transform ray origin to object space
-    SP = C - ray.getOrigin();
-
-    // Get transformed radius
-    r = m_radiusTransformed;
-
-    // Solve the quadratic equation for t
-    b = vec3::dot(SP, ray.getDirection());
-    d = b * b - vec3::dot(SP, SP) + r * r;
-
-    if (d < 0.0f)
-    {
-        return false;
-    }
-
-    d = std::sqrt(d);
-    t = (t = b - d) > EPSILON ? t : ((t = b + d) > EPSILON ? t : -1.0f);
-
-    if (t == -1.0f)
-    {
-        return false;
-    }
+    return intersectSphere(m_centerTransformed, m_radiusTransformed, ray, hit);
+}
 
+void Sphere::getIntersection(const Ray &ray, const Hit &hit, Intersection &iSect) const
+{
     // Set final surface intersection info
-    iSect.setT(t);
-    iSect.setPosition(ray(t));
-    iSect.setNormal((iSect.getPosition() - C) / r);
+    iSect.setT(hit.t);
+    iSect.setPosition(ray(hit.t));
+    iSect.setNormal((iSect.getPosition() - m_centerTransformed) / m_radiusTransformed);
     iSect.setMaterial(m_material);
-
-    return true;
 }
 
 bool Sphere::intersectP(const Ray &ray) const
 {
-    vec3 C, SP;
-    float r, b, d, t;
-
-    // Get sphere center in world space
-    C = m_centerTransformed;
-
-    // Transform ray origin to object space
-    SP = C - ray.getOrigin();
-
-    // Get transformed radius
-    r = m_radiusTransformed;
-
-    // Solve the quadratic equation for t
-    b = vec3::dot(SP, ray.getDirection());
-    d = b * b - vec3::dot(SP, SP) + r * r;
-
-    if (d < 0.0f)
-    {
-        return false;
-    }
-
-    d = std::sqrt(d);
-    t = (t = b - d) > EPSILON ? t : ((t = b + d) > EPSILON ? t : -1.0f);
-
-    if (t == -1.0f)
-    {
-        return false;
-    }
-
-    return true;
+    return intersectSphereP(m_centerTransformed, m_radiusTransformed, ray);
 }
 
 float Sphere::getSurfaceArea() const
@@ -113,6 +60,11 @@ float Sphere::getSurfaceArea() const
     return 4.0f * PI * m_radiusTransformed * m_radiusTransformed;
 }
 
+ShapeType Sphere::getType() const
+{
+    return SHAPE_SPHERE;
+}
+
 vec3 Sphere::getCenterInit() const
 {
     return m_centerInit;
@@ -1,22 +1,30 @@
 #ifndef SPHERE_H
 #define SPHERE_H
 
+// std includes
+#include <cmath>
+#include <algorithm>
+
 // mirage includes
 #include "../core/shape.h"
 
 namespace mirage
 {
 
-class Sphere : public virtual Shape
+class Sphere : public Shape
 {
 public:
     Sphere(const Transform o2w, Material *m = nullptr, vec3 c = vec3(), float r = 1.0f);
     virtual void update() override;
     virtual AABB objectBound() const override;
     virtual AABB worldBound() const override;
-    virtual bool intersect(const Ray &ray, Intersection &iSect) const override;
+    virtual bool intersect(const Ray &ray, Hit &hit) const override;
+    virtual void getIntersection(const Ray &ray, const Hit &hit, Intersection &iSect) const override;
     virtual bool intersectP(const Ray &ray) const override;
     virtual float getSurfaceArea() const override;
+    virtual ShapeType getType() const override;
+    static inline bool intersectSphere(const vec3 &C, const float r, const Ray &ray, Hit &hit);
+    static inline bool intersectSphereP(const vec3 &C, const float r, const Ray &ray);
     vec3 getCenterInit() const;
     vec3 getCenterTransformed() const;
     float getRadiusInit() const;
@@ -29,6 +37,74 @@ private:
 protected:
 };
 
+// Ray against a sphere of radius r around C in world space, inline so accelerators can test spheres without a virtual call
+inline bool Sphere::intersectSphere(const vec3 &C, const float r, const Ray &ray, Hit &hit)
+{
+    vec3 SP;
+    float b, d, t;
+
+    // Transform ray origin to object space
+    SP = C - ray.getOrigin();
+
+    // Solve the quadratic equation for t
+    b = vec3::dot(SP, ray.getDirection());
+    d = b * b - vec3::dot(SP, SP) + r * r;
+
+    if (d < 0.0f)
+    {
+        return false;
+    }
+
+    // The far root counts when the near one lies before the ray's interval
+    d = std::sqrt(d);
+    const float tmin = std::max(ray.mint, EPSILON);
+    t = b - d;
+    if (t <= tmin)
+    {
+        t = b + d;
+    }
+
+    if (t <= tmin || t >= hit.t)
+    {
+        return false;
+    }
+
+    hit.t = t;
+
+    return true;
+}
+
+inline bool Sphere::intersectSphereP(const vec3 &C, const float r, const Ray &ray)
+{
+    vec3 SP;
+    float b, d, t;
+
+    // Transform ray origin to object space
+    SP = C - ray.getOrigin();
+
+    // Solve the quadratic equation for t
+    b = vec3::dot(SP, ray.getDirection());
+    d = b * b - vec3::dot(SP, SP) + r * r;
+
+    if (d < 0.0f)
+    {
+        return false;
+    }
+
+    d = std::sqrt(d);
+
+    // Either root blocks the ray as long as it lies within the ray's interval
+    const float tmin = std::max(ray.mint, EPSILON);
+    t = b - d;
+    if (t > tmin && t <= ray.maxt)
+    {
+        return true;
+    }
+    t = b + d;
+
+    return t > tmin && t <= ray.maxt;
+}
+
 }
 
 #endif // SPHERE_H
@@ -1,5 +1,7 @@
 // std includes
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 
 // mirage includes
 #include "triangle.h"
@@ -8,41 +10,150 @@
 namespace mirage
 {
 
-	Triangle::Triangle(const Transform o2w, Material *m, std::array<Vertex, 3> vertices) : Shape(o2w, m), m_verticesInit(vertices)
+	// Möller-Trumbore against every lane of a packet, same steps as the scalar test below
+	static inline vmask intersectPacket(const RayPacket &packet, const vec3 &v0, const vec3 &edge_a, const vec3 &edge_b, const bool cull, vfloat &t, vfloat &u, vfloat &v)
 	{
-		update();
+		const vfloat eps(EPSILON);
+		const vfloat zero(0.0f);
+		const vfloat one(1.0f);
+
+		const vfloat dx = vfloat::load(packet.dx);
+		const vfloat dy = vfloat::load(packet.dy);
+		const vfloat dz = vfloat::load(packet.dz);
+
+		// P = cross(D, edge_b)
+		const vfloat px = dy * vfloat(edge_b.z) - vfloat(edge_b.y) * dz;
+		const vfloat py = dz * vfloat(edge_b.x) - vfloat(edge_b.z) * dx;
+		const vfloat pz = dx * vfloat(edge_b.y) - vfloat(edge_b.x) * dy;
+		const vfloat d = vfloat(edge_a.x) * px + vfloat(edge_a.y) * py + vfloat(edge_a.z) * pz;
+
+		vmask valid = cull ? (d >= eps) : ((d >= eps) | (d <= zero - eps));
+
+		// T = O - v0
+		const vfloat inv_d = one / d;
+		const vfloat tx = vfloat::load(packet.ox) - vfloat(v0.x);
+		const vfloat ty = vfloat::load(packet.oy) - vfloat(v0.y);
+		const vfloat tz = vfloat::load(packet.oz) - vfloat(v0.z);
+		u = (tx * px + ty * py + tz * pz) * inv_d;
+		valid = valid & (u >= zero) & (u <= one);
+
+		// Q = cross(T, edge_a)
+		const vfloat qx = ty * vfloat(edge_a.z) - vfloat(edge_a.y) * tz;
+		const vfloat qy = tz * vfloat(edge_a.x) - vfloat(edge_a.z) * tx;
+		const vfloat qz = tx * vfloat(edge_a.y) - vfloat(edge_a.x) * ty;
+		v = (dx * qx + dy * qy + dz * qz) * inv_d;
+		valid = valid & (v >= zero) & (u + v <= one);
+
+		t = (vfloat(edge_b.x) * qx + vfloat(edge_b.y) * qy + vfloat(edge_b.z) * qz) * inv_d;
+		return valid & (t >= eps);
+	}
+
+	Triangle::Triangle(const Transform o2w, Material *m, TriangleMesh *mesh, uint32_t index) : Shape(o2w, m), m_mesh(mesh), m_index(index)
+	{
+		// The mesh places the shared vertices, there's nothing left to update until it moves
+		m_objToWorld.setState(false);
 	}
 
 	void Triangle::update()
 	{
 		if (m_objToWorld.reqStateUpdate())
 		{
-			for (size_t i = 0; i < 3; i++)
-			{
-				m_verticesTransformed[i] = m_verticesInit[i] * m_objToWorld.getMatrix();
-			}
+			m_mesh->update();
+			m_objToWorld.setState(false);
 		}
 	}
 
 	AABB Triangle::objectBound() const
 	{
-		return AABB(getMinimum(m_verticesInit), getMaximum(m_verticesInit));
+		const uint32_t *idx = m_mesh->getIndices(m_index);
+		const vec3 v0 = m_mesh->getObjectPosition(idx[0]);
+		return AABB(v0, v0).addPoint(m_mesh->getObjectPosition(idx[1])).addPoint(m_mesh->getObjectPosition(idx[2]));
 	}
 
 	AABB Triangle::worldBound() const
 	{
-		return AABB(getMinimum(m_verticesTransformed), getMaximum(m_verticesTransformed));
+		const uint32_t *idx = m_mesh->getIndices(m_index);
+		const vec3 v0 = m_mesh->getPosition(idx[0]);
+		return AABB(v0, v0).addPoint(m_mesh->getPosition(idx[1])).addPoint(m_mesh->getPosition(idx[2]));
+	}
+
+	bool Triangle::clipBound(const int axis, const float min, const float max, AABB &bounds) const
+	{
+		// The clipped polygon's corners are the vertices inside the slab & the points where the edges cross its planes
+		vec3 pmin(INFINITY, INFINITY, INFINITY);
+		vec3 pmax(-INFINITY, -INFINITY, -INFINITY);
+		bool found = false;
+		bool crossed = false;
+
+		const uint32_t *idx = m_mesh->getIndices(m_index);
+		const vec3 v[3] = { m_mesh->getPosition(idx[0]), m_mesh->getPosition(idx[1]), m_mesh->getPosition(idx[2]) };
+		for (size_t i = 0; i < 3; i++)
+		{
+			const vec3 & a = v[i];
+			const vec3 & b = v[(i + 1) % 3];
+
+			if (a[axis] >= min && a[axis] <= max)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					pmin[k] = std::min(pmin[k], a[k]);
+					pmax[k] = std::max(pmax[k], a[k]);
+				}
+				found = true;
+			}
+
+			const float planes[2] = { min, max };
+			for (int j = 0; j < 2; j++)
+			{
+				const float plane = planes[j];
+				if ((a[axis] < plane && b[axis] > plane) || (a[axis] > plane && b[axis] < plane))
+				{
+					vec3 p = a + (b - a) * ((plane - a[axis]) / (b[axis] - a[axis]));
+					p[axis] = plane;
+					for (int k = 0; k < 3; k++)
+					{
+						pmin[k] = std::min(pmin[k], p[k]);
+						pmax[k] = std::max(pmax[k], p[k]);
+					}
+					found = true;
+					crossed = true;
+				}
+			}
+		}
+
+		if (!found)
+		{
+			return false;
+		}
+
+		// Crossings are interpolated, rounding the bounds outwards keeps the clipped parts covering the whole triangle
+		if (crossed)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				if (k != axis)
+				{
+					pmin[k] = std::nextafter(pmin[k], -INFINITY);
+					pmax[k] = std::nextafter(pmax[k], INFINITY);
+				}
+			}
+		}
+
+		bounds = AABB(pmin, pmax);
+
+		return true;
 	}
 
-	bool Triangle::intersect(const Ray &ray, Intersection &iSect) const
+	bool Triangle::intersect(const Ray &ray, Hit &hit) const
 	{
-		std::array<Vertex, 3> vertices = m_verticesTransformed;
+		const uint32_t *idx = m_mesh->getIndices(m_index);
+		const vec3 v0 = m_mesh->getPosition(idx[0]);
 
 		vec3 P, Q, T;
-		float d, inv_d, u, v, t, b0, b1, b2;
+		float d, inv_d, u, v, t;
 
-		const vec3 edge_a = vertices[1].getPosition() - vertices[0].getPosition();
-		const vec3 edge_b = vertices[2].getPosition() - vertices[0].getPosition();
+		const vec3 edge_a = m_mesh->getPosition(idx[1]) - v0;
+		const vec3 edge_b = m_mesh->getPosition(idx[2]) - v0;
 
 		P = vec3::cross(ray.getDirection(), edge_b);
 		d = vec3::dot(edge_a, P);
@@ -59,7 +170,7 @@ namespace mirage
 		}
 
 		inv_d = 1.0f / d;
-		T = ray.getOrigin() - vertices[0].getPosition();
+		T = ray.getOrigin() - v0;
 		u = vec3::dot(T, P) * inv_d;
 
 		if (u < 0.0f || u > 1.0f)
@@ -73,37 +184,60 @@ namespace mirage
 
 		t = vec3::dot(edge_b, Q) * inv_d;
 
-		if (t < EPSILON)
+		if (t < EPSILON || t < ray.mint || t >= hit.t)
 			return false;
 
-		// Get ray hit position
-		vec3 hit = ray(t);
+		// u & v are the barycentric coordinates of the second & third vertex
+		hit.t = t;
+		hit.u = u;
+		hit.v = v;
 
-		// Get barycentric coordinates
-		getBarycentric(hit, edge_a, edge_b, b0, b1, b2);
+		return true;
+	}
+
+	void Triangle::getIntersection(const Ray &ray, const Hit &hit, Intersection &iSect) const
+	{
+		const uint32_t *idx = m_mesh->getIndices(m_index);
+		const float b0 = 1.0f - hit.u - hit.v;
+		const float b1 = hit.u;
+		const float b2 = hit.v;
 
 		// Interpolate normal vector
-		const vec3 & N1 = vertices[0].getNormal();
-		const vec3 & N2 = vertices[1].getNormal();
-		const vec3 & N3 = vertices[2].getNormal();
+		const vec3 N1 = m_mesh->getNormal(idx[0]);
+		const vec3 N2 = m_mesh->getNormal(idx[1]);
+		const vec3 N3 = m_mesh->getNormal(idx[2]);
 		vec3 N = N1 + b1 * (N2 - N1) + b2 * (N3 - N1);
 
 		// Interpolate UV coordinates
-		const vec2 & UV1 = vertices[0].getTexcoord();
-		const vec2 & UV2 = vertices[1].getTexcoord();
-		const vec2 & UV3 = vertices[2].getTexcoord();
+		const vec2 UV1 = m_mesh->getTexcoord(idx[0]);
+		const vec2 UV2 = m_mesh->getTexcoord(idx[1]);
+		const vec2 UV3 = m_mesh->getTexcoord(idx[2]);
 		vec2 UV = UV1 * b0 + UV2 * b1 + UV3 * b2;
 
-		if (d < 0.0f)
+		// Back face hits, only refractive triangles get them
+		vec3 v0, edge_a, edge_b;
+		getEdges(v0, edge_a, edge_b);
+		if (vec3::dot(edge_a, vec3::cross(ray.getDirection(), edge_b)) < 0.0f)
 			N = N.negate();
 
-		iSect.setT(t);
-		iSect.setPosition(hit);
+		iSect.setT(hit.t);
+		iSect.setPosition(ray(hit.t));
 		iSect.setNormal(N.normalize());
 		iSect.setTexcoord(UV);
 		iSect.setMaterial(m_material);
+	}
 
-		return true;
+	void Triangle::getEdges(vec3 &v0, vec3 &edge_a, vec3 &edge_b) const
+	{
+		const uint32_t *idx = m_mesh->getIndices(m_index);
+		v0 = m_mesh->getPosition(idx[0]);
+		edge_a = m_mesh->getPosition(idx[1]) - v0;
+		edge_b = m_mesh->getPosition(idx[2]) - v0;
+	}
+
+	bool Triangle::isTwoSided() const
+	{
+		return m_material->isRefractive();
 	}
 
 	bool Triangle::intersectP(const Ray &ray) const
@@ -111,10 +245,10 @@ namespace mirage
 		vec3 P, Q, T;
 		float d, inv_d, u, v, t;
 
-		std::array<Vertex, 3> vertices = m_verticesTransformed;
-
-		const vec3 edge_a = vertices[1].getPosition() - vertices[0].getPosition();
-		const vec3 edge_b = vertices[2].getPosition() - vertices[0].getPosition();
+		const uint32_t *idx = m_mesh->getIndices(m_index);
+		const vec3 v0 = m_mesh->getPosition(idx[0]);
+		const vec3 edge_a = m_mesh->getPosition(idx[1]) - v0;
+		const vec3 edge_b = m_mesh->getPosition(idx[2]) - v0;
 
 		P = vec3::cross(ray.getDirection(), edge_b);
 		d = vec3::dot(edge_a, P);
@@ -123,7 +257,7 @@ namespace mirage
 			return false;
 
 		inv_d = 1.0f / d;
-		T = ray.getOrigin() - vertices[0].getPosition();
+		T = ray.getOrigin() - v0;
 		u = vec3::dot(T, P) * inv_d;
 
 		if (u < 0.0f || u > 1.0f)
@@ -137,58 +271,74 @@ namespace mirage
 
 		t = vec3::dot(edge_b, Q) * inv_d;
 
-		if (t < EPSILON)
+		// Only occluders within the ray's interval count
+		if (t < EPSILON || t < ray.mint || t > ray.maxt)
 			return false;
 
 		return true;
 	}
 
-	float Triangle::getSurfaceArea() const
+	int Triangle::intersect(const RayPacket &packet, const int mask, Hit *hits) const
 	{
-		return 0.0f;
-	}
+		const uint32_t *idx = m_mesh->getIndices(m_index);
+		const vec3 v0 = m_mesh->getPosition(idx[0]);
+		const vec3 edge_a = m_mesh->getPosition(idx[1]) - v0;
+		const vec3 edge_b = m_mesh->getPosition(idx[2]) - v0;
+
+		// Only keep hits within [mint, hit.t) of each lane, same as the single ray test
+		float t_closest[RayPacket::WIDTH];
+		for (unsigned i = 0; i < RayPacket::WIDTH; i++)
+			t_closest[i] = hits[i].t;
+
+		vfloat t(0.0f), u(0.0f), v(0.0f);
+		// t is only set once the test returns, so it can't share an expression with it
+		vmask valid = intersectPacket(packet, v0, edge_a, edge_b, !m_material->isRefractive(), t, u, v);
+		valid = valid & (t >= vfloat::load(packet.mint)) & (t < vfloat::load(t_closest));
+		const int result = movemask(valid) & mask;
+
+		if (result)
+		{
+			float lanes[3][RayPacket::WIDTH];
+			t.store(lanes[0]);
+			u.store(lanes[1]);
+			v.store(lanes[2]);
+			for (unsigned i = 0; i < RayPacket::WIDTH; i++)
+			{
+				if (result & (1 << i))
+				{
+					hits[i].t = lanes[0][i];
+					hits[i].u = lanes[1][i];
+					hits[i].v = lanes[2][i];
+				}
+			}
+		}
 
-	void Triangle::getBarycentric(const vec3 &p, const vec3 &e1, const vec3 &e2, float &b0, float &b1, float &b2) const
-	{
-		// Find the point from first vertice to the requested point
-		const vec3 w = p - m_verticesTransformed[0].getPosition();
-
-		// Find the perpendicular vectors
-		const vec3 vCrossW = vec3::cross(e2, w);
-		const vec3 uCrossW = vec3::cross(e1, w);
-		const vec3 uCrossV = vec3::cross(e1, e2);
-
-		// Find the barycentric coordinates
-		const float denom = uCrossV.length();
-		const float r = vCrossW.length() / denom;
-		const float t = uCrossW.length() / denom;
-
-		// Insert found values to the output variables
-		b0 = 1.0f - r - t;
-		b1 = r;
-		b2 = t;
+		return result;
 	}
 
-	vec3 Triangle::getMinimum(const std::array<Vertex, 3> &v) const
+	int Triangle::intersectP(const RayPacket &packet, const int mask) const
 	{
-		vec3 result;
+		const uint32_t *idx = m_mesh->getIndices(m_index);
+		const vec3 v0 = m_mesh->getPosition(idx[0]);
+		const vec3 edge_a = m_mesh->getPosition(idx[1]) - v0;
+		const vec3 edge_b = m_mesh->getPosition(idx[2]) - v0;
 
-		result.x = std::min(v[0].getPosition().x, std::min(v[1].getPosition().x, v[2].getPosition().x));
-		result.y = std::min(v[0].getPosition().y, std::min(v[1].getPosition().y, v[2].getPosition().y));
-		result.z = std::min(v[0].getPosition().z, std::min(v[1].getPosition().z, v[2].getPosition().z));
+		// Back faces never block, just like the single ray test
+		vfloat t(0.0f), u(0.0f), v(0.0f);
+		vmask valid = intersectPacket(packet, v0, edge_a, edge_b, true, t, u, v);
+		valid = valid & (t >= vfloat::load(packet.mint)) & (t <= vfloat::load(packet.maxt));
 
-		return result;
+		return movemask(valid) & mask;
 	}
 
-	vec3 Triangle::getMaximum(const std::array<Vertex, 3> &v) const
+	float Triangle::getSurfaceArea() const
 	{
-		vec3 result;
-
-		result.x = std::max(v[0].getPosition().x, std::max(v[1].getPosition().x, v[2].getPosition().x));
-		result.y = std::max(v[0].getPosition().y, std::max(v[1].getPosition().y, v[2].getPosition().y));
-		result.z = std::max(v[0].getPosition().z, std::max(v[1].getPosition().z, v[2].getPosition().z));
+		return 0.0f;
+	}
 
-		return result;
+	ShapeType Triangle::getType() const
+	{
+		return SHAPE_TRIANGLE;
 	}
 
 }
@@ -2,31 +2,35 @@
 #define TRIANGLE_H
 
 // std includes
-#include <array>
+#include <cstdint>
 
 // mirage includes
 #include "../core/shape.h"
-#include "../core/vertex.h"
+#include "trianglemesh.h"
 
 namespace mirage
 {
 
-class Triangle : public virtual Shape
+class Triangle : public Shape
 {
 public:
-    Triangle(const Transform o2w, Material *m = nullptr, std::array<Vertex, 3> vertices = { });
+    Triangle(const Transform o2w, Material *m, TriangleMesh *mesh, uint32_t index);
     virtual void update() override;
     virtual AABB objectBound() const override;
     virtual AABB worldBound() const override;
-    virtual bool intersect(const Ray &ray, Intersection &iSect) const override;
+    virtual bool clipBound(const int axis, const float min, const float max, AABB &bounds) const override;
+    virtual bool intersect(const Ray &ray, Hit &hit) const override;
+    virtual void getIntersection(const Ray &ray, const Hit &hit, Intersection &iSect) const override;
     virtual bool intersectP(const Ray &ray) const override;
+    virtual int intersect(const RayPacket &packet, const int mask, Hit *hits) const override;
+    virtual int intersectP(const RayPacket &packet, const int mask) const override;
     virtual float getSurfaceArea() const override;
-    void getBarycentric(const vec3 &p, const vec3 &e1, const vec3 &e2, float &u, float &v, float &w) const;
-    vec3 getMinimum(const std::array<Vertex, 3> &v) const;
-    vec3 getMaximum(const std::array<Vertex, 3> &v) const;
+    virtual ShapeType getType() const override;
+    void getEdges(vec3 &v0, vec3 &edge_a, vec3 &edge_b) const;
+    bool isTwoSided() const;
 private:
-    std::array<Vertex, 3> m_verticesInit;
-    std::array<Vertex, 3> m_verticesTransformed;
+    TriangleMesh *m_mesh;
+    uint32_t m_index;
 };
 
 }
@@ -0,0 +1,100 @@
+#include "trianglemesh.h"
+
+// std includes
+#include <iostream>
+
+// mirage includes
+#include "../macros.h"
+#include "../math/mat4.h"
+
+namespace mirage
+{
+
+	TriangleMesh::TriangleMesh() : m_stale(true)
+	{
+
+	}
+
+	uint32_t TriangleMesh::addVertex(const vec3 &p, const vec3 &n, const vec2 &t)
+	{
+		m_px.push_back(p.x);
+		m_py.push_back(p.y);
+		m_pz.push_back(p.z);
+		m_nx.push_back(n.x);
+		m_ny.push_back(n.y);
+		m_nz.push_back(n.z);
+		m_tu.push_back(t.x);
+		m_tv.push_back(t.y);
+		m_stale = true;
+
+		return static_cast<uint32_t>(m_px.size() - 1);
+	}
+
+	uint32_t TriangleMesh::addTriangle(const uint32_t a, const uint32_t b, const uint32_t c)
+	{
+		m_indices.push_back(a);
+		m_indices.push_back(b);
+		m_indices.push_back(c);
+
+		return static_cast<uint32_t>(m_indices.size() / 3 - 1);
+	}
+
+	void TriangleMesh::setTransform(const Transform &o2w)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_objToWorld = o2w;
+		m_stale = true;
+	}
+
+	void TriangleMesh::update()
+	{
+		// Every triangle of a moved mesh calls this, possibly from several threads, only the first does the work
+		if (!m_stale.load(std::memory_order_acquire))
+			return;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_stale.load(std::memory_order_relaxed))
+			return;
+
+		const std::size_t count = m_px.size();
+		m_wpx.resize(count);
+		m_wpy.resize(count);
+		m_wpz.resize(count);
+		m_wnx.resize(count);
+		m_wny.resize(count);
+		m_wnz.resize(count);
+
+		// Same as multiplying each Vertex by the matrix
+		const mat4 m = m_objToWorld.getMatrix();
+		for (std::size_t i = 0; i < count; i++)
+		{
+			const vec4 p = m * vec4(m_px[i], m_py[i], m_pz[i], 1.0f);
+			const vec4 n = m * vec4(m_nx[i], m_ny[i], m_nz[i], 0.0f);
+			const vec3 nw = vec3(n.x, n.y, n.z).normalize();
+			m_wpx[i] = p.x;
+			m_wpy[i] = p.y;
+			m_wpz[i] = p.z;
+			m_wnx[i] = nw.x;
+			m_wny[i] = nw.y;
+			m_wnz[i] = nw.z;
+		}
+
+		m_stale.store(false, std::memory_order_release);
+	}
+
+	std::size_t TriangleMesh::getVertexCount() const
+	{
+		return m_px.size();
+	}
+
+	std::size_t TriangleMesh::getTriangleCount() const
+	{
+		return m_indices.size() / 3;
+	}
+
+	std::size_t TriangleMesh::getMemoryUsage() const
+	{
+		return m_px.size() * 14 * sizeof(float) + m_indices.size() * sizeof(uint32_t);
+	}
+
+}
@@ -0,0 +1,81 @@
+#ifndef TRIANGLEMESH_H
+#define TRIANGLEMESH_H
+
+// std includes
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+// mirage includes
+#include "../math/vec2.h"
+#include "../math/vec3.h"
+#include "../core/transform.h"
+
+namespace mirage
+{
+
+	// ---------------------------------------------------------------------------
+	// TriangleMesh
+	// Vertex attributes shared by all triangles of a mesh, one array per
+	// component, and an index buffer with three entries per triangle. Positions
+	// and normals are kept as loaded and as placed by the mesh's transform;
+	// update() places them again after setTransform(), once no matter how many
+	// triangles ask for it.
+	// ---------------------------------------------------------------------------
+	class TriangleMesh
+	{
+	public:
+		TriangleMesh();
+
+		uint32_t addVertex(const vec3 &p, const vec3 &n, const vec2 &t);
+		uint32_t addTriangle(const uint32_t a, const uint32_t b, const uint32_t c);
+		void setTransform(const Transform &o2w);
+		void update();
+		std::size_t getVertexCount() const;
+		std::size_t getTriangleCount() const;
+		std::size_t getMemoryUsage() const;
+
+		inline const uint32_t *getIndices(const uint32_t triangle) const
+		{
+			return &m_indices[3 * triangle];
+		}
+
+		inline vec3 getPosition(const uint32_t v) const
+		{
+			return vec3(m_wpx[v], m_wpy[v], m_wpz[v]);
+		}
+
+		inline vec3 getObjectPosition(const uint32_t v) const
+		{
+			return vec3(m_px[v], m_py[v], m_pz[v]);
+		}
+
+		inline vec3 getNormal(const uint32_t v) const
+		{
+			return vec3(m_wnx[v], m_wny[v], m_wnz[v]);
+		}
+
+		inline vec2 getTexcoord(const uint32_t v) const
+		{
+			return vec2(m_tu[v], m_tv[v]);
+		}
+	private:
+		TriangleMesh(const TriangleMesh &);
+		TriangleMesh &operator=(const TriangleMesh &);
+
+		std::vector<float> m_px, m_py, m_pz;
+		std::vector<float> m_nx, m_ny, m_nz;
+		std::vector<float> m_tu, m_tv;
+		std::vector<float> m_wpx, m_wpy, m_wpz;
+		std::vector<float> m_wnx, m_wny, m_wnz;
+		std::vector<uint32_t> m_indices;
+		Transform m_objToWorld;
+		std::mutex m_mutex;
+		std::atomic<bool> m_stale;
+	};
+
+}
+
+#endif // TRIANGLEMESH_H
@@ -0,0 +1,123 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace mirage
+{
+
+	MappedFile::MappedFile() :
+		m_data(nullptr),
+		m_size(0)
+#ifdef _WIN32
+		, m_file(INVALID_HANDLE_VALUE),
+		m_mapping(nullptr)
+#endif
+	{
+
+	}
+
+	MappedFile::~MappedFile()
+	{
+		close();
+	}
+
+	bool MappedFile::open(const std::string & path)
+	{
+		close();
+
+#ifdef _WIN32
+		m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (m_file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+		{
+			close();
+			return false;
+		}
+
+		m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+		m_data = m_mapping ? static_cast<unsigned char *>(MapViewOfFile(m_mapping, FILE_MAP_COPY, 0, 0, 0)) : nullptr;
+		if (!m_data)
+		{
+			close();
+			return false;
+		}
+		m_size = static_cast<std::size_t>(size.QuadPart);
+#else
+		const int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			::close(fd);
+			return false;
+		}
+
+		// The mapping stays valid after the descriptor is closed
+		void * data = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (data == MAP_FAILED)
+			return false;
+
+		m_data = static_cast<unsigned char *>(data);
+		m_size = static_cast<std::size_t>(st.st_size);
+#endif
+
+		return true;
+	}
+
+	void MappedFile::close()
+	{
+#ifdef _WIN32
+		if (m_data)
+			UnmapViewOfFile(m_data);
+		if (m_mapping)
+			CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE)
+			CloseHandle(m_file);
+		m_mapping = nullptr;
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		if (m_data)
+			munmap(m_data, m_size);
+#endif
+
+		m_data = nullptr;
+		m_size = 0;
+	}
+
+	bool MappedFile::isOpen() const
+	{
+		return m_data != nullptr;
+	}
+
+	bool MappedFile::contains(const void * ptr) const
+	{
+		const unsigned char * p = static_cast<const unsigned char *>(ptr);
+		return m_data && p >= m_data && p < m_data + m_size;
+	}
+
+	unsigned char * MappedFile::getData() const
+	{
+		return m_data;
+	}
+
+	std::size_t MappedFile::getSize() const
+	{
+		return m_size;
+	}
+
+}
@@ -0,0 +1,43 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+// std includes
+#include <cstddef>
+#include <string>
+
+namespace mirage
+{
+
+	// ---------------------------------------------------------------------------
+	// MappedFile
+	// Maps a whole file into memory copy-on-write: the contents can be modified
+	// in place, but the changes never reach the file. Unmapped on close() or
+	// destruction.
+	// ---------------------------------------------------------------------------
+	class MappedFile
+	{
+	public:
+		MappedFile();
+		~MappedFile();
+
+		bool open(const std::string & path);
+		void close();
+		bool isOpen() const;
+		bool contains(const void * ptr) const;
+		unsigned char * getData() const;
+		std::size_t getSize() const;
+	private:
+		MappedFile(const MappedFile &);
+		MappedFile & operator=(const MappedFile &);
+
+		unsigned char * m_data;
+		std::size_t m_size;
+#ifdef _WIN32
+		void * m_file;
+		void * m_mapping;
+#endif
+	};
+
+}
+
+#endif // MAPPEDFILE_H
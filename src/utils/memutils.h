@@ -0,0 +1,45 @@
+#ifndef MEMUTILS_H
+#define MEMUTILS_H
+
+// std includes
+#include <cstddef>
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace mirage
+{
+
+	// ---------------------------------------------------------------------------
+	// alignedAlloc
+	// Allocates size bytes starting at a multiple of alignment (a power of two).
+	// Must be released with alignedFree.
+	// ---------------------------------------------------------------------------
+	inline void * alignedAlloc(const std::size_t size, const std::size_t alignment)
+	{
+#ifdef _WIN32
+		return _aligned_malloc(size, alignment);
+#else
+		void * ptr = nullptr;
+		return posix_memalign(&ptr, alignment, size) == 0 ? ptr : nullptr;
+#endif
+	}
+
+	// ---------------------------------------------------------------------------
+	// alignedFree
+	// Releases memory from alignedAlloc, null is ignored.
+	// ---------------------------------------------------------------------------
+	inline void alignedFree(void * ptr)
+	{
+#ifdef _WIN32
+		_aligned_free(ptr);
+#else
+		std::free(ptr);
+#endif
+	}
+
+}
+
+#endif // MEMUTILS_H